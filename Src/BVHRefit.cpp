@@ -0,0 +1,225 @@
+#include "BVHRefit.hpp"
+
+namespace
+{
+
+// a region holds at most this fraction of the triangles, so there are enough of them to keep every
+// worker busy and a degraded spot is rebuilt without touching the rest
+const uint32_t REFIT_REGIONS         = 64;
+const uint32_t REFIT_REGION_MIN_SIZE = 256;
+
+struct RefitJob
+{
+	BVHRefitter    *refitter;
+	BVHNode        *nodes;
+	const Triangle *triangles;
+};
+
+// Summed SAH weight of a subtree as stored: node areas, leaves weighted by their triangle count.
+float subtreeArea( const BVHNode *nodes, uint32_t nodeIdx, uint32_t &nodeEnd, int &depth )
+{
+	const BVHNode &node = nodes[nodeIdx];
+	nodeEnd             = std::max( nodeEnd, nodeIdx + 1 );
+	if ( node.isLeaf() )
+	{
+		depth = 1;
+		return node.bbox.surfaceArea() * node.count;
+	}
+
+	int   leftDepth, rightDepth;
+	float area = node.bbox.surfaceArea() + subtreeArea( nodes, nodeIdx + 1, nodeEnd, leftDepth ) +
+	             subtreeArea( nodes, node.offset, nodeEnd, rightDepth );
+	depth      = 1 + std::max( leftDepth, rightDepth );
+	return area;
+}
+
+// Recomputes the boxes of a subtree from its triangles, children first; adds its SAH weight to `area`.
+AABB refitSubtree( BVHNode *nodes, uint32_t nodeIdx, const Triangle *triangles, float &area )
+{
+	BVHNode &node = nodes[nodeIdx];
+	AABB     bbox;
+	if ( node.isLeaf() )
+	{
+		for ( uint32_t i = node.offset; i < node.offset + node.count; i++ )
+		{
+			bbox = AABB::combine( bbox, triangles[i].bounds() );
+		}
+		node.bbox = bbox;
+		area += bbox.surfaceArea() * node.count;
+		return bbox;
+	}
+
+	AABB left  = refitSubtree( nodes, nodeIdx + 1, triangles, area );
+	AABB right = refitSubtree( nodes, node.offset, triangles, area );
+	bbox       = AABB::combine( left, right );
+	node.bbox  = bbox;
+	area += bbox.surfaceArea();
+	return bbox;
+}
+
+inline float relativeCost( float area, const AABB &rootBox )
+{
+	float rootArea = rootBox.surfaceArea();
+	return rootArea > 0.0f ? area / rootArea : 0.0f;
+}
+
+// Builds a fresh SAH tree over the region's triangles and writes it over the region's node slots; slots
+// the new tree does not need are left unreferenced. False when it needs more slots or would get deeper
+// than the traversal stacks allow.
+bool rebuildRegion( std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles, RefitRegion &region )
+{
+	std::vector<BVHPrimitive> prims( region.triangleCount );
+	for ( uint32_t i = 0; i < region.triangleCount; i++ )
+	{
+		AABB box = triangles[region.firstTriangle + i].bounds();
+		prims[i] = { box, box.getCenter(), i };
+	}
+
+	std::vector<BVHNode> subtree;
+	buildBVH( prims, subtree );
+
+	uint32_t end   = 0;
+	int      depth = 0;
+	float    area  = subtreeArea( subtree.data(), 0, end, depth );
+	if ( subtree.size() > region.nodeEnd - region.root || region.depth + depth > BVH_MAX_DEPTH )
+		return false;
+
+	std::vector<Triangle> reordered( region.triangleCount );
+	for ( uint32_t i = 0; i < region.triangleCount; i++ )
+	{
+		reordered[i] = triangles[region.firstTriangle + prims[i].index];
+	}
+	std::copy( reordered.begin(), reordered.end(), triangles.begin() + region.firstTriangle );
+
+	for ( uint32_t i = 0; i < subtree.size(); i++ )
+	{
+		BVHNode node = subtree[i];
+		node.offset += node.isLeaf() ? region.firstTriangle : region.root;
+		nodes[region.root + i] = node;
+	}
+
+	region.builtCost = region.cost = relativeCost( area, subtree[0].bbox );
+	region.area                    = area;
+	return true;
+}
+
+} // namespace
+
+void BVHRefitter::init( const std::vector<BVHNode> &nodes )
+{
+	regions.clear();
+	topNodes.clear();
+	builtCost = 0.0f;
+	if ( nodes.empty() )
+		return;
+
+	// triangle ranges are contiguous per subtree, so the root covers [0, total)
+	uint32_t total = 0;
+	for ( const BVHNode &node : nodes )
+	{
+		if ( node.isLeaf() )
+			total = std::max( total, node.offset + node.count );
+	}
+	uint32_t regionSize = std::max<uint32_t>( REFIT_REGION_MIN_SIZE, total / REFIT_REGIONS );
+
+	// walk down from the root, splitting until a subtree is small enough (or a leaf)
+	struct Pending
+	{
+		uint32_t node, first, count;
+		int      depth;
+	};
+	std::vector<Pending> pending = { { 0, 0, total, 0 } };
+	float                topArea = 0.0f;
+	while ( !pending.empty() )
+	{
+		Pending item = pending.back();
+		pending.pop_back();
+
+		const BVHNode &node = nodes[item.node];
+		if ( node.isLeaf() || item.count <= regionSize )
+		{
+			RefitRegion region;
+			region.root          = item.node;
+			region.nodeEnd       = 0;
+			region.firstTriangle = item.first;
+			region.triangleCount = item.count;
+			int depth;
+			region.area      = subtreeArea( nodes.data(), item.node, region.nodeEnd, depth );
+			region.depth     = item.depth;
+			region.builtCost = region.cost = relativeCost( region.area, node.bbox );
+			regions.push_back( region );
+			continue;
+		}
+
+		// the right subtree's triangles begin at its leftmost leaf
+		uint32_t leftmost = node.offset;
+		while ( !nodes[leftmost].isLeaf() )
+			leftmost++;
+		uint32_t split = nodes[leftmost].offset;
+
+		topNodes.push_back( item.node );
+		topArea += node.bbox.surfaceArea();
+		pending.push_back( { node.offset, split, item.first + item.count - split, item.depth + 1 } );
+		pending.push_back( { item.node + 1, item.first, split - item.first, item.depth + 1 } );
+	}
+
+	float area = topArea;
+	for ( const RefitRegion &region : regions )
+	{
+		area += region.area;
+	}
+	builtCost = relativeCost( area, nodes[0].bbox );
+}
+
+RefitResult BVHRefitter::refit( std::vector<BVHNode>  &nodes,
+                                std::vector<Triangle> &triangles,
+                                ThreadPool            &pool )
+{
+	RefitJob job = { this, nodes.data(), triangles.data() };
+	pool.parallelFor( regions.size(),
+	                  [&job]( int i, int )
+	                  {
+		                  RefitRegion &region = job.refitter->regions[i];
+		                  float        area   = 0.0f;
+		                  AABB         bbox   = refitSubtree( job.nodes, region.root, job.triangles, area );
+		                  region.area         = area;
+		                  region.cost         = relativeCost( area, bbox );
+	                  } );
+
+	// the nodes above the regions, children before parents
+	float topArea = 0.0f;
+	for ( size_t i = topNodes.size(); i-- > 0; )
+	{
+		BVHNode &node = nodes[topNodes[i]];
+		node.bbox     = AABB::combine( nodes[topNodes[i] + 1].bbox, nodes[node.offset].bbox );
+		topArea += node.bbox.surfaceArea();
+	}
+
+	float area = topArea;
+	for ( const RefitRegion &region : regions )
+	{
+		area += region.area;
+	}
+	if ( relativeCost( area, nodes[0].bbox ) > REFIT_FULL_REBUILD_RATIO * builtCost )
+		return RefitResult::NeedsRebuild;
+
+	bool rebuilt = false;
+	for ( RefitRegion &region : regions )
+	{
+		if ( region.cost <= REFIT_SUBTREE_REBUILD_RATIO * region.builtCost )
+			continue;
+		if ( !rebuildRegion( nodes, triangles, region ) )
+			return RefitResult::NeedsRebuild;
+		rebuilt = true;
+	}
+	if ( !rebuilt )
+		return RefitResult::Refitted;
+
+	// a rebuilt region may have a tighter root box
+	for ( size_t i = topNodes.size(); i-- > 0; )
+	{
+		BVHNode &node = nodes[topNodes[i]];
+		node.bbox     = AABB::combine( nodes[topNodes[i] + 1].bbox, nodes[node.offset].bbox );
+	}
+	return RefitResult::PartiallyRebuilt;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Math.hpp"
+#include "ThreadPool.hpp"
+
+// Quality thresholds for refitted trees, as SAH cost over the cost right after the (re)build: a subtree
+// past the first is rebuilt in place, a whole tree past the second needs a full build.
+const float REFIT_SUBTREE_REBUILD_RATIO = 1.5f;
+const float REFIT_FULL_REBUILD_RATIO    = 2.0f;
+
+enum class RefitResult
+{
+	Refitted,         // bounds updated, topology kept
+	PartiallyRebuilt, // degraded subtrees were rebuilt in place as well
+	NeedsRebuild,     // the tree as a whole degraded too far; BVHRefitter only
+	Rebuilt,          // a full build was done instead; Mesh::refit() only
+};
+
+// Subtree refitted as one task and rebuilt on its own when it degrades. Its nodes lie in [root, nodeEnd)
+// and its triangles in [firstTriangle, firstTriangle + triangleCount).
+struct RefitRegion
+{
+	uint32_t root;
+	uint32_t nodeEnd;
+	uint32_t firstTriangle;
+	uint32_t triangleCount;
+	int      depth;     // of `root` below the tree's root
+	float    builtCost; // SAH cost relative to the root box, as built
+	float    cost;      // same after the last refit
+	float    area;      // unnormalized cost of the last refit, summed into the whole tree's
+};
+
+// Refits a TriangleBVH in place after its triangles moved: the tree is cut into regions that are
+// refitted bottom-up in parallel, then the few nodes above them. Nothing is allocated unless a subtree
+// has to be rebuilt. init() again after every full build.
+struct BVHRefitter
+{
+	std::vector<RefitRegion> regions;
+	std::vector<uint32_t>    topNodes; // interior nodes above the regions, parents first
+	float                    builtCost = 0.0f;
+
+	void init( const std::vector<BVHNode> &nodes );
+
+	// Updates the node boxes from `triangles` (same count and order as at the build; only moved).
+	RefitResult refit( std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles, ThreadPool &pool );
+
+	bool empty() const
+	{
+		return regions.empty();
+	}
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Math.hpp"
+#include "Stats.hpp"
+
+// Iterative front-to-back traversal of a non-empty node array. `leaf( offset, count )` tests a primitive
+// range and returns whether it shortened `hit.t`; nodes whose entry distance lies beyond the current hit
+// are skipped.
+template <typename LeafFn>
+bool traverseBVH( const BVHNode *nodes, const Ray &ray, Hit &hit, LeafFn leaf )
+{
+	STATS_ADD( boxTests, 1 );
+	float tMin, tMax;
+	if ( !nodes[0].bbox.intersect( ray, tMin, tMax ) || tMax < 0.001f || tMin > hit.t )
+		return false;
+
+	struct Entry
+	{
+		uint32_t node;
+		float    tMin;
+	};
+	Entry stack[BVH_MAX_DEPTH];
+	int   stackSize = 0;
+
+	bool     hitAnything = false;
+	uint32_t nodeIdx     = 0;
+	uint32_t visited     = 0; // counted locally, flushed to the stats once per ray
+	uint32_t interior    = 0;
+	while ( true )
+	{
+		const BVHNode &node = nodes[nodeIdx];
+		visited++;
+		if ( node.isLeaf() )
+		{
+			hitAnything |= leaf( node.offset, node.count );
+		}
+		else
+		{
+			interior++;
+			uint32_t near = nodeIdx + 1;
+			uint32_t far  = node.offset;
+			float    tNear, tFar, tNearExit, tFarExit;
+			bool     hitNear = nodes[near].bbox.intersect( ray, tNear, tNearExit );
+			bool     hitFar  = nodes[far].bbox.intersect( ray, tFar, tFarExit );
+			hitNear          = hitNear && tNearExit >= 0.001f && tNear <= hit.t;
+			hitFar           = hitFar && tFarExit >= 0.001f && tFar <= hit.t;
+
+			if ( hitNear && hitFar )
+			{
+				if ( tFar < tNear )
+				{
+					std::swap( near, far );
+					std::swap( tNear, tFar );
+				}
+				stack[stackSize++] = { far, tFar };
+				nodeIdx            = near;
+				continue;
+			}
+			if ( hitNear || hitFar )
+			{
+				nodeIdx = hitNear ? near : far;
+				continue;
+			}
+		}
+
+		// pop the next subtree that can still contain a closer hit
+		while ( stackSize > 0 && stack[stackSize - 1].tMin > hit.t )
+		{
+			stackSize--;
+		}
+		if ( stackSize == 0 )
+			break;
+		nodeIdx = stack[--stackSize].node;
+	}
+
+	STATS_ADD( nodesVisited, visited );
+	STATS_ADD( boxTests, 2 * interior );
+	return hitAnything;
+}
@@ -0,0 +1,516 @@
+// End-to-end benchmark: builds a fixed set of scenes, renders each headless for a fixed sample count
+// and prints the results as JSON on stdout. Progress goes to stderr so the output can be piped.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+
+#include "Options.hpp"
+#include "Renderer.hpp"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+using SphereList = std::vector<Sphere>;
+
+// Deforming scenes refit their first mesh after each of REFIT_STEPS animation steps and cast REFIT_RAYS
+// camera rays per step against it and a freshly built copy.
+const int REFIT_STEPS = 8;
+const int REFIT_RAYS  = 1 << 16;
+
+struct BenchScene
+{
+	std::string name;
+	// creates the geometry; the BVHs are built afterwards so their build time can be measured alone
+	std::function<void( SphereList &, Scene & )> generate;
+	Vec3                                         cameraPosition;
+	float                                        cameraYaw;
+	float                                        cameraPitch;
+	// moves the vertices of the first mesh in place for animation step `step`; static scenes have none
+	std::function<void( Mesh &, int step )> deform = nullptr;
+};
+
+// Refit against rebuild over the animation steps of a deforming scene, times per step.
+struct RefitBench
+{
+	double refitMs          = 0.0;
+	double rebuildMs        = 0.0;
+	int    refitted         = 0; // steps by RefitResult
+	int    partiallyRebuilt = 0;
+	int    rebuilt          = 0;
+	int    mismatches       = 0; // rays whose hit differs between the refitted and the rebuilt tree
+};
+
+struct BenchSettings
+{
+	RenderSettings           render;
+	int                      threads = defaultThreadCount();
+	int                      spp     = 8;
+	BVHBuildMode             bvhMode = BVHBuildMode::SAH;
+	std::vector<std::string> only; // scene names to run, all when empty
+	std::string              output;
+};
+
+// UV sphere with a ripple on the radius so BVH leaves see non-trivial overlap; 4 * rings^2 triangles.
+Mesh makeBumpySphere( Vec3 center, float radius, int rings )
+{
+	Mesh mesh;
+	int  segments = rings * 2;
+	auto point    = [&]( int ring, int segment )
+	{
+		float theta = M_PI * ring / rings;
+		float phi   = 2 * M_PI * segment / segments;
+		float r     = radius * ( 1.0f + 0.05f * std::sin( 12 * theta ) * std::sin( 12 * phi ) );
+		return center + Vec3( std::sin( theta ) * std::cos( phi ), std::cos( theta ),
+		                      std::sin( theta ) * std::sin( phi ) ) *
+		                    r;
+	};
+
+	mesh.triangles.reserve( size_t( rings ) * segments * 2 );
+	for ( int ring = 0; ring < rings; ring++ )
+	{
+		for ( int segment = 0; segment < segments; segment++ )
+		{
+			Vec3 a = point( ring, segment ), b = point( ring + 1, segment );
+			Vec3 c = point( ring + 1, segment + 1 ), d = point( ring, segment + 1 );
+			mesh.triangles.emplace_back( a, b, c, Vec3( 0.9f, 0.6f, 0.3f ), false );
+			mesh.triangles.emplace_back( a, c, d, Vec3( 0.9f, 0.6f, 0.3f ), false );
+		}
+	}
+	return mesh;
+}
+
+// Turns every vertex of `mesh` above `base` about the vertical axis through it by `radiansPerUnit` times
+// its height above `base`, so the mesh's top twists a bit further with every call.
+void twistMesh( Mesh &mesh, Vec3 base, float radiansPerUnit )
+{
+	auto twist = [&]( Vec3 p )
+	{
+		float angle = radiansPerUnit * std::max( p.y - base.y, 0.0f );
+		float c = std::cos( angle ), s = std::sin( angle );
+		Vec3  d     = p - base;
+		return base + Vec3( c * d.x - s * d.z, d.y, s * d.x + c * d.z );
+	};
+	for ( Triangle &tri : mesh.triangles )
+	{
+		tri = Triangle(
+		    twist( tri.v0 ), twist( tri.v1 ), twist( tri.v2 ), tri.color, tri.reflective, tri.emission );
+	}
+}
+
+// Rolling height field of 2 * cells^2 triangles covering [-size, size] around the origin.
+Mesh makeTerrain( float size, int cells )
+{
+	Mesh mesh;
+	auto point = [&]( int i, int j )
+	{
+		float x = -size + 2 * size * i / cells;
+		float z = -size + 2 * size * j / cells;
+		float h = 0.6f + 0.4f * std::sin( x * 0.9f ) * std::cos( z * 0.7f );
+		h += 0.1f * std::sin( x * 5 + z * 3 );
+		return Vec3( x, h, z );
+	};
+
+	mesh.triangles.reserve( size_t( cells ) * cells * 2 );
+	for ( int i = 0; i < cells; i++ )
+	{
+		for ( int j = 0; j < cells; j++ )
+		{
+			Vec3 a = point( i, j ), b = point( i, j + 1 ), c = point( i + 1, j + 1 ), d = point( i + 1, j );
+			mesh.triangles.emplace_back( a, b, c, Vec3( 0.4f, 0.7f, 0.3f ), false );
+			mesh.triangles.emplace_back( a, c, d, Vec3( 0.4f, 0.7f, 0.3f ), false );
+		}
+	}
+	return mesh;
+}
+
+// `count` random spheres filling a box in front of the camera, a tenth of them mirrors.
+SphereList makeSphereCloud( int count )
+{
+	std::mt19937                          rng( 1234 );
+	std::uniform_real_distribution<float> dist( 0, 1 );
+
+	Vec3       boxMin( -6, 0.2f, -16 ), boxMax( 6, 5, -4 );
+	Vec3       extent  = boxMax - boxMin;
+	float      spacing = std::cbrt( extent.x * extent.y * extent.z / count );
+	SphereList spheres;
+	spheres.reserve( count );
+	for ( int i = 0; i < count; i++ )
+	{
+		Vec3  center = boxMin + Vec3( dist( rng ), dist( rng ), dist( rng ) ) * extent;
+		float radius = spacing * ( 0.1f + 0.3f * dist( rng ) );
+		Vec3  color( 0.2f + 0.8f * dist( rng ), 0.2f + 0.8f * dist( rng ), 0.2f + 0.8f * dist( rng ) );
+		spheres.push_back( { center, radius, color, dist( rng ) < 0.1f } );
+	}
+	return spheres;
+}
+
+std::vector<BenchScene> benchScenes()
+{
+	const Vec3 front( 0, 2, 6 );
+	return {
+	    { "spheres",
+	      []( SphereList &spheres, Scene & ) { spheres = defaultSpheres(); },
+	      front,
+	      -90,
+	      -10 },
+	    { "bumpy_sphere_250k",
+	      []( SphereList &spheres, Scene &scene )
+	      {
+		      spheres = defaultSpheres();
+		      addMesh( scene, makeBumpySphere( Vec3( 0, 1.5f, -4 ), 1.5f, 250 ) );
+	      },
+	      front,
+	      -90,
+	      -10 },
+	    { "twisting_sphere_250k",
+	      []( SphereList &spheres, Scene &scene )
+	      {
+		      // the bumpy sphere again with its cap twisted further every animation step: mostly refits, with
+		      // the cap's subtrees rebuilt once they degrade and the odd full rebuild
+		      spheres = defaultSpheres();
+		      addMesh( scene, makeBumpySphere( Vec3( 0, 1.5f, -4 ), 1.5f, 250 ) );
+	      },
+	      front,
+	      -90,
+	      -10,
+	      []( Mesh &mesh, int ) { twistMesh( mesh, Vec3( 0, 2.5f, -4 ), 2.0f ); } },
+	    { "terrain_1m",
+	      []( SphereList &, Scene &scene ) { addMesh( scene, makeTerrain( 20, 708 ) ); },
+	      Vec3( 0, 5, 12 ),
+	      -90,
+	      -25 },
+	    { "mesh_field_1k",
+	      []( SphereList &spheres, Scene &scene )
+	      {
+		      // many small separate meshes, the case the top-level BVH is for
+		      spheres = defaultSpheres();
+		      for ( int i = 0; i < 32; i++ )
+		      {
+			      for ( int j = 0; j < 32; j++ )
+			      {
+				      Vec3 center( -8 + 0.5f * i, 0.2f, -2 - 0.5f * j );
+				      addMesh( scene, makeBumpySphere( center, 0.2f, 8 ) );
+			      }
+		      }
+	      },
+	      front,
+	      -90,
+	      -10 },
+	    { "instances_1k",
+	      []( SphereList &spheres, Scene &scene )
+	      {
+		      // one 10k triangle mesh placed 1024 times, turned and stretched differently each time
+		      spheres = defaultSpheres();
+		      std::mt19937                          rng( 4321 );
+		      std::uniform_real_distribution<float> dist( 0, 1 );
+		      scene.meshes.push_back( makeBumpySphere( Vec3( 0 ), 0.2f, 50 ) );
+		      for ( int i = 0; i < 32; i++ )
+		      {
+			      for ( int j = 0; j < 32; j++ )
+			      {
+				      Vec3  position( -8 + 0.5f * i, 0.2f, -2 - 0.5f * j );
+				      Vec3  axis( dist( rng ), 1, dist( rng ) );
+				      float angle = 360 * dist( rng );
+				      Vec3  stretch( 0.6f + 0.8f * dist( rng ), 0.6f + 0.8f * dist( rng ), 1.0f );
+				      scene.instances.emplace_back( 0,
+				                                    Transform::translate( position ) *
+				                                        Transform::rotate( axis, angle ) *
+				                                        Transform::scale( stretch ) );
+			      }
+		      }
+	      },
+	      front,
+	      -90,
+	      -10 },
+	    { "room",
+	      []( SphereList &spheres, Scene &scene )
+	      {
+		      // closed in and lit by a small panel only, the case light sampling is for
+		      spheres = defaultSpheres();
+		      addMesh( scene, makeRoom() );
+	      },
+	      Vec3( 0, 2, 4.5f ),
+	      -90,
+	      -10 },
+	    { "sphere_cloud_10k",
+	      []( SphereList &spheres, Scene & ) { spheres = makeSphereCloud( 10000 ); },
+	      front,
+	      -90,
+	      -10 },
+	    { "sphere_cloud_100k",
+	      []( SphereList &spheres, Scene & ) { spheres = makeSphereCloud( 100000 ); },
+	      front,
+	      -90,
+	      -10 },
+	};
+}
+
+size_t sceneBytes( const Scene &scene )
+{
+	size_t bytes = scene.sphereBVH.nodes.size() * sizeof( BVHNode ) +
+	               scene.sphereBVH.spheres.size() * sizeof( scene.sphereBVH.spheres[0] ) +
+	               scene.topLevel.nodes.size() * sizeof( BVHNode ) +
+	               scene.instances.size() * sizeof( MeshInstance );
+	for ( const Mesh &mesh : scene.meshes )
+	{
+		bytes += mesh.triangles.size() * sizeof( Triangle ) + mesh.packets.size() * sizeof( TrianglePacket ) +
+		         mesh.bvh.nodes.size() * sizeof( BVHNode ) +
+		         mesh.wideBVH.nodes4.size() * sizeof( WideBVHNode<4> ) +
+		         mesh.wideBVH.nodes8.size() * sizeof( WideBVHNode<8> );
+	}
+	return bytes;
+}
+
+double peakRSSMegabytes()
+{
+	rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+	return usage.ru_maxrss / ( 1024.0 * 1024.0 ); // bytes
+#else
+	return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+}
+
+double millisecondsSince( Clock::time_point start )
+{
+	return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+// Animates `bench`, refitting the first mesh of `scene` after every step, and builds the same triangles
+// from scratch to time against the refit and to check both trees give the same hit distance for rays
+// through random points of the camera's view.
+RefitBench benchRefit( const BenchScene    &bench,
+                       Scene               &scene,
+                       const Camera        &camera,
+                       ThreadPool          &pool,
+                       const BenchSettings &settings )
+{
+	std::mt19937                          rng( 99 );
+	std::uniform_real_distribution<float> dist( -1, 1 );
+	const float                           aspect = float( settings.render.width ) / settings.render.height;
+
+	RefitBench result;
+	Mesh      &mesh = scene.meshes[0];
+	for ( int step = 0; step < REFIT_STEPS; step++ )
+	{
+		bench.deform( mesh, step );
+		auto        refitStart = Clock::now();
+		RefitResult refit      = mesh.refit( pool );
+		result.refitMs += millisecondsSince( refitStart ) / REFIT_STEPS;
+		result.refitted += refit == RefitResult::Refitted;
+		result.partiallyRebuilt += refit == RefitResult::PartiallyRebuilt;
+		result.rebuilt += refit == RefitResult::Rebuilt;
+
+		Mesh fresh;
+		fresh.triangles = mesh.triangles;
+		auto buildStart = Clock::now();
+		fresh.buildBVH( pool, preferredBVHWidth(), settings.bvhMode );
+		result.rebuildMs += millisecondsSince( buildStart ) / REFIT_STEPS;
+
+		for ( int i = 0; i < REFIT_RAYS; i++ )
+		{
+			Ray ray = camera.getRay( dist( rng ) * aspect, dist( rng ) );
+			Hit refitHit, freshHit;
+			refitHit.t = 1e9f;
+			freshHit.t = 1e9f;
+			bool hit   = intersectMesh( ray, mesh, refitHit );
+			if ( hit != intersectMesh( ray, fresh, freshHit ) || ( hit && refitHit.t != freshHit.t ) )
+				result.mismatches++;
+		}
+	}
+	updateTopLevel( scene );
+	return result;
+}
+
+bool parseBenchArgs( int argc, char *argv[], BenchSettings &settings )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg   = argv[i];
+		const char *value = i + 1 < argc ? argv[++i] : nullptr;
+		if ( !value )
+			arg = "--help";
+
+		bool ok = true;
+		if ( arg == "--width" )
+			ok = parseInt( value, 1, settings.render.width );
+		else if ( arg == "--height" )
+			ok = parseInt( value, 1, settings.render.height );
+		else if ( arg == "--spp" )
+			ok = parseInt( value, 1, settings.spp );
+		else if ( arg == "--depth" )
+			ok = parseInt( value, 1, settings.render.maxDepth );
+		else if ( arg == "--roulette" )
+			ok = parseInt( value, 0, settings.render.rouletteDepth );
+		else if ( arg == "-t" || arg == "--threads" )
+			ok = parseInt( value, 1, settings.threads );
+		else if ( arg == "--scene" )
+			settings.only.push_back( value );
+		else if ( arg == "--integrator" && std::string( value ) == "recursive" )
+			settings.render.wavefront = false;
+		else if ( arg == "--integrator" && std::string( value ) == "wavefront" )
+			settings.render.wavefront = true;
+		else if ( arg == "--bvh-build" && std::string( value ) == "sah" )
+			settings.bvhMode = BVHBuildMode::SAH;
+		else if ( arg == "--bvh-build" && std::string( value ) == "lbvh" )
+			settings.bvhMode = BVHBuildMode::LBVH;
+		else if ( arg == "-o" || arg == "--out" )
+			settings.output = value;
+		else
+			ok = false;
+
+		if ( !ok )
+		{
+			if ( value )
+				std::cerr << "Invalid argument: " << arg << " " << value << std::endl;
+			std::cerr << "Usage: " << argv[0]
+			          << " [--width N] [--height N] [--spp N] [--depth N] [--roulette N] [--threads N]"
+			          << " [--scene NAME]... [--bvh-build sah|lbvh] [--integrator recursive|wavefront]"
+			          << " [--out FILE]\nScenes:";
+			for ( const BenchScene &scene : benchScenes() )
+			{
+				std::cerr << " " << scene.name;
+			}
+			std::cerr << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+	BenchSettings settings;
+	settings.render.width  = 320;
+	settings.render.height = 240;
+	if ( !parseBenchArgs( argc, argv, settings ) )
+		return 1;
+
+	ThreadPool pool( settings.threads );
+
+	std::ostringstream json;
+	json << "{\n  \"threads\": " << pool.size() << ",\n  \"width\": " << settings.render.width
+	     << ",\n  \"height\": " << settings.render.height << ",\n  \"spp\": " << settings.spp
+	     << ",\n  \"depth\": " << settings.render.maxDepth
+	     << ",\n  \"roulette_depth\": " << settings.render.rouletteDepth << ",\n  \"bvh_build\": \""
+	     << ( settings.bvhMode == BVHBuildMode::SAH ? "sah" : "lbvh" ) << "\",\n  \"integrator\": \""
+	     << ( settings.render.wavefront ? "wavefront" : "recursive" ) << "\",\n  \"scenes\": [";
+
+	bool first      = true;
+	int  mismatches = 0;
+	for ( const BenchScene &bench : benchScenes() )
+	{
+		if ( !settings.only.empty() &&
+		     std::find( settings.only.begin(), settings.only.end(), bench.name ) == settings.only.end() )
+			continue;
+
+		std::cerr << bench.name << ": building" << std::endl;
+		Scene      scene;
+		SphereList spheres;
+		bench.generate( spheres, scene );
+
+		auto buildStart = Clock::now();
+		scene.sphereBVH = SphereBVH( std::move( spheres ) );
+		for ( Mesh &mesh : scene.meshes )
+		{
+			mesh.buildBVH( pool, preferredBVHWidth(), settings.bvhMode );
+		}
+		updateTopLevel( scene );
+		double buildMs = millisecondsSince( buildStart );
+
+		size_t triangles = 0; // as placed, counting every instance
+		for ( const MeshInstance &instance : scene.instances )
+		{
+			triangles += scene.meshes[instance.mesh].geometry.triangleCount;
+		}
+
+		Camera camera( bench.cameraPosition );
+		camera.rotate( bench.cameraYaw - camera.yaw, bench.cameraPitch - camera.pitch );
+
+		// one untimed frame to warm caches and wake the workers
+		Renderer renderer( pool, settings.render );
+		renderer.renderFrame( camera, scene );
+		renderer.reset();
+		renderer.resetStats();
+		uint64_t raysBefore = renderer.raysTraced();
+
+		std::cerr << bench.name << ": rendering" << std::endl;
+		auto renderStart = Clock::now();
+		for ( int i = 0; i < settings.spp; i++ )
+		{
+			renderer.renderFrame( camera, scene );
+		}
+		double renderMs = millisecondsSince( renderStart );
+
+		RefitBench refit;
+		if ( bench.deform )
+		{
+			std::cerr << bench.name << ": refitting" << std::endl;
+			refit = benchRefit( bench, scene, camera, pool, settings );
+			mismatches += refit.mismatches;
+		}
+
+		uint64_t rays    = renderer.raysTraced() - raysBefore;
+		double   samples = double( settings.render.width ) * settings.render.height * settings.spp;
+		double   seconds = std::max( renderMs, 1e-6 ) / 1000.0; // a zero timing would print inf, not JSON
+
+		json << ( first ? "\n" : ",\n" ) << "    {\n"
+		     << "      \"name\": \"" << bench.name << "\",\n"
+		     << "      \"triangles\": " << triangles << ",\n"
+		     << "      \"instances\": " << scene.instances.size() << ",\n"
+		     << "      \"spheres\": " << scene.sphereBVH.spheres.size() << ",\n"
+		     << "      \"bvh_build_ms\": " << buildMs << ",\n"
+		     << "      \"render_ms\": " << renderMs << ",\n"
+		     << "      \"rays\": " << rays << ",\n"
+		     << "      \"mrays_per_s\": " << rays / seconds / 1e6 << ",\n"
+		     << "      \"samples_per_s\": " << samples / seconds << ",\n"
+		     << "      \"scene_mb\": " << sceneBytes( scene ) / ( 1024.0 * 1024.0 );
+		if ( bench.deform )
+		{
+			json << ",\n      \"refit\": { \"steps\": " << REFIT_STEPS << ", \"refit_ms\": " << refit.refitMs
+			     << ", \"rebuild_ms\": " << refit.rebuildMs << ", \"refitted\": " << refit.refitted
+			     << ", \"partially_rebuilt\": " << refit.partiallyRebuilt
+			     << ", \"rebuilt\": " << refit.rebuilt << ", \"rays_checked\": " << REFIT_STEPS * REFIT_RAYS
+			     << ", \"hit_mismatches\": " << refit.mismatches << " }";
+		}
+#if PATHTRACER_STATS
+		json << ",\n      \"stats\": " << renderer.totalStats().toJSON();
+#endif
+		json << "\n"
+		     << "    }";
+		first = false;
+	}
+	// the whole run's peak: it only ever grows, so one scene's is only measured by running it alone
+	json << "\n  ],\n  \"process_peak_rss_mb\": " << peakRSSMegabytes() << "\n}\n";
+
+	std::cout << json.str();
+	if ( !settings.output.empty() )
+	{
+		FILE *file = std::fopen( settings.output.c_str(), "w" );
+		if ( !file || std::fputs( json.str().c_str(), file ) < 0 )
+		{
+			std::cerr << "Failed to write " << settings.output << std::endl;
+			return 1;
+		}
+		std::fclose( file );
+	}
+	if ( mismatches > 0 )
+	{
+		std::cerr << mismatches << " rays hit differently in refitted and rebuilt BVHs" << std::endl;
+		return 1;
+	}
+	return 0;
+}
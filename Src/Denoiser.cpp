@@ -0,0 +1,230 @@
+#include "Denoiser.hpp"
+#include "Shading.hpp"
+
+namespace
+{
+
+// B3-spline weights of the kernel along one axis
+const float KERNEL[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+// 3x3 Gaussian the variance is smoothed with before it steers the luminance weight
+const float VARIANCE_KERNEL[2] = { 1.0f / 2, 1.0f / 4 };
+
+// Edge stopping: luminance differences count in LUMINANCE_SIGMA standard deviations of the pixel's noise,
+// depth differences in DEPTH_SIGMA times what the local depth slope predicts over the distance.
+const float LUMINANCE_SIGMA = 4.0f;
+const float DEPTH_SIGMA     = 1.0f;
+const float WEIGHT_EPSILON  = 1e-4f;
+
+const float ALBEDO_EPSILON = 0.01f; // darker albedo channels are divided out as if they were this bright
+const float MISS_DEPTH     = 1e4f;
+
+// pixels with fewer samples estimate their variance from their 3x3 neighbourhood instead of their own
+const uint32_t MIN_VARIANCE_SAMPLES = 4;
+
+// max( 0, a . b )^128 by repeated squaring
+inline float normalWeight( const Vec3 &a, const Vec3 &b )
+{
+	float weight = std::max( 0.0f, a.dot( b ) );
+	for ( int i = 0; i < 7; i++ )
+	{
+		weight *= weight;
+	}
+	return weight;
+}
+
+} // namespace
+
+PixelFeatures firstHitFeatures( const Ray &ray, bool hit, const Hit &closestHit )
+{
+	PixelFeatures features;
+	if ( !hit )
+	{
+		features.albedo = skyColor();
+		features.normal = ray.dir * -1.0f;
+		features.depth  = MISS_DEPTH;
+		return features;
+	}
+	features.albedo = closestHit.color;
+	features.normal = faceForward( closestHit.normal, ray.dir );
+	features.depth  = closestHit.t;
+	return features;
+}
+
+void Denoiser::filter( ThreadPool &pool, const DenoiseInput &input, Vec3 *output )
+{
+	if ( width != input.width || height != input.height )
+	{
+		width  = input.width;
+		height = input.height;
+		for ( std::vector<Vec3> *buffer : { &albedo, &normal, &irradiance[0], &irradiance[1] } )
+		{
+			buffer->resize( width * height );
+		}
+		for ( std::vector<float> *buffer : { &depth, &depthSlope, &variance[0], &variance[1] } )
+		{
+			buffer->resize( width * height );
+		}
+	}
+
+	pool.parallelFor( height, [&]( int y, int ) { prepareRow( input, y ); } );
+	pool.parallelFor( height, [&]( int y, int ) { estimateRow( input, y ); } );
+
+	int from = 0;
+	for ( int i = 0; i < DENOISE_ITERATIONS; i++ )
+	{
+		pool.parallelFor( height, [&]( int y, int ) { filterRow( y, 1 << i, from ); } );
+		from = 1 - from;
+	}
+
+	pool.parallelFor( height,
+	                  [&]( int y, int )
+	                  {
+		                  for ( int i = y * width; i < ( y + 1 ) * width; i++ )
+		                  {
+			                  output[i] = irradiance[from][i] * albedo[i];
+		                  }
+	                  } );
+}
+
+// Turns the sums of row `y` into means, divides the albedo out of the color and estimates the variance of
+// the result from the pixel's samples, or marks it -1 when it has too few.
+void Denoiser::prepareRow( const DenoiseInput &input, int y )
+{
+	for ( int i = y * width; i < ( y + 1 ) * width; i++ )
+	{
+		uint32_t n = input.samples[i];
+		if ( n == 0 )
+		{
+			albedo[i]        = Vec3( 0 );
+			normal[i]        = Vec3( 0 );
+			depth[i]         = MISS_DEPTH;
+			irradiance[0][i] = Vec3( 0 );
+			variance[0][i]   = 0.0f;
+			continue;
+		}
+
+		float                inv      = 1.0f / n;
+		const PixelFeatures &features = input.features[i];
+		Vec3                 mean     = input.color[i] * inv;
+		Vec3                 a        = features.albedo * inv;
+		a = Vec3( std::max( a.x, ALBEDO_EPSILON ),
+		          std::max( a.y, ALBEDO_EPSILON ),
+		          std::max( a.z, ALBEDO_EPSILON ) );
+		albedo[i]        = a;
+		normal[i]        = features.normal.length() > 0.0f ? features.normal.normalize() : Vec3( 0 );
+		depth[i]         = features.depth * inv;
+		irradiance[0][i] = Vec3( mean.x / a.x, mean.y / a.y, mean.z / a.z );
+		if ( n < MIN_VARIANCE_SAMPLES )
+		{
+			variance[0][i] = -1.0f;
+			continue;
+		}
+
+		// variance of the mean luminance, scaled the way dividing by the albedo scales the luminance
+		float brightness     = luminance( mean );
+		float squares        = input.luminanceSquares[i] * inv;
+		float sampleVariance = std::max( 0.0f, squares - brightness * brightness ) * n / ( n - 1 );
+		float scale          = 1.0f / std::max( luminance( a ), ALBEDO_EPSILON );
+		variance[0][i]       = sampleVariance * inv * scale * scale;
+	}
+}
+
+// Depth slopes of row `y`, and the variance of its pixels with too few samples from their 3x3
+// neighbourhood, all of which prepareRow() must have finished.
+void Denoiser::estimateRow( const DenoiseInput &input, int y )
+{
+	const int y0 = std::max( y - 1, 0 ), y1 = std::min( y + 1, height - 1 );
+	for ( int x = 0; x < width; x++ )
+	{
+		const int i = y * width + x;
+
+		// the smaller one-sided difference per axis, so a silhouette next to the pixel does not make its own
+		// surface look steep
+		float slopeX = MISS_DEPTH, slopeY = MISS_DEPTH;
+		if ( x > 0 )
+			slopeX = std::abs( depth[i - 1] - depth[i] );
+		if ( x + 1 < width )
+			slopeX = std::min( slopeX, std::abs( depth[i + 1] - depth[i] ) );
+		if ( y > 0 )
+			slopeY = std::abs( depth[i - width] - depth[i] );
+		if ( y + 1 < height )
+			slopeY = std::min( slopeY, std::abs( depth[i + width] - depth[i] ) );
+		depthSlope[i] = std::max( slopeX, slopeY );
+
+		if ( variance[0][i] >= 0.0f )
+			continue;
+		float sum = 0.0f, sumSquares = 0.0f;
+		int   count = 0;
+		for ( int qy = y0; qy <= y1; qy++ )
+		{
+			for ( int qx = std::max( x - 1, 0 ); qx <= std::min( x + 1, width - 1 ); qx++ )
+			{
+				float brightness = luminance( irradiance[0][qy * width + qx] );
+				sum += brightness;
+				sumSquares += brightness * brightness;
+				count++;
+			}
+		}
+		float mean     = sum / count;
+		variance[0][i] = std::max( 0.0f, sumSquares / count - mean * mean ) / input.samples[i];
+	}
+}
+
+// One a-trous pass over row `y` with holes `step` pixels apart, from buffer `from` into the other one.
+void Denoiser::filterRow( int y, int step, int from )
+{
+	const int                 to    = 1 - from;
+	const std::vector<Vec3>  &color = irradiance[from];
+	const std::vector<float> &noise = variance[from];
+	const int                 y0 = std::max( y - 1, 0 ), y1 = std::min( y + 1, height - 1 );
+	for ( int x = 0; x < width; x++ )
+	{
+		const int i = y * width + x;
+
+		float smoothed = 0.0f, smoothedWeight = 0.0f;
+		for ( int qy = y0; qy <= y1; qy++ )
+		{
+			for ( int qx = std::max( x - 1, 0 ); qx <= std::min( x + 1, width - 1 ); qx++ )
+			{
+				float weight = VARIANCE_KERNEL[std::abs( qx - x )] * VARIANCE_KERNEL[std::abs( qy - y )];
+				smoothed += noise[qy * width + qx] * weight;
+				smoothedWeight += weight;
+			}
+		}
+		float centre         = luminance( color[i] );
+		float deviation      = std::sqrt( smoothed / smoothedWeight );
+		float luminanceScale = 1.0f / ( LUMINANCE_SIGMA * deviation + WEIGHT_EPSILON );
+
+		Vec3  sum( 0 );
+		float sumVariance = 0.0f, sumWeight = 0.0f;
+		for ( int ky = -2; ky <= 2; ky++ )
+		{
+			int qy = y + ky * step;
+			if ( qy < 0 || qy >= height )
+				continue;
+			for ( int kx = -2; kx <= 2; kx++ )
+			{
+				int qx = x + kx * step;
+				if ( qx < 0 || qx >= width )
+					continue;
+
+				int   j      = qy * width + qx;
+				float weight = KERNEL[kx + 2] * KERNEL[ky + 2];
+				if ( j != i )
+				{
+					float distance      = step * std::sqrt( float( kx * kx + ky * ky ) );
+					float depthScale    = 1.0f / ( DEPTH_SIGMA * depthSlope[i] * distance + WEIGHT_EPSILON );
+					float luminanceEdge = std::abs( centre - luminance( color[j] ) ) * luminanceScale;
+					float depthEdge     = std::abs( depth[i] - depth[j] ) * depthScale;
+					weight *= normalWeight( normal[i], normal[j] ) * std::exp( -luminanceEdge - depthEdge );
+				}
+				sum += color[j] * weight;
+				sumVariance += noise[j] * weight * weight;
+				sumWeight += weight;
+			}
+		}
+		irradiance[to][i] = sum * ( 1.0f / sumWeight );
+		variance[to][i]   = sumVariance / ( sumWeight * sumWeight );
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Math.hpp"
+#include "ThreadPool.hpp"
+
+// Passes of the a-trous filter; the last one reaches 2 * 2^(DENOISE_ITERATIONS - 1) pixels out.
+const int DENOISE_ITERATIONS = 5;
+
+// What a camera ray first sees, the guide the denoiser tells edges from noise by. Summed per pixel over
+// the samples like the radiance, so edge pixels get the coverage-weighted mix.
+struct PixelFeatures
+{
+	Vec3  albedo; // surface color, the sky's radiance for misses
+	Vec3  normal; // facing the camera; misses point back along the ray
+	float depth = 0.0f;
+};
+
+// Feature sample of a camera ray `ray` that hit `closestHit`, or missed everything when `hit` is false.
+PixelFeatures firstHitFeatures( const Ray &ray, bool hit, const Hit &closestHit );
+
+// Accumulated image handed to Denoiser::filter(), every buffer `width * height` sums over `samples` of
+// each pixel.
+struct DenoiseInput
+{
+	int                  width  = 0;
+	int                  height = 0;
+	const Vec3          *color;
+	const float         *luminanceSquares; // sum of the squared sample luminances
+	const uint32_t      *samples;
+	const PixelFeatures *features;
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance-guided luminance weight of
+// SVGF: DENOISE_ITERATIONS passes of a 5x5 B3-spline kernel with holes that double in size each pass, every
+// tap weighted down by normal, depth and luminance differences to the centre. Color is divided by the
+// first-hit albedo before filtering and multiplied back after, so only the lighting is blurred and
+// surface color edges stay sharp. Luminance edges are measured against each pixel's own noise, so the
+// filter backs off as samples accumulate. Buffers are kept between calls; rows run on the pool.
+struct Denoiser
+{
+	// Writes the filtered per-pixel mean of `input` to `output`.
+	void filter( ThreadPool &pool, const DenoiseInput &input, Vec3 *output );
+
+  private:
+	int                width  = 0;
+	int                height = 0;
+	std::vector<Vec3>  albedo;
+	std::vector<Vec3>  normal;
+	std::vector<float> depth;
+	std::vector<float> depthSlope; // depth change per pixel, how far neighbours on one plane may differ
+	std::vector<Vec3>  irradiance[2];
+	std::vector<float> variance[2]; // of the luminance of `irradiance`, filtered alongside it
+
+	void prepareRow( const DenoiseInput &input, int y );
+	void estimateRow( const DenoiseInput &input, int y );
+	void filterRow( int y, int step, int from );
+};
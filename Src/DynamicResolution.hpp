@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Renderer.hpp"
+
+// Coarsest scale, at most TILE_SIZE; how quickly the measured frame time follows new frames; and the share
+// of the target a finer scale must be predicted to fit in before the viewer switches to it.
+const int   DYNAMIC_MAX_SCALE = 8;
+const float DYNAMIC_SMOOTHING = 0.3f;
+const float DYNAMIC_HEADROOM  = 0.8f;
+
+// Picks the pixel scale of the viewer's frames (RenderSettings::pixelScale) from measured render times.
+// While the camera moves it doubles the scale when frames overrun `targetSeconds` and halves it when the
+// finer scale, about four times the work, would still fit; once the camera stops it steps back to full
+// resolution one halving per frame.
+struct DynamicResolution
+{
+	float targetSeconds  = 0.0f; // 0 always renders at full resolution
+	int   scale          = 1;
+	float averageSeconds = 0.0f; // per frame at `scale`, smoothed
+
+	// Scale for the next frame after the last one took `frameSeconds` at the current scale.
+	int update( float frameSeconds, bool moving )
+	{
+		if ( targetSeconds <= 0.0f )
+			return scale = 1;
+
+		if ( averageSeconds > 0.0f )
+			averageSeconds += ( frameSeconds - averageSeconds ) * DYNAMIC_SMOOTHING;
+		else
+			averageSeconds = frameSeconds;
+
+		bool coarser = moving && averageSeconds > targetSeconds && scale < DYNAMIC_MAX_SCALE;
+		bool finer   = scale > 1 && ( !moving || averageSeconds * 4 < targetSeconds * DYNAMIC_HEADROOM );
+		if ( coarser )
+		{
+			scale *= 2;
+			averageSeconds /= 4;
+		}
+		else if ( finer )
+		{
+			scale /= 2;
+			averageSeconds *= 4;
+		}
+		return scale;
+	}
+};
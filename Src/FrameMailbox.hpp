@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Passes frames from the render thread to the thread that presents them without copying: the presenting
+// thread offers the memory of a locked streaming texture, the render thread resolves its next finished
+// frame straight into it, and the presenting thread collects it to unlock and show the texture. Neither
+// side waits for the other; frames finished while nothing is offered are just not shown. A render thread
+// with nothing left to render sleeps in waitForWake() instead.
+struct FrameMailbox
+{
+	// Presenting thread: the next finished frame goes to `pixels`, rows `pitch` pixels apart.
+	void offer( uint32_t *pixels, int pitch )
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		offered      = pixels;
+		offeredPitch = pitch;
+		state        = State::OFFERED;
+		wakeUp.notify_one();
+	}
+
+	// Presenting thread: ends the render thread's current or next waitForWake(), e.g. after a new request.
+	void wake()
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		woken = true;
+		wakeUp.notify_one();
+	}
+
+	// Presenting thread: true once the offered memory holds a frame, which also withdraws the offer.
+	bool collect()
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		if ( state != State::FILLED )
+			return false;
+		state = State::EMPTY;
+		return true;
+	}
+
+	// Render thread: the offered memory to write a frame to, then call filled(); nullptr when nothing is
+	// offered or the last frame was not collected yet.
+	uint32_t *take( int &pitch )
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		if ( state != State::OFFERED )
+			return nullptr;
+		state = State::WRITING;
+		pitch = offeredPitch;
+		return offered;
+	}
+
+	void filled()
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		state = State::FILLED;
+	}
+
+	// Render thread: blocks until wake() was called since the last wait, or with `forOffer` until memory is
+	// offered, for a frame that did not reach the screen yet.
+	void waitForWake( bool forOffer )
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		wakeUp.wait( lock, [&] { return woken || ( forOffer && state == State::OFFERED ); } );
+		woken = false;
+	}
+
+  private:
+	enum class State
+	{
+		EMPTY,
+		OFFERED,
+		WRITING,
+		FILLED
+	};
+
+	std::mutex              mutex;
+	std::condition_variable wakeUp;
+	State                   state        = State::EMPTY;
+	uint32_t               *offered      = nullptr;
+	int                     offeredPitch = 0;
+	bool                    woken        = false;
+};
@@ -0,0 +1,91 @@
+#include "Headless.hpp"
+#include "Image.hpp"
+
+#include <chrono>
+#include <iostream>
+
+int renderHeadless( const Options &options )
+{
+	using Clock = std::chrono::steady_clock;
+
+	ThreadPool pool( options.threads );
+
+	Scene scene;
+	scene.sphereBVH = SphereBVH( defaultSpheres() );
+	if ( !options.objPath.empty() &&
+	     !addOBJMesh( scene, options.objPath, pool, options.cache, options.instances, options.bvhMode ) )
+		return 1;
+	if ( options.room )
+		addRoom( scene, pool, options.bvhMode );
+	updateTopLevel( scene );
+
+	// with a noise target the samples per pixel only cap the noisiest tiles, which stop the render once
+	// they all converged or reached it; the denoiser only runs once, on the final image
+	RenderSettings renderSettings = options.render;
+	int            spp            = options.spp;
+	renderSettings.denoise        = false;
+	if ( renderSettings.noiseTarget > 0.0f )
+	{
+		renderSettings.maxSamples = spp > 0 ? spp : 4096;
+		spp                       = 0;
+	}
+	else if ( spp == 0 && options.timeLimit <= 0.0f )
+		spp = 64;
+
+	Renderer renderer( pool, renderSettings );
+	Camera   camera = startCamera( options );
+
+	std::cout << "Rendering " << options.render.width << "x" << options.render.height << " with "
+	          << pool.size() << " threads" << std::endl;
+
+	StatsReporter statsReporter{ options.statsInterval, options.statsJSON };
+
+	auto  start   = Clock::now();
+	float elapsed = 0.0f;
+	while ( ( spp == 0 || renderer.sampleCount < spp ) && !renderer.converged() &&
+	        ( options.timeLimit <= 0.0f || elapsed < options.timeLimit ) )
+	{
+		renderer.renderFrame( camera, scene );
+		elapsed = std::chrono::duration<float>( Clock::now() - start ).count();
+		if ( statsReporter.update( renderer.totalStats() ) )
+			renderer.resetStats();
+	}
+
+	std::cout << "Rendered " << renderer.averageSamples() << " spp in " << elapsed << " s";
+	if ( renderSettings.noiseTarget > 0.0f )
+		std::cout << ", " << renderer.convergedFraction() * 100.0f << "% of tiles done, noise "
+		          << renderer.noiseLevel();
+	std::cout << std::endl;
+	if ( options.statsInterval > 0.0f && renderer.totalStats().frames > 0 )
+	{
+		statsReporter.print( renderer.totalStats() ); // whatever the last interval did not cover
+	}
+
+	if ( options.render.denoise )
+	{
+		auto denoiseStart = Clock::now();
+		renderer.denoise();
+		std::cout << "Denoised in " << std::chrono::duration<float>( Clock::now() - denoiseStart ).count()
+		          << " s" << std::endl;
+	}
+
+	renderer.resolve();
+	const RenderSettings &settings = renderer.settings;
+	if ( !writeImage( options.output, settings.width, settings.height, renderer.pixels.data() ) )
+		return 1;
+	std::cout << "Wrote " << options.output << std::endl;
+
+	if ( !options.rawOutput.empty() )
+	{
+		std::vector<Vec3> radiance( renderer.accum.size() );
+		for ( size_t i = 0; i < radiance.size(); i++ )
+		{
+			radiance[i] = renderer.pixelMean( int( i ) );
+		}
+		if ( !writePFM( options.rawOutput, settings.width, settings.height, radiance.data(), 1.0f ) )
+			return 1;
+		std::cout << "Wrote " << options.rawOutput << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Options.hpp"
+
+// Renders `options` without a window and writes the requested images. Returns the process exit code.
+int renderHeadless( const Options &options );
@@ -0,0 +1,10 @@
+#include "Headless.hpp"
+
+int main( int argc, char *argv[] )
+{
+	Options options;
+	if ( !parseOptions( argc, argv, options ) )
+		return 1;
+
+	return renderHeadless( options );
+}
@@ -0,0 +1,180 @@
+#include "Image.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+
+FILE *openForWrite( const std::string &path )
+{
+	FILE *file = std::fopen( path.c_str(), "wb" );
+	if ( !file )
+	{
+		std::cerr << "Failed to open " << path << " for writing" << std::endl;
+	}
+	return file;
+}
+
+bool finishWrite( FILE *file, const std::string &path )
+{
+	bool ok = !std::ferror( file );
+	ok      = std::fclose( file ) == 0 && ok;
+	if ( !ok )
+	{
+		std::cerr << "Failed to write " << path << std::endl;
+	}
+	return ok;
+}
+
+uint32_t crc32( const uint8_t *data, size_t size, uint32_t crc = 0 )
+{
+	static uint32_t table[256];
+	static bool     tableReady = false;
+	if ( !tableReady )
+	{
+		for ( uint32_t i = 0; i < 256; i++ )
+		{
+			uint32_t c = i;
+			for ( int k = 0; k < 8; k++ )
+			{
+				c = ( c & 1 ) ? 0xEDB88320u ^ ( c >> 1 ) : c >> 1;
+			}
+			table[i] = c;
+		}
+		tableReady = true;
+	}
+
+	crc = ~crc;
+	for ( size_t i = 0; i < size; i++ )
+	{
+		crc = table[( crc ^ data[i] ) & 0xFF] ^ ( crc >> 8 );
+	}
+	return ~crc;
+}
+
+void appendBigEndian( std::vector<uint8_t> &out, uint32_t value )
+{
+	out.push_back( value >> 24 );
+	out.push_back( value >> 16 );
+	out.push_back( value >> 8 );
+	out.push_back( value );
+}
+
+void writeChunk( FILE *file, const char *type, const std::vector<uint8_t> &data )
+{
+	std::vector<uint8_t> chunk;
+	appendBigEndian( chunk, data.size() );
+	chunk.insert( chunk.end(), type, type + 4 );
+	chunk.insert( chunk.end(), data.begin(), data.end() );
+	appendBigEndian( chunk, crc32( chunk.data() + 4, chunk.size() - 4 ) );
+	std::fwrite( chunk.data(), 1, chunk.size(), file );
+}
+
+} // namespace
+
+bool writePPM( const std::string &path, int width, int height, const uint32_t *pixels )
+{
+	FILE *file = openForWrite( path );
+	if ( !file )
+		return false;
+
+	std::fprintf( file, "P6\n%d %d\n255\n", width, height );
+	std::vector<uint8_t> row( width * 3 );
+	for ( int y = 0; y < height; y++ )
+	{
+		for ( int x = 0; x < width; x++ )
+		{
+			uint32_t p     = pixels[y * width + x];
+			row[x * 3 + 0] = p >> 16;
+			row[x * 3 + 1] = p >> 8;
+			row[x * 3 + 2] = p;
+		}
+		std::fwrite( row.data(), 1, row.size(), file );
+	}
+	return finishWrite( file, path );
+}
+
+// Uncompressed PNG: the zlib stream is made of stored deflate blocks, so no compressor is needed.
+bool writePNG( const std::string &path, int width, int height, const uint32_t *pixels )
+{
+	FILE *file = openForWrite( path );
+	if ( !file )
+		return false;
+
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::fwrite( signature, 1, sizeof( signature ), file );
+
+	std::vector<uint8_t> header;
+	appendBigEndian( header, width );
+	appendBigEndian( header, height );
+	header.insert( header.end(), { 8, 2, 0, 0, 0 } ); // 8-bit RGB, no interlace
+	writeChunk( file, "IHDR", header );
+
+	// raw scanlines, each prefixed with filter type 0
+	std::vector<uint8_t> raw;
+	raw.reserve( size_t( width * 3 + 1 ) * height );
+	for ( int y = 0; y < height; y++ )
+	{
+		raw.push_back( 0 );
+		for ( int x = 0; x < width; x++ )
+		{
+			uint32_t p = pixels[y * width + x];
+			raw.insert( raw.end(), { uint8_t( p >> 16 ), uint8_t( p >> 8 ), uint8_t( p ) } );
+		}
+	}
+
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	uint32_t             a = 1, b = 0;
+	for ( size_t pos = 0; pos < raw.size() || pos == 0; )
+	{
+		size_t blockSize = std::min<size_t>( raw.size() - pos, 65535 );
+		bool   last      = pos + blockSize == raw.size();
+		zlib.insert( zlib.end(),
+		             { uint8_t( last ), uint8_t( blockSize ), uint8_t( blockSize >> 8 ),
+		               uint8_t( ~blockSize ), uint8_t( ~blockSize >> 8 ) } );
+		zlib.insert( zlib.end(), raw.begin() + pos, raw.begin() + pos + blockSize );
+		for ( size_t i = pos; i < pos + blockSize; i++ )
+		{
+			a = ( a + raw[i] ) % 65521;
+			b = ( b + a ) % 65521;
+		}
+		pos += blockSize;
+		if ( last )
+			break;
+	}
+	appendBigEndian( zlib, ( b << 16 ) | a );
+	writeChunk( file, "IDAT", zlib );
+	writeChunk( file, "IEND", {} );
+	return finishWrite( file, path );
+}
+
+bool writeImage( const std::string &path, int width, int height, const uint32_t *pixels )
+{
+	bool png = path.size() >= 4 && path.compare( path.size() - 4, 4, ".png" ) == 0;
+	return png ? writePNG( path, width, height, pixels ) : writePPM( path, width, height, pixels );
+}
+
+bool writePFM( const std::string &path, int width, int height, const Vec3 *pixels, float scale )
+{
+	FILE *file = openForWrite( path );
+	if ( !file )
+		return false;
+
+	// a negative scale in the header marks little-endian data; rows are stored bottom to top
+	std::fprintf( file, "PF\n%d %d\n-1.0\n", width, height );
+	std::vector<float> row( width * 3 );
+	for ( int y = height - 1; y >= 0; y-- )
+	{
+		for ( int x = 0; x < width; x++ )
+		{
+			const Vec3 &p  = pixels[y * width + x];
+			row[x * 3 + 0] = p.x * scale;
+			row[x * 3 + 1] = p.y * scale;
+			row[x * 3 + 2] = p.z * scale;
+		}
+		std::fwrite( row.data(), sizeof( float ), row.size(), file );
+	}
+	return finishWrite( file, path );
+}
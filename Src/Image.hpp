@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Math.hpp"
+
+// 8-bit images take pixels packed as 0x00RRGGBB, the layout of the frame buffer, rows top to bottom.
+bool writePPM( const std::string &path, int width, int height, const uint32_t *pixels );
+bool writePNG( const std::string &path, int width, int height, const uint32_t *pixels );
+
+// PNG for a ".png" path, binary PPM otherwise.
+bool writeImage( const std::string &path, int width, int height, const uint32_t *pixels );
+
+// Linear float RGB as a little-endian PFM, scaled by `scale` (e.g. 1 / samples to store the mean).
+bool writePFM( const std::string &path, int width, int height, const Vec3 *pixels, float scale = 1.0f );
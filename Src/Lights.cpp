@@ -0,0 +1,152 @@
+#include "Lights.hpp"
+#include "Scene.hpp"
+#include "Shading.hpp"
+
+namespace
+{
+
+// lights seen this close to edge-on are left to BSDF sampling
+const float MIN_LIGHT_COSINE = 1e-6f;
+
+float lightArea( const Light &light )
+{
+	if ( light.radius > 0.0f )
+		return 4.0f * M_PI * light.radius * light.radius;
+	return 0.5f * light.edge1.cross( light.edge2 ).length();
+}
+
+void addLight( SceneLights &lights, const Light &light )
+{
+	float power = luminance( light.emission ) * lightArea( light );
+	if ( !( power > 0.0f ) )
+		return;
+	lights.totalPower += power;
+	lights.lights.push_back( light );
+	lights.cdf.push_back( lights.totalPower );
+}
+
+} // namespace
+
+LightSample SceneLights::sample( float u0, float u1, float u2 ) const
+{
+	size_t       index = std::upper_bound( cdf.begin(), cdf.end(), u0 ) - cdf.begin();
+	const Light &light = lights[std::min( index, lights.size() - 1 )];
+
+	LightSample sample;
+	sample.emission = light.emission;
+	if ( light.radius > 0.0f )
+	{
+		float z       = 1.0f - 2.0f * u1;
+		float r       = std::sqrt( std::max( 0.0f, 1.0f - z * z ) );
+		float phi     = 2 * M_PI * u2;
+		sample.normal = Vec3( r * std::cos( phi ), r * std::sin( phi ), z );
+		sample.point  = light.position + sample.normal * light.radius;
+		return sample;
+	}
+
+	float su      = std::sqrt( u1 );
+	sample.point  = light.position + light.edge1 * ( su * ( 1.0f - u2 ) ) + light.edge2 * ( su * u2 );
+	sample.normal = light.edge1.cross( light.edge2 ).normalize();
+	return sample;
+}
+
+float SceneLights::areaPdf( const Vec3 &emission ) const
+{
+	return totalPower > 0.0f ? std::max( 0.0f, luminance( emission ) ) / totalPower : 0.0f;
+}
+
+void updateLights( Scene &scene )
+{
+	SceneLights &lights = scene.lights;
+	lights.lights.clear();
+	lights.cdf.clear();
+	lights.totalPower = 0.0f;
+
+	for ( const Sphere &sphere : scene.sphereBVH.spheres )
+	{
+		Light light;
+		light.position = sphere.center;
+		light.emission = sphere.emission;
+		light.radius   = sphere.radius;
+		addLight( lights, light );
+	}
+
+	// each mesh is scanned for emissive triangles once, however many instances it has
+	std::vector<std::vector<uint32_t>> emitters( scene.meshes.size() );
+	std::vector<bool>                  scanned( scene.meshes.size(), false );
+	for ( const MeshInstance &instance : scene.instances )
+	{
+		if ( instance.mesh >= scene.meshes.size() )
+			continue;
+		const MeshGeometry &geometry = scene.meshes[instance.mesh].geometry;
+		if ( !scanned[instance.mesh] )
+		{
+			for ( uint32_t i = 0; i < geometry.triangleCount; i++ )
+			{
+				if ( luminance( geometry.triangles[i].emission ) > 0.0f )
+					emitters[instance.mesh].push_back( i );
+			}
+			scanned[instance.mesh] = true;
+		}
+
+		for ( uint32_t i : emitters[instance.mesh] )
+		{
+			const Triangle &tri = geometry.triangles[i];
+			Light           light;
+			light.position = instance.transform.point( tri.v0 );
+			light.edge1    = instance.transform.point( tri.v1 ) - light.position;
+			light.edge2    = instance.transform.point( tri.v2 ) - light.position;
+			light.emission = tri.emission;
+			addLight( lights, light );
+		}
+	}
+
+	for ( float &power : lights.cdf )
+	{
+		power /= lights.totalPower;
+	}
+}
+
+bool sampleDirectLight( const SceneLights &lights,
+                        const Vec3        &point,
+                        const Vec3        &normal,
+                        const Vec3        &color,
+                        float              u0,
+                        float              u1,
+                        float              u2,
+                        DirectLight       &direct )
+{
+	if ( lights.empty() )
+		return false;
+
+	LightSample sample    = lights.sample( u0, u1, u2 );
+	Vec3        toLight   = sample.point - point;
+	float       distance2 = toLight.dot( toLight );
+	if ( distance2 <= 1e-8f )
+		return false;
+
+	direct.distance  = std::sqrt( distance2 );
+	direct.dir       = toLight * ( 1.0f / direct.distance );
+	float cosSurface = normal.dot( direct.dir );
+	float cosLight   = std::abs( sample.normal.dot( direct.dir ) );
+	if ( cosSurface <= 0.0f || cosLight <= MIN_LIGHT_COSINE )
+		return false;
+
+	// both densities per solid angle at `point`
+	float lightPdf  = lights.areaPdf( sample.emission ) * distance2 / cosLight;
+	float bsdfPdf   = cosSurface / M_PI;
+	direct.radiance = sample.emission * color * ( bsdfPdf / lightPdf * powerHeuristic( lightPdf, bsdfPdf ) );
+	return true;
+}
+
+Vec3 emittedRadiance( const SceneLights &lights, const Hit &hit, const Vec3 &dir, float bsdfPdf )
+{
+	if ( hit.emission.x == 0.0f && hit.emission.y == 0.0f && hit.emission.z == 0.0f )
+		return Vec3( 0 );
+
+	float cosLight = std::abs( hit.normal.dot( dir ) );
+	if ( bsdfPdf <= 0.0f || cosLight <= MIN_LIGHT_COSINE )
+		return hit.emission;
+	float lightPdf = lights.areaPdf( hit.emission ) * hit.t * hit.t / cosLight;
+	return hit.emission * powerHeuristic( bsdfPdf, lightPdf );
+}
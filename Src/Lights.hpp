@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Math.hpp"
+
+struct Scene;
+
+// One emitter in world space: an emissive sphere, or an emissive triangle with its instance transform
+// applied.
+struct Light
+{
+	Vec3  position;     // sphere centre or first triangle corner
+	Vec3  edge1, edge2; // triangle edges from `position`, unused for spheres
+	Vec3  emission;
+	float radius = 0.0f; // > 0 for spheres
+};
+
+// A point on a light picked by SceneLights::sample().
+struct LightSample
+{
+	Vec3 point;
+	Vec3 normal;
+	Vec3 emission;
+};
+
+// Every emitter of the scene with a power CDF for picking one: a light is chosen with probability
+// proportional to luminance times area and then sampled uniformly by area, so the density of a sampled
+// point per unit area is just its luminance over the total power.
+struct SceneLights
+{
+	std::vector<Light> lights;
+	std::vector<float> cdf; // running power up to and including each light, over `totalPower`
+	float              totalPower = 0.0f;
+
+	bool empty() const
+	{
+		return lights.empty();
+	}
+
+	// Light point from three uniform numbers in [0, 1).
+	LightSample sample( float u0, float u1, float u2 ) const;
+
+	// Density per unit area of sample() returning a point that emits `emission`.
+	float areaPdf( const Vec3 &emission ) const;
+};
+
+// Rebuilds `scene.lights` from the emissive spheres and every instance of a mesh with emissive triangles.
+void updateLights( Scene &scene );
+
+// Next-event estimate at a diffuse point: `dir` (unit) and `distance` are the shadow ray to a light point,
+// `radiance` what it adds when that ray is unoccluded, already divided by the sampling density and weighted
+// against BSDF sampling of the same light.
+struct DirectLight
+{
+	Vec3  dir;
+	float distance;
+	Vec3  radiance;
+};
+
+// Samples a light for the diffuse surface at `point` with albedo `color` and a `normal` facing the viewer;
+// returns false when there are no lights or the sample cannot contribute.
+bool sampleDirectLight( const SceneLights &lights,
+                        const Vec3        &point,
+                        const Vec3        &normal,
+                        const Vec3        &color,
+                        float              u0,
+                        float              u1,
+                        float              u2,
+                        DirectLight       &direct );
+
+// What `hit`, reached along unit direction `dir`, emits back along it, weighted against sampling that
+// light directly when the ray was a bounce sampled with solid angle density `bsdfPdf`. Camera rays and
+// mirror bounces pass 0 and get the full emission.
+Vec3 emittedRadiance( const SceneLights &lights, const Hit &hit, const Vec3 &dir, float bsdfPdf );
@@ -1,8 +1,12 @@
 #include <SDL2/SDL.h>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
@@ -11,182 +15,203 @@
 
 #include "Camera.hpp"
 #include "CameraController.hpp"
+#include "DynamicResolution.hpp"
+#include "FrameMailbox.hpp"
+#include "Headless.hpp"
 #include "Math.hpp"
 #include "RenderUtils.hpp"
-#include "Utils.hpp"
+#include "Renderer.hpp"
 
-const int WINDOW_WIDTH  = 1080;
-const int WINDOW_HEIGHT = 720;
+namespace
+{
 
-const int RENDER_TARGET_WIDTH  = WINDOW_WIDTH;
-const int RENDER_TARGET_HEIGHT = WINDOW_HEIGHT;
+// What the SDL thread asks of the render thread, which picks it up before every frame.
+struct ViewRequest
+{
+	Camera  camera;
+	bool    primaryPackets;
+	bool    denoise;
+	Tonemap  tonemap = Tonemap::CLAMP;
+	bool     reset   = false; // drop the accumulated samples
+	uint64_t serial  = 0;     // bumped on every change, so the render thread can tell it has nothing new
+};
+
+bool samePose( const Camera &a, const Camera &b )
+{
+	const Vec3 &p = a.position, &q = b.position;
+	return p.x == q.x && p.y == q.y && p.z == q.z && a.yaw == b.yaw && a.pitch == b.pitch;
+}
 
-const int MAX_DEPTH = 5;
-const int THREADS   = std::thread::hardware_concurrency();
+} // namespace
 
-Vec3 trace( const Ray                             &ray,
-            std::mt19937                          &rng,
-            std::uniform_real_distribution<float> &dist,
-            const SphereBVH                       &sphereBVH,
-            const std::vector<Mesh>               &meshes,
-            int                                    depth = 0 )
+int main( int argc, char *argv[] )
 {
-	if ( depth >= MAX_DEPTH )
-		return Vec3( 0 );
+	using Clock = std::chrono::steady_clock;
 
-	Hit closestHit;
-	closestHit.t = 1e9;
-	bool hit     = false;
+	Options options;
+	if ( !parseOptions( argc, argv, options ) )
+		return 1;
 
-	if ( sphereBVH.intersect( ray, closestHit ) )
-	{
-		hit = true;
-	}
+	if ( options.headless )
+		return renderHeadless( options );
+
+	const int RENDER_TARGET_WIDTH  = options.render.width;
+	const int RENDER_TARGET_HEIGHT = options.render.height;
+
+	SDL_Init( SDL_INIT_VIDEO );
+
+	SDL_Window *win = SDL_CreateWindow( "DK's Path Tracer",
+	                                    100,
+	                                    100,
+	                                    RENDER_TARGET_WIDTH,
+	                                    RENDER_TARGET_HEIGHT,
+	                                    SDL_WINDOW_SHOWN );
+	SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
 
-	for ( const auto &mesh : meshes )
+	SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
+	SDL_RenderSetLogicalSize( ren, RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT );
+	SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
+
+	// double buffered: the render thread writes the locked back texture while the front one is shown
+	SDL_Texture *textures[2];
+	for ( SDL_Texture *&tex : textures )
 	{
-		Hit meshHit = closestHit;
-		if ( intersectMesh( ray, mesh, meshHit ) && meshHit.t < closestHit.t )
-		{
-			closestHit = meshHit;
-			hit        = true;
-		}
+		tex = SDL_CreateTexture( ren,
+		                         SDL_PIXELFORMAT_RGB888,
+		                         SDL_TEXTUREACCESS_STREAMING,
+		                         RENDER_TARGET_WIDTH,
+		                         RENDER_TARGET_HEIGHT );
 	}
+	int front = 0, back = 1;
 
-	Hit groundHit;
-	groundHit.t = 1e9;
-	if ( intersectGround( ray, groundHit ) && groundHit.t < closestHit.t )
+	ThreadPool pool( options.threads );
+
+	Scene scene;
+	scene.sphereBVH = SphereBVH( defaultSpheres() );
+	if ( !options.objPath.empty() )
 	{
-		closestHit = groundHit;
-		hit        = true;
+		addOBJMesh( scene, options.objPath, pool, options.cache, options.instances, options.bvhMode );
 	}
+	if ( options.room )
+		addRoom( scene, pool, options.bvhMode );
+	updateTopLevel( scene );
 
-	if ( hit )
-	{
-		Vec3 p = ray.origin + ray.dir * closestHit.t;
-		if ( closestHit.reflective )
-		{
-			Vec3 reflectDir = ray.dir - closestHit.normal * 2.0f * ray.dir.dot( closestHit.normal );
-			return trace( Ray( p + reflectDir * 0.001f, reflectDir.normalize() ),
-			              rng,
-			              dist,
-			              sphereBVH,
-			              meshes,
-			              depth + 1 ) *
-			       closestHit.color;
-		}
+	Camera camera = startCamera( options );
 
-		float r1  = dist( rng );
-		float r2  = dist( rng );
-		float phi = 2 * M_PI * r1;
-		float r   = std::sqrt( r2 );
-		float x = r * std::cos( phi ), y = r * std::sin( phi ), z = std::sqrt( 1 - r2 );
-		Vec3  u = closestHit.normal
-		             .cross( std::abs( closestHit.normal.x ) > 0.1f ? Vec3( 0, 1, 0 ) : Vec3( 1, 0, 0 ) )
-		             .normalize();
-		Vec3 v   = closestHit.normal.cross( u );
-		Vec3 dir = ( u * x + v * y + closestHit.normal * z ).normalize();
-
-		return closestHit.color *
-		       trace( Ray( p + dir * 0.001f, dir ), rng, dist, sphereBVH, meshes, depth + 1 );
-	}
+	int  prevMouseX = 0, prevMouseY = 0;
+	bool mouseGrabbed          = false;
+	bool showBVH               = false;
+	bool showTriangles         = false;
+	int  bvhVisualizationDepth = 2;
 
-	return Vec3( 0.2f, 0.3f, 0.6f );
-}
+	Renderer renderer( pool, options.render, SDL_GetTicks() );
+	std::cout << "Rendering with " << pool.size() << " threads" << std::endl;
 
-void renderBlock( std::vector<Vec3>       &accum,
-                  std::vector<uint32_t>   &pixels,
-                  Camera                  &camera,
-                  const SphereBVH         &sphereBVH,
-                  const std::vector<Mesh> &meshes,
-                  int                      startY,
-                  int                      endY,
-                  std::atomic<int>        &frameCount )
-{
-	std::mt19937                          rng( SDL_GetTicks() + startY );
-	std::uniform_real_distribution<float> dist( 0, 1 );
-	for ( int y = startY; y < endY; ++y )
+	std::mutex        requestMutex;
+	ViewRequest       request{ camera, options.render.primaryPackets, options.render.denoise };
+	FrameMailbox      mailbox;
+	std::atomic<bool> running{ true };
+	request.tonemap = options.render.tonemap;
+
+	// the render thread owns the renderer and the pool: it renders frame after frame and resolves each into
+	// the back texture whenever the SDL thread has one on offer, so presenting never waits for a frame. Once
+	// the image converged it sleeps until the SDL thread asks for something new.
+	auto renderLoop = [&]
 	{
-		for ( int x = 0; x < RENDER_TARGET_WIDTH; ++x )
+		StatsReporter     statsReporter{ options.statsInterval, options.statsJSON };
+		DynamicResolution resolution{ options.targetFrameTime };
+
+		Camera   current    = startCamera( options );
+		uint64_t seenSerial = 0;
+		bool     shown      = false; // the last frame reached a texture
+		while ( running )
 		{
-			float u = ( x + dist( rng ) ) / RENDER_TARGET_WIDTH * 2 - 1;
-			float v = ( y + dist( rng ) ) / RENDER_TARGET_HEIGHT * 2 - 1;
-			u *= (float)RENDER_TARGET_WIDTH / RENDER_TARGET_HEIGHT;
-			Ray  ray   = camera.getRay( u, -v );
-			Vec3 color = trace( ray, rng, dist, sphereBVH, meshes );
-			int  idx   = y * RENDER_TARGET_WIDTH + x;
-			accum[idx] += color;
-			Vec3 avg = accum[idx] * ( 1.0f / frameCount.load() );
-			avg.x    = std::pow( std::clamp( avg.x, 0.0f, 1.0f ), 1 / 2.2f );
-			avg.y    = std::pow( std::clamp( avg.y, 0.0f, 1.0f ), 1 / 2.2f );
-			avg.z    = std::pow( std::clamp( avg.z, 0.0f, 1.0f ), 1 / 2.2f );
-			pixels[idx] =
-			    ( uint8_t( avg.x * 255 ) << 16 ) | ( uint8_t( avg.y * 255 ) << 8 ) | uint8_t( avg.z * 255 );
-		}
-	}
-}
+			Camera previous = current;
+			bool   resetRequested, requested;
+			{
+				std::lock_guard<std::mutex> lock( requestMutex );
+				requested                        = request.serial != seenSerial;
+				seenSerial                       = request.serial;
+				current                          = request.camera;
+				renderer.settings.primaryPackets = request.primaryPackets;
+				renderer.settings.denoise        = request.denoise;
+				renderer.settings.tonemap        = request.tonemap;
+				resetRequested                   = request.reset;
+				request.reset                    = false;
+			}
 
-int main( int argc, char *argv[] )
-{
-	SDL_Init( SDL_INIT_VIDEO );
+			bool cameraChanged = !samePose( previous, current );
 
-	SDL_Window *win =
-	    SDL_CreateWindow( "DK's Path Tracer", 100, 100, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN );
-	SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED );
+			// meshes moved since the last frame: refit or rebuild the top level, old samples are stale
+			bool sceneChanged = updateTopLevel( scene );
 
-	SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
-	SDL_RenderSetLogicalSize( ren, RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT );
-	SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
+			if ( !renderer.converged() || requested || sceneChanged )
+			{
+				if ( resetRequested || sceneChanged || ( cameraChanged && !renderer.settings.temporal ) )
+				{
+					renderer.reset();
+				}
+				else if ( cameraChanged )
+				{
+					// temporal mode: keep what still lines up with the new view
+					renderer.reproject( previous, current );
+				}
 
-	SDL_Texture *tex = SDL_CreateTexture( ren,
-	                                      SDL_PIXELFORMAT_RGB888,
-	                                      SDL_TEXTUREACCESS_STREAMING,
-	                                      RENDER_TARGET_WIDTH,
-	                                      RENDER_TARGET_HEIGHT );
-
-	std::vector<uint32_t> pixels( RENDER_TARGET_WIDTH * RENDER_TARGET_HEIGHT );
-	std::vector<Vec3>     accum( RENDER_TARGET_WIDTH * RENDER_TARGET_HEIGHT );
-	std::atomic<int>      frameCount = 1;
-
-	std::vector<std::tuple<Vec3, float, Vec3, bool>> spheres = {
-	    { { 0, 1.0f, 0 }, 1.0f, { 1, 1.0f, 1.0f }, true },
-	    { { -2, 1, -2 }, 1.0f, { 1, 0.2f, 0.2f }, false },
-	    { { -3, 1, -6 }, 1.0f, { 0.2f, 1, 0.2f }, false },
-	    { { 4, 1, -4 }, 1.0f, { 0.2f, 0.2f, 1 }, false },
-	    { { 3, 1, -6 }, 0.5f, { 1, 1, 0.2f }, false },
-	};
+				// frames rendered while the camera moves pick their scale from the time the last one took
+				auto frameStart = Clock::now();
+				renderer.renderFrame( current, scene );
+				float frameSeconds = std::chrono::duration<float>( Clock::now() - frameStart ).count();
+
+				renderer.settings.pixelScale = resolution.update( frameSeconds, cameraChanged );
+				shown                        = false;
+			}
+
+			int pitch;
+			if ( uint32_t *target = shown ? nullptr : mailbox.take( pitch ) )
+			{
+				renderer.resolve( target, pitch );
+				mailbox.filled();
+				shown = true;
+			}
+
+			if ( statsReporter.update( renderer.totalStats() ) )
+				renderer.resetStats();
 
-	SphereBVH         sphereBVH( spheres, 0, spheres.size() );
-	std::vector<Mesh> meshes;
+			if ( renderer.converged() )
+				mailbox.waitForWake( !shown );
+		}
+	};
+	std::thread renderThread( renderLoop );
 
-	if ( argc > 1 )
+	// Locks the back texture and offers its memory to the render thread; false when it cannot be locked,
+	// the next present tries again.
+	auto offerBackTexture = [&]
 	{
-		Mesh objMesh;
-		if ( loadOBJ( argv[1], objMesh, Vec3( 0.9f, 0.9f, 0.9f ), false ) )
+		void *texturePixels;
+		int   pitch;
+		if ( SDL_LockTexture( textures[back], nullptr, &texturePixels, &pitch ) != 0 )
 		{
-			objMesh.setScale( 1.0f );
-			objMesh.translate( Vec3( 0, 1.0f, -5.0f ) );
-			objMesh.buildBVH();
-			meshes.push_back( std::move( objMesh ) );
-			std::cout << "Loaded OBJ with " << meshes.back().triangles.size() << " triangles" << std::endl;
+			std::cerr << "Failed to lock the frame texture: " << SDL_GetError() << std::endl;
+			return false;
 		}
-	}
-
-	Camera camera( Vec3( 0, 2, 0 ) );
-
-	int  prevMouseX = 0, prevMouseY = 0;
-	bool mouseGrabbed          = false;
-	bool showBVH               = false;
-	bool showTriangles         = false;
-	int  bvhVisualizationDepth = 2;
+		mailbox.offer( static_cast<uint32_t *>( texturePixels ), pitch / int( sizeof( uint32_t ) ) );
+		return true;
+	};
 
-	const int                BLOCK_SIZE = RENDER_TARGET_HEIGHT / THREADS;
-	std::vector<std::thread> renderThreads( THREADS );
+	// nothing is rendered yet, show black until the first frame arrives
+	void *frontPixels;
+	int   frontPitch;
+	if ( SDL_LockTexture( textures[front], nullptr, &frontPixels, &frontPitch ) == 0 )
+	{
+		std::memset( frontPixels, 0, size_t( frontPitch ) * RENDER_TARGET_HEIGHT );
+		SDL_UnlockTexture( textures[front] );
+	}
+	bool backLocked = offerBackTexture();
 
-	bool      running = true;
 	SDL_Event event;
 	while ( running )
 	{
+		bool requested = false; // the render thread has something new to do
 		while ( SDL_PollEvent( &event ) )
 		{
 			if ( event.type == SDL_QUIT )
@@ -197,8 +222,9 @@ int main( int argc, char *argv[] )
 					running = false;
 				else if ( event.key.keysym.sym == SDLK_r )
 				{
-					std::fill( accum.begin(), accum.end(), Vec3( 0 ) );
-					frameCount = 1;
+					std::lock_guard<std::mutex> lock( requestMutex );
+					request.reset = true;
+					requested     = true;
 				}
 				else if ( event.key.keysym.sym == SDLK_b )
 				{
@@ -208,6 +234,29 @@ int main( int argc, char *argv[] )
 				{
 					showTriangles = !showTriangles;
 				}
+				else if ( event.key.keysym.sym == SDLK_p )
+				{
+					std::lock_guard<std::mutex> lock( requestMutex );
+					bool                       &packets = request.primaryPackets;
+					packets                             = !packets;
+					requested                           = true;
+					std::cout << "Primary ray packets: " << ( packets ? "on" : "off" ) << std::endl;
+				}
+				else if ( event.key.keysym.sym == SDLK_n )
+				{
+					std::lock_guard<std::mutex> lock( requestMutex );
+					bool                       &denoise = request.denoise;
+					denoise                             = !denoise;
+					requested                           = true;
+					std::cout << "Denoiser: " << ( denoise ? "on" : "off" ) << std::endl;
+				}
+				else if ( event.key.keysym.sym == SDLK_m )
+				{
+					std::lock_guard<std::mutex> lock( requestMutex );
+					request.tonemap = Tonemap( ( int( request.tonemap ) + 1 ) % TONEMAP_COUNT );
+					requested       = true;
+					std::cout << "Tonemap: " << tonemapName( request.tonemap ) << std::endl;
+				}
 				else if ( event.key.keysym.sym == SDLK_PLUS || event.key.keysym.sym == SDLK_EQUALS )
 				{
 					bvhVisualizationDepth = std::min( 10, bvhVisualizationDepth + 1 );
@@ -240,61 +289,42 @@ int main( int argc, char *argv[] )
 				float xrel = -event.motion.xrel * MOUSE_SENSITIVITY;
 				float yrel = event.motion.yrel * MOUSE_SENSITIVITY;
 				camera.rotate( xrel, -yrel );
-				std::fill( accum.begin(), accum.end(), Vec3( 0 ) );
-				frameCount = 1;
 			}
 		}
 
-		bool  cameraChanged = false;
-		Vec3  oldPosition   = camera.position;
-		float oldYaw        = camera.yaw;
-		float oldPitch      = camera.pitch;
-
 		cameraControllerMove( camera );
-
-		if ( oldPosition.x != camera.position.x || oldPosition.y != camera.position.y ||
-		     oldPosition.z != camera.position.z || oldYaw != camera.yaw || oldPitch != camera.pitch )
 		{
-			cameraChanged = true;
-		}
-
-		if ( cameraChanged )
-		{
-			std::fill( accum.begin(), accum.end(), Vec3( 0 ) );
-			frameCount = 1;
-		}
-
-		for ( int i = 0; i < THREADS; ++i )
-		{
-			int startY       = i * BLOCK_SIZE;
-			int endY         = ( i == THREADS - 1 ) ? RENDER_TARGET_HEIGHT : startY + BLOCK_SIZE;
-			renderThreads[i] = std::thread( renderBlock,
-			                                std::ref( accum ),
-			                                std::ref( pixels ),
-			                                std::ref( camera ),
-			                                std::ref( sphereBVH ),
-			                                std::ref( meshes ),
-			                                startY,
-			                                endY,
-			                                std::ref( frameCount ) );
+			std::lock_guard<std::mutex> lock( requestMutex );
+			if ( !samePose( request.camera, camera ) )
+			{
+				request.camera = camera;
+				requested      = true;
+			}
+			if ( requested )
+				request.serial++;
 		}
+		if ( requested )
+			mailbox.wake();
 
-		for ( auto &thread : renderThreads )
+		// a new frame landed in the back texture: show it and hand the other one to the render thread
+		if ( !backLocked )
+			backLocked = offerBackTexture();
+		else if ( mailbox.collect() )
 		{
-			thread.join();
+			SDL_UnlockTexture( textures[back] );
+			std::swap( front, back );
+			backLocked = offerBackTexture();
 		}
 
-		SDL_UpdateTexture( tex, nullptr, pixels.data(), RENDER_TARGET_WIDTH * sizeof( uint32_t ) );
 		SDL_RenderClear( ren );
 
 		SDL_Rect dst = { 0, 0, RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT };
-		SDL_RenderCopy( ren, tex, nullptr, &dst );
+		SDL_RenderCopy( ren, textures[front], nullptr, &dst );
 
 		if ( showBVH )
 		{
 			debugRenderBoundingBoxes( ren,
-			                          meshes,
-			                          sphereBVH,
+			                          scene,
 			                          camera,
 			                          RENDER_TARGET_WIDTH,
 			                          RENDER_TARGET_HEIGHT,
@@ -303,14 +333,23 @@ int main( int argc, char *argv[] )
 
 		if ( showTriangles )
 		{
-			debugRenderTriangles( ren, meshes, camera, RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT );
+			debugRenderTriangles( ren, scene, camera, RENDER_TARGET_WIDTH, RENDER_TARGET_HEIGHT );
 		}
 
+		// with vsync this paces the SDL thread to the display
 		SDL_RenderPresent( ren );
-		frameCount++;
 	}
 
-	SDL_DestroyTexture( tex );
+	// the render thread may be writing the back texture until it finished its frame
+	mailbox.wake();
+	renderThread.join();
+	if ( backLocked )
+		SDL_UnlockTexture( textures[back] );
+
+	for ( SDL_Texture *tex : textures )
+	{
+		SDL_DestroyTexture( tex );
+	}
 	SDL_DestroyRenderer( ren );
 	SDL_DestroyWindow( win );
 	SDL_Quit();
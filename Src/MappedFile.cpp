@@ -0,0 +1,33 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile( const std::string &path, bool sequential )
+{
+	int fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+		return;
+
+	struct stat info;
+	if ( fstat( fd, &info ) == 0 && info.st_size > 0 )
+	{
+		void *mapped = mmap( nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( mapped != MAP_FAILED )
+		{
+			data = static_cast<const char *>( mapped );
+			size = info.st_size;
+			if ( sequential )
+				madvise( mapped, size, MADV_SEQUENTIAL );
+		}
+	}
+	close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+	if ( data )
+		munmap( const_cast<char *>( data ), size );
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped on destruction. `data` stays null if the file can't
+// be opened or is empty.
+struct MappedFile
+{
+	const char *data = nullptr;
+	size_t      size = 0;
+
+	explicit MappedFile( const std::string &path, bool sequential = false );
+	~MappedFile();
+
+	MappedFile( const MappedFile & )            = delete;
+	MappedFile &operator=( const MappedFile & ) = delete;
+};
@@ -1,4 +1,8 @@
 #include "Math.hpp"
+#include "BVHTraversal.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "TrianglePacket.hpp"
 #include <algorithm>
 
 Vec3 Vec3::operator+( const Vec3 &b ) const
@@ -69,14 +73,14 @@ float Vec3::operator[]( int i ) const
 
 bool AABB::intersect( const Ray &ray, float &tMin, float &tMax ) const
 {
-	float txMin = ( min.x - ray.origin.x ) / ray.dir.x;
-	float txMax = ( max.x - ray.origin.x ) / ray.dir.x;
-	if ( ray.dir.x < 0 )
+	float txMin = ( min.x - ray.origin.x ) * ray.invDir.x;
+	float txMax = ( max.x - ray.origin.x ) * ray.invDir.x;
+	if ( ray.invDir.x < 0 )
 		std::swap( txMin, txMax );
 
-	float tyMin = ( min.y - ray.origin.y ) / ray.dir.y;
-	float tyMax = ( max.y - ray.origin.y ) / ray.dir.y;
-	if ( ray.dir.y < 0 )
+	float tyMin = ( min.y - ray.origin.y ) * ray.invDir.y;
+	float tyMax = ( max.y - ray.origin.y ) * ray.invDir.y;
+	if ( ray.invDir.y < 0 )
 		std::swap( tyMin, tyMax );
 
 	if ( txMin > tyMax || tyMin > txMax )
@@ -85,9 +89,9 @@ bool AABB::intersect( const Ray &ray, float &tMin, float &tMax ) const
 	tMin = std::max( txMin, tyMin );
 	tMax = std::min( txMax, tyMax );
 
-	float tzMin = ( min.z - ray.origin.z ) / ray.dir.z;
-	float tzMax = ( max.z - ray.origin.z ) / ray.dir.z;
-	if ( ray.dir.z < 0 )
+	float tzMin = ( min.z - ray.origin.z ) * ray.invDir.z;
+	float tzMax = ( max.z - ray.origin.z ) * ray.invDir.z;
+	if ( ray.invDir.z < 0 )
 		std::swap( tzMin, tzMax );
 
 	if ( tMin > tzMax || tzMin > tMax )
@@ -104,100 +108,825 @@ Vec3 AABB::getCenter() const
 	return ( min + max ) * 0.5f;
 }
 
-Triangle::Triangle( Vec3 a, Vec3 b, Vec3 c, Vec3 col, bool refl )
-    : v0( a ), v1( b ), v2( c ), color( col ), reflective( refl )
+float AABB::surfaceArea() const
 {
+	Vec3 d = max - min;
+	if ( d.x < 0 || d.y < 0 || d.z < 0 )
+		return 0.0f;
+	return 2.0f * ( d.x * d.y + d.y * d.z + d.z * d.x );
+}
 
-	Vec3 edge1 = v1 - v0;
-	Vec3 edge2 = v2 - v0;
-	normal     = edge1.cross( edge2 ).normalize();
+Transform Transform::translate( const Vec3 &offset )
+{
+	Transform result;
+	result.translation = offset;
+	return result;
+}
 
-	bbox.min.x = std::min( std::min( a.x, b.x ), c.x );
-	bbox.min.y = std::min( std::min( a.y, b.y ), c.y );
-	bbox.min.z = std::min( std::min( a.z, b.z ), c.z );
+Transform Transform::rotate( const Vec3 &axis, float degrees )
+{
+	Vec3  a = axis.normalize();
+	float r = degrees * float( M_PI ) / 180.0f;
+	float c = std::cos( r ), s = std::sin( r ), k = 1.0f - c;
 
-	bbox.max.x = std::max( std::max( a.x, b.x ), c.x );
-	bbox.max.y = std::max( std::max( a.y, b.y ), c.y );
-	bbox.max.z = std::max( std::max( a.z, b.z ), c.z );
+	Transform result;
+	result.rows[0] = Vec3( c + a.x * a.x * k, a.x * a.y * k - a.z * s, a.x * a.z * k + a.y * s );
+	result.rows[1] = Vec3( a.y * a.x * k + a.z * s, c + a.y * a.y * k, a.y * a.z * k - a.x * s );
+	result.rows[2] = Vec3( a.z * a.x * k - a.y * s, a.z * a.y * k + a.x * s, c + a.z * a.z * k );
+	return result;
 }
 
-BVHNode::BVHNode( std::vector<Triangle> &tris, int startIdx, int endIdx, int depth )
+Transform Transform::scale( const Vec3 &factors )
 {
-	const int MAX_TRIANGLES_PER_LEAF = 4;
-	const int MAX_DEPTH              = 20;
-	for ( int i = startIdx; i < endIdx; i++ )
+	Transform result;
+	result.rows[0] = Vec3( factors.x, 0, 0 );
+	result.rows[1] = Vec3( 0, factors.y, 0 );
+	result.rows[2] = Vec3( 0, 0, factors.z );
+	return result;
+}
+
+Transform Transform::operator*( const Transform &b ) const
+{
+	Transform result;
+	for ( int i = 0; i < 3; i++ )
 	{
-		bbox = AABB::combine( bbox, tris[i].bbox );
+		const Vec3 &row = rows[i];
+		result.rows[i]  = b.rows[0] * row.x + b.rows[1] * row.y + b.rows[2] * row.z;
 	}
+	result.translation = point( b.translation );
+	return result;
+}
+
+Transform Transform::inverse() const
+{
+	// adjugate over determinant; the columns of the adjugate are cross products of the rows
+	Vec3  c0  = rows[1].cross( rows[2] );
+	Vec3  c1  = rows[2].cross( rows[0] );
+	Vec3  c2  = rows[0].cross( rows[1] );
+	float det = rows[0].dot( c0 );
+	float inv = det != 0.0f ? 1.0f / det : 0.0f;
+
+	Transform result;
+	result.rows[0]     = Vec3( c0.x, c1.x, c2.x ) * inv;
+	result.rows[1]     = Vec3( c0.y, c1.y, c2.y ) * inv;
+	result.rows[2]     = Vec3( c0.z, c1.z, c2.z ) * inv;
+	result.translation = result.vector( translation ) * -1.0f;
+	return result;
+}
 
-	int numTriangles = endIdx - startIdx;
-	if ( numTriangles <= MAX_TRIANGLES_PER_LEAF || depth >= MAX_DEPTH )
+bool Transform::isIdentity() const
+{
+	return rows[0].x == 1 && rows[0].y == 0 && rows[0].z == 0 && rows[1].x == 0 && rows[1].y == 1 &&
+	       rows[1].z == 0 && rows[2].x == 0 && rows[2].y == 0 && rows[2].z == 1 && translation.x == 0 &&
+	       translation.y == 0 && translation.z == 0;
+}
+
+Vec3 Transform::point( const Vec3 &p ) const
+{
+	return vector( p ) + translation;
+}
+
+Vec3 Transform::vector( const Vec3 &v ) const
+{
+	return Vec3( rows[0].dot( v ), rows[1].dot( v ), rows[2].dot( v ) );
+}
+
+Vec3 Transform::transposedVector( const Vec3 &v ) const
+{
+	return rows[0] * v.x + rows[1] * v.y + rows[2] * v.z;
+}
+
+AABB Transform::bounds( const AABB &box ) const
+{
+	// the extent along each output axis is the absolute row applied to the half size
+	Vec3 center = point( box.getCenter() );
+	Vec3 half   = ( box.max - box.min ) * 0.5f;
+	auto span   = [&]( const Vec3 &row )
+	{ return std::abs( row.x ) * half.x + std::abs( row.y ) * half.y + std::abs( row.z ) * half.z; };
+
+	Vec3 extent( span( rows[0] ), span( rows[1] ), span( rows[2] ) );
+	return AABB( center - extent, center + extent );
+}
+
+namespace
+{
+
+// Binned SAH parameters shared by the triangle and sphere trees. Costs are relative: one node
+// traversal against one primitive test.
+const int   SAH_BINS           = 12;
+const float SAH_TRAVERSAL_COST = 1.0f;
+const float SAH_INTERSECT_COST = 1.0f;
+const int   SAH_MAX_LEAF_SIZE  = 16;
+
+struct SAHBin
+{
+	AABB bbox;
+	int  count = 0;
+};
+
+// Maps centroids to SAH_BINS bins along the axis of largest centroid extent.
+struct SAHBinning
+{
+	int   axis;
+	float axisMin;
+	float scale;
+
+	// False when all centroids coincide and there is nothing to split on.
+	bool init( const AABB &centroidBox )
 	{
-		triangles.reserve( numTriangles );
-		for ( int i = startIdx; i < endIdx; i++ )
+		Vec3 extent = centroidBox.max - centroidBox.min;
+		axis        = 0;
+		if ( extent.y > extent.x )
+			axis = 1;
+		if ( extent.z > extent[axis] )
+			axis = 2;
+
+		axisMin = centroidBox.min[axis];
+		scale   = extent[axis] > 0.0f ? SAH_BINS / extent[axis] : 0.0f;
+		return extent[axis] > 0.0f;
+	}
+
+	int binOf( const BVHPrimitive &p ) const
+	{
+		return std::min( SAH_BINS - 1, int( ( p.centroid[axis] - axisMin ) * scale ) );
+	}
+};
+
+// Finds the cheapest bin boundary for `numPrims` primitives in `nodeBox`; primitives in bins up to and
+// including `bestSplit` go left. Returns false when a leaf is cheaper or no split exists.
+bool findSAHSplit( const SAHBin *bins, int numPrims, const AABB &nodeBox, int &bestSplit )
+{
+	// sweep from the right to get the area/count of every right-hand side, then from the left
+	float rightArea[SAH_BINS - 1];
+	int   rightCount[SAH_BINS - 1];
+	AABB  box;
+	int   count = 0;
+	for ( int i = SAH_BINS - 1; i > 0; i-- )
+	{
+		box   = AABB::combine( box, bins[i].bbox );
+		count += bins[i].count;
+		rightArea[i - 1]  = box.surfaceArea();
+		rightCount[i - 1] = count;
+	}
+
+	float bestCost = std::numeric_limits<float>::max();
+	bestSplit      = -1;
+	box            = AABB();
+	count          = 0;
+	for ( int i = 0; i < SAH_BINS - 1; i++ )
+	{
+		box   = AABB::combine( box, bins[i].bbox );
+		count += bins[i].count;
+		if ( count == 0 || rightCount[i] == 0 )
+			continue;
+		float cost = box.surfaceArea() * count + rightArea[i] * rightCount[i];
+		if ( cost < bestCost )
 		{
-			triangles.push_back( tris[i] );
+			bestCost  = cost;
+			bestSplit = i;
 		}
+	}
+
+	if ( bestSplit < 0 )
+		return false;
+
+	float parentArea = nodeBox.surfaceArea();
+	float splitCost  = SAH_TRAVERSAL_COST +
+	                  ( parentArea > 0.0f ? SAH_INTERSECT_COST * bestCost / parentArea : 0.0f );
+	float leafCost = SAH_INTERSECT_COST * numPrims;
+	return !( splitCost >= leafCost && numPrims <= SAH_MAX_LEAF_SIZE );
+}
+
+// Bins the primitives in [startIdx, endIdx) along the axis of largest centroid extent and partitions
+// them in place at the cheapest bin boundary. Returns false when a leaf is cheaper (or no split
+// exists), otherwise stores the first index of the right half in `mid`.
+bool partitionBinnedSAH(
+    std::vector<BVHPrimitive> &prims, int startIdx, int endIdx, const AABB &nodeBox, int &mid )
+{
+	int numPrims = endIdx - startIdx;
+	if ( numPrims <= 1 )
+		return false;
+
+	AABB centroidBox;
+	for ( int i = startIdx; i < endIdx; i++ )
+	{
+		centroidBox = AABB::combine( centroidBox, AABB( prims[i].centroid, prims[i].centroid ) );
+	}
+
+	SAHBinning binning;
+	if ( !binning.init( centroidBox ) )
+		return false;
+
+	SAHBin bins[SAH_BINS];
+	for ( int i = startIdx; i < endIdx; i++ )
+	{
+		SAHBin &bin = bins[binning.binOf( prims[i] )];
+		bin.bbox    = AABB::combine( bin.bbox, prims[i].bbox );
+		bin.count++;
+	}
+
+	int bestSplit;
+	if ( !findSAHSplit( bins, numPrims, nodeBox, bestSplit ) )
+		return false;
+
+	auto it = std::partition( prims.begin() + startIdx,
+	                          prims.begin() + endIdx,
+	                          [&]( const BVHPrimitive &p ) { return binning.binOf( p ) <= bestSplit; } );
+	mid     = int( it - prims.begin() );
+	return true;
+}
+
+// Recursively builds the subtree over prims [startIdx, endIdx) in depth-first order.
+void buildSubtree(
+    std::vector<BVHPrimitive> &prims, int startIdx, int endIdx, int depth, std::vector<BVHNode> &nodes )
+{
+	uint32_t nodeIdx = nodes.size();
+	nodes.push_back( BVHNode{ AABB(), 0, 0 } );
+
+	AABB bbox;
+	for ( int i = startIdx; i < endIdx; i++ )
+	{
+		bbox = AABB::combine( bbox, prims[i].bbox );
+	}
+	nodes[nodeIdx].bbox = bbox;
+
+	int mid;
+	if ( depth >= BVH_MAX_DEPTH - 1 || !partitionBinnedSAH( prims, startIdx, endIdx, bbox, mid ) )
+	{
+		nodes[nodeIdx].offset = startIdx;
+		nodes[nodeIdx].count  = endIdx - startIdx;
 		return;
 	}
 
-	int axis = depth % 3;
-	std::sort( tris.begin() + startIdx,
-	           tris.begin() + endIdx,
-	           [axis]( const Triangle &a, const Triangle &b )
-	           {
-		           float centerA = ( a.bbox.min[axis] + a.bbox.max[axis] ) * 0.5f;
-		           float centerB = ( b.bbox.min[axis] + b.bbox.max[axis] ) * 0.5f;
-		           return centerA < centerB;
-	           } );
+	buildSubtree( prims, startIdx, mid, depth + 1, nodes );
+	nodes[nodeIdx].offset = nodes.size();
+	buildSubtree( prims, mid, endIdx, depth + 1, nodes );
+}
+
+// Moves items into the order produced by the builder, following permutation cycles so that no
+// second copy of the array is needed.
+template <typename T>
+void applyBVHOrder( std::vector<T> &items, std::vector<BVHPrimitive> &prims )
+{
+	for ( uint32_t i = 0; i < prims.size(); i++ )
+	{
+		if ( prims[i].index == i )
+			continue;
+		T        tmp = std::move( items[i] );
+		uint32_t dst = i;
+		uint32_t src = prims[i].index;
+		while ( src != i )
+		{
+			items[dst]       = std::move( items[src] );
+			prims[dst].index = dst;
+			dst              = src;
+			src              = prims[src].index;
+		}
+		items[dst]       = std::move( tmp );
+		prims[dst].index = dst;
+	}
+}
 
-	int mid = startIdx + numTriangles / 2;
+AABB sphereBounds( const Sphere &sphere )
+{
+	const Vec3 &center = sphere.center;
+	float       radius = sphere.radius;
+	return AABB( Vec3( center.x - radius, center.y - radius, center.z - radius ),
+	             Vec3( center.x + radius, center.y + radius, center.z + radius ) );
+}
+
+// Parallel builds: passes over large ranges run in chunks of this many primitives, and the top levels
+// are split until every subtree task holds at most 1 / (workers * SUBTREE_TASKS_PER_WORKER) of them.
+const int PARALLEL_BUILD_CHUNK     = 32768;
+const int PARALLEL_SPLIT_MIN_SIZE  = 4 * PARALLEL_BUILD_CHUNK;
+const int SUBTREE_TASKS_PER_WORKER = 8;
+const int SUBTREE_MIN_SIZE         = 4096;
+
+// LBVH leaves; Morton splits ignore primitive sizes, so small leaves keep the boxes tight.
+const int MORTON_LEAF_SIZE = 4;
+const int MORTON_RADIX     = 10; // bits per radix sort pass, three passes cover the 30-bit codes
 
-	left  = std::make_unique<BVHNode>( tris, startIdx, mid, depth + 1 );
-	right = std::make_unique<BVHNode>( tris, mid, endIdx, depth + 1 );
+inline int chunkCount( int count )
+{
+	return ( count + PARALLEL_BUILD_CHUNK - 1 ) / PARALLEL_BUILD_CHUNK;
 }
 
-bool BVHNode::intersect( const Ray &ray, Hit &hit ) const
+// Upper part of a parallel build: either split further (`left`/`right` set) or handed to a task.
+struct TopNode
+{
+	int      startIdx, endIdx, depth;
+	int      left  = -1;
+	int      right = -1;
+	int      task  = -1;
+	uint32_t index = 0; // position in the final node array
+};
+
+struct SubtreeTask
 {
-	float tMin, tMax;
-	if ( !bbox.intersect( ray, tMin, tMax ) || tMax < 0.001f || tMin > hit.t )
+	int                  top   = 0;
+	std::vector<BVHNode> nodes = {}; // local indices, rebased when copied into the final array
+	uint32_t             base  = 0;
+};
+
+struct ParallelBuild
+{
+	std::vector<BVHPrimitive> &prims;
+	ThreadPool                &pool;
+	BVHBuildMode               mode;
+	int                        taskSize = 0;
+	std::vector<BVHPrimitive>  scratch  = {}; // partition and reorder target, same size as `prims`
+	std::vector<uint32_t>      codes    = {}; // LBVH only: Morton codes of `prims`, sorted
+	std::vector<TopNode>       top      = {};
+	std::vector<SubtreeTask>   tasks    = {};
+};
+
+// partitionBinnedSAH() over a large range: bounds and bins are gathered per chunk on every worker, then
+// each chunk scatters its primitives through `scratch`, which keeps the partition stable.
+bool partitionBinnedSAHParallel( ParallelBuild &build, int startIdx, int endIdx, int &mid )
+{
+	std::vector<BVHPrimitive> &prims  = build.prims;
+	int                        chunks = chunkCount( endIdx - startIdx );
+	auto chunkBegin = [&]( int chunk ) { return startIdx + chunk * PARALLEL_BUILD_CHUNK; };
+	auto chunkEnd   = [&]( int chunk ) { return std::min( endIdx, chunkBegin( chunk + 1 ) ); };
+
+	std::vector<AABB> boxes( chunks * 2 ); // node box and centroid box per chunk
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        AABB bbox, centroidBox;
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+		                        {
+			                        const Vec3 &c = prims[i].centroid;
+			                        bbox          = AABB::combine( bbox, prims[i].bbox );
+			                        centroidBox   = AABB::combine( centroidBox, AABB( c, c ) );
+		                        }
+		                        boxes[chunk * 2]     = bbox;
+		                        boxes[chunk * 2 + 1] = centroidBox;
+	                        } );
+
+	AABB nodeBox, centroidBox;
+	for ( int chunk = 0; chunk < chunks; chunk++ )
+	{
+		nodeBox     = AABB::combine( nodeBox, boxes[chunk * 2] );
+		centroidBox = AABB::combine( centroidBox, boxes[chunk * 2 + 1] );
+	}
+
+	SAHBinning binning;
+	if ( !binning.init( centroidBox ) )
+		return false;
+
+	std::vector<SAHBin> chunkBins( chunks * SAH_BINS );
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        SAHBin *bins = &chunkBins[chunk * SAH_BINS];
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+		                        {
+			                        SAHBin &bin = bins[binning.binOf( prims[i] )];
+			                        bin.bbox    = AABB::combine( bin.bbox, prims[i].bbox );
+			                        bin.count++;
+		                        }
+	                        } );
+
+	SAHBin bins[SAH_BINS];
+	for ( int chunk = 0; chunk < chunks; chunk++ )
 	{
+		for ( int b = 0; b < SAH_BINS; b++ )
+		{
+			bins[b].bbox = AABB::combine( bins[b].bbox, chunkBins[chunk * SAH_BINS + b].bbox );
+			bins[b].count += chunkBins[chunk * SAH_BINS + b].count;
+		}
+	}
+
+	int bestSplit;
+	if ( !findSAHSplit( bins, endIdx - startIdx, nodeBox, bestSplit ) )
 		return false;
+
+	// left-hand primitives per chunk give every chunk its two write positions
+	std::vector<int> leftOffset( chunks ), rightOffset( chunks );
+	int              leftCount = 0;
+	for ( int chunk = 0; chunk < chunks; chunk++ )
+	{
+		for ( int b = 0; b <= bestSplit; b++ )
+			leftOffset[chunk] += chunkBins[chunk * SAH_BINS + b].count;
+		leftCount += leftOffset[chunk];
+	}
+	mid = startIdx + leftCount;
+	for ( int chunk = 0, left = startIdx, right = mid; chunk < chunks; chunk++ )
+	{
+		int chunkLeft      = leftOffset[chunk];
+		leftOffset[chunk]  = left;
+		rightOffset[chunk] = right;
+		left += chunkLeft;
+		right += chunkEnd( chunk ) - chunkBegin( chunk ) - chunkLeft;
 	}
 
-	bool hitAnything = false;
-	if ( !left && !right )
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        int left = leftOffset[chunk], right = rightOffset[chunk];
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+		                        {
+			                        bool goesLeft      = binning.binOf( prims[i] ) <= bestSplit;
+			                        int  dst           = goesLeft ? left++ : right++;
+			                        build.scratch[dst] = prims[i];
+		                        }
+	                        } );
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        std::copy( build.scratch.begin() + chunkBegin( chunk ),
+		                                   build.scratch.begin() + chunkEnd( chunk ),
+		                                   prims.begin() + chunkBegin( chunk ) );
+	                        } );
+	return true;
+}
+
+// Spreads the low 10 bits of `v` out to every third bit.
+inline uint32_t expandBits( uint32_t v )
+{
+	v = ( v * 0x00010001u ) & 0xFF0000FFu;
+	v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+	v = ( v * 0x00000011u ) & 0xC30C30C3u;
+	v = ( v * 0x00000005u ) & 0x49249249u;
+	return v;
+}
+
+// Sorts `prims` by the 30-bit Morton code of their centroid within the centroid bounds and leaves the
+// sorted codes in `build.codes`. LSD radix sort: every pass histograms per chunk, then each chunk
+// scatters to its own precomputed offsets, so a pass is stable and needs no synchronisation.
+void sortByMortonCode( ParallelBuild &build )
+{
+	std::vector<BVHPrimitive> &prims  = build.prims;
+	int                        count  = prims.size();
+	int                        chunks = chunkCount( count );
+	auto chunkBegin = [&]( int chunk ) { return chunk * PARALLEL_BUILD_CHUNK; };
+	auto chunkEnd   = [&]( int chunk ) { return std::min( count, chunkBegin( chunk + 1 ) ); };
+
+	std::vector<AABB> centroidBoxes( chunks );
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        AABB box;
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+			                        box = AABB::combine( box, AABB( prims[i].centroid, prims[i].centroid ) );
+		                        centroidBoxes[chunk] = box;
+	                        } );
+	AABB centroidBox;
+	for ( const AABB &box : centroidBoxes )
+		centroidBox = AABB::combine( centroidBox, box );
+
+	Vec3 extent = centroidBox.max - centroidBox.min;
+	Vec3 scale( extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+	            extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+	            extent.z > 0.0f ? 1023.0f / extent.z : 0.0f );
+
+	std::vector<uint32_t> codes( count ), order( count ), codesTmp( count ), orderTmp( count );
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+		                        {
+			                        Vec3     p = ( prims[i].centroid - centroidBox.min ) * scale;
+			                        uint32_t x = expandBits( uint32_t( p.x ) );
+			                        uint32_t y = expandBits( uint32_t( p.y ) );
+			                        uint32_t z = expandBits( uint32_t( p.z ) );
+			                        codes[i]   = x << 2 | y << 1 | z;
+			                        order[i] = i;
+		                        }
+	                        } );
+
+	const int             buckets = 1 << MORTON_RADIX;
+	std::vector<uint32_t> offsets( chunks * buckets );
+	for ( int shift = 0; shift < 30; shift += MORTON_RADIX )
 	{
-		for ( const auto &tri : triangles )
+		std::fill( offsets.begin(), offsets.end(), 0 );
+		build.pool.parallelFor( chunks,
+		                        [&]( int chunk, int )
+		                        {
+			                        uint32_t *histogram = &offsets[chunk * buckets];
+			                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+				                        histogram[( codes[i] >> shift ) & ( buckets - 1 )]++;
+		                        } );
+
+		// bucket-major prefix sum: all of bucket 0 in chunk order, then bucket 1, ...
+		uint32_t sum = 0;
+		for ( int bucket = 0; bucket < buckets; bucket++ )
 		{
-			Hit tempHit = hit;
-			if ( intersectTriangle( ray, tri, tempHit ) && tempHit.t < hit.t )
+			for ( int chunk = 0; chunk < chunks; chunk++ )
 			{
-				hit         = tempHit;
-				hitAnything = true;
+				uint32_t n                        = offsets[chunk * buckets + bucket];
+				offsets[chunk * buckets + bucket] = sum;
+				sum += n;
 			}
 		}
-		return hitAnything;
+
+		build.pool.parallelFor( chunks,
+		                        [&]( int chunk, int )
+		                        {
+			                        uint32_t *offset = &offsets[chunk * buckets];
+			                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+			                        {
+				                        uint32_t dst  = offset[( codes[i] >> shift ) & ( buckets - 1 )]++;
+				                        codesTmp[dst] = codes[i];
+				                        orderTmp[dst] = order[i];
+			                        }
+		                        } );
+		codes.swap( codesTmp );
+		order.swap( orderTmp );
 	}
 
-	if ( left )
+	build.pool.parallelFor( chunks,
+	                        [&]( int chunk, int )
+	                        {
+		                        for ( int i = chunkBegin( chunk ); i < chunkEnd( chunk ); i++ )
+			                        build.scratch[i] = prims[order[i]];
+	                        } );
+	prims.swap( build.scratch );
+	build.codes = std::move( codes );
+}
+
+// First index of the upper half of Morton-sorted [startIdx, endIdx): where the highest bit that differs
+// across the range becomes set, or the middle when all codes are equal.
+int mortonSplit( const uint32_t *codes, int startIdx, int endIdx )
+{
+	uint32_t first = codes[startIdx];
+	uint32_t last  = codes[endIdx - 1];
+	if ( first == last )
+		return ( startIdx + endIdx ) / 2;
+
+	int bit = 31 - __builtin_clz( first ^ last );
+	int lo  = startIdx;
+	int hi  = endIdx - 1; // codes[lo] has the bit clear, codes[hi] has it set
+	while ( lo + 1 < hi )
 	{
-		hitAnything |= left->intersect( ray, hit );
+		int mid = ( lo + hi ) / 2;
+		if ( ( codes[mid] >> bit ) & 1 )
+			hi = mid;
+		else
+			lo = mid;
 	}
+	return hi;
+}
 
-	if ( right )
+// Builds the LBVH subtree over Morton-sorted prims [startIdx, endIdx) in depth-first order, boxes
+// bottom-up; returns the subtree's box.
+AABB buildMortonSubtree( const std::vector<BVHPrimitive> &prims,
+                         const uint32_t                  *codes,
+                         int                              startIdx,
+                         int                              endIdx,
+                         int                              depth,
+                         std::vector<BVHNode>            &nodes )
+{
+	uint32_t nodeIdx = nodes.size();
+	nodes.push_back( BVHNode{ AABB(), 0, 0 } );
+
+	AABB bbox;
+	if ( endIdx - startIdx <= MORTON_LEAF_SIZE || depth >= BVH_MAX_DEPTH - 1 )
 	{
-		hitAnything |= right->intersect( ray, hit );
+		for ( int i = startIdx; i < endIdx; i++ )
+		{
+			bbox = AABB::combine( bbox, prims[i].bbox );
+		}
+		nodes[nodeIdx] = BVHNode{ bbox, uint32_t( startIdx ), uint32_t( endIdx - startIdx ) };
+		return bbox;
 	}
 
-	return hitAnything;
+	int  mid              = mortonSplit( codes, startIdx, endIdx );
+	AABB left             = buildMortonSubtree( prims, codes, startIdx, mid, depth + 1, nodes );
+	nodes[nodeIdx].offset = nodes.size();
+	AABB right            = buildMortonSubtree( prims, codes, mid, endIdx, depth + 1, nodes );
+	bbox                  = AABB::combine( left, right );
+	nodes[nodeIdx].bbox   = bbox;
+	return bbox;
 }
 
-bool intersectSphere( const Ray &ray, Vec3 center, float radius, Vec3 color, bool reflective, Hit &hit )
+// Splits the top levels serially (each split itself parallel for SAH) and queues a task for every range
+// that is small enough or cannot be split here. Returns the index of the new TopNode.
+int splitTop( ParallelBuild &build, int startIdx, int endIdx, int depth )
 {
-	Vec3  oc = ray.origin - center;
+	int topIdx = build.top.size();
+	build.top.push_back( TopNode{ startIdx, endIdx, depth } );
+
+	int  mid;
+	bool split = false;
+	if ( endIdx - startIdx > build.taskSize && depth < BVH_MAX_DEPTH - 1 )
+	{
+		if ( build.mode == BVHBuildMode::LBVH )
+		{
+			mid   = mortonSplit( build.codes.data(), startIdx, endIdx );
+			split = true;
+		}
+		else if ( endIdx - startIdx >= PARALLEL_SPLIT_MIN_SIZE )
+		{
+			split = partitionBinnedSAHParallel( build, startIdx, endIdx, mid );
+		}
+		else
+		{
+			AABB bbox;
+			for ( int i = startIdx; i < endIdx; i++ )
+			{
+				bbox = AABB::combine( bbox, build.prims[i].bbox );
+			}
+			split = partitionBinnedSAH( build.prims, startIdx, endIdx, bbox, mid );
+		}
+	}
+
+	if ( !split )
+	{
+		build.top[topIdx].task = build.tasks.size();
+		build.tasks.push_back( SubtreeTask{ topIdx } );
+		return topIdx;
+	}
+
+	int left                = splitTop( build, startIdx, mid, depth + 1 );
+	int right               = splitTop( build, mid, endIdx, depth + 1 );
+	build.top[topIdx].left  = left;
+	build.top[topIdx].right = right;
+	return topIdx;
+}
+
+// Assigns final node positions to the TopNode subtree at `topIdx` starting at `base`, in the same
+// depth-first order the serial builder produces; returns the position after it.
+uint32_t layoutTop( ParallelBuild &build, int topIdx, uint32_t base )
+{
+	TopNode &node = build.top[topIdx];
+	node.index    = base;
+	if ( node.task >= 0 )
+	{
+		build.tasks[node.task].base = base;
+		return base + build.tasks[node.task].nodes.size();
+	}
+	uint32_t next = layoutTop( build, node.left, base + 1 );
+	return layoutTop( build, node.right, next );
+}
+
+} // namespace
+
+Triangle::Triangle( Vec3 a, Vec3 b, Vec3 c, Vec3 col, bool refl, Vec3 emit )
+    : v0( a ), v1( b ), v2( c ), color( col ), reflective( refl ), emission( emit )
+{
+
+	Vec3 edge1 = v1 - v0;
+	Vec3 edge2 = v2 - v0;
+	normal     = edge1.cross( edge2 ).normalize();
+}
+
+AABB Triangle::bounds() const
+{
+	return AABB( Vec3( std::min( std::min( v0.x, v1.x ), v2.x ),
+	                   std::min( std::min( v0.y, v1.y ), v2.y ),
+	                   std::min( std::min( v0.z, v1.z ), v2.z ) ),
+	             Vec3( std::max( std::max( v0.x, v1.x ), v2.x ),
+	                   std::max( std::max( v0.y, v1.y ), v2.y ),
+	                   std::max( std::max( v0.z, v1.z ), v2.z ) ) );
+}
+
+void buildBVH( std::vector<BVHPrimitive> &prims, std::vector<BVHNode> &nodes )
+{
+	nodes.clear();
+	if ( prims.empty() )
+		return;
+
+	nodes.reserve( 2 * prims.size() );
+	buildSubtree( prims, 0, prims.size(), 0, nodes );
+	nodes.shrink_to_fit();
+}
+
+void buildBVH( std::vector<BVHPrimitive> &prims,
+               std::vector<BVHNode>      &nodes,
+               ThreadPool                &pool,
+               BVHBuildMode               mode )
+{
+	nodes.clear();
+	if ( prims.empty() )
+		return;
+	if ( mode == BVHBuildMode::SAH && ( pool.size() == 1 || int( prims.size() ) <= SUBTREE_MIN_SIZE ) )
+	{
+		buildBVH( prims, nodes );
+		return;
+	}
+
+	ParallelBuild build{ prims, pool, mode };
+	build.taskSize =
+	    std::max<int>( SUBTREE_MIN_SIZE, prims.size() / ( pool.size() * SUBTREE_TASKS_PER_WORKER ) );
+	build.scratch.resize( prims.size() );
+	if ( mode == BVHBuildMode::LBVH )
+		sortByMortonCode( build );
+	splitTop( build, 0, prims.size(), 0 );
+
+	pool.parallelFor( build.tasks.size(),
+	                  [&build]( int i, int )
+	                  {
+		                  SubtreeTask   &task = build.tasks[i];
+		                  const TopNode &node = build.top[task.top];
+		                  task.nodes.reserve( 2 * ( node.endIdx - node.startIdx ) );
+		                  if ( build.mode == BVHBuildMode::LBVH )
+			                  buildMortonSubtree( build.prims,
+			                                      build.codes.data(),
+			                                      node.startIdx,
+			                                      node.endIdx,
+			                                      node.depth,
+			                                      task.nodes );
+		                  else
+			                  buildSubtree( build.prims, node.startIdx, node.endIdx, node.depth, task.nodes );
+	                  } );
+
+	nodes.resize( layoutTop( build, 0, 0 ) );
+	pool.parallelFor( build.tasks.size(),
+	                  [&build, &nodes]( int i, int )
+	                  {
+		                  const SubtreeTask &task = build.tasks[i];
+		                  for ( size_t j = 0; j < task.nodes.size(); j++ )
+		                  {
+			                  BVHNode node = task.nodes[j];
+			                  if ( !node.isLeaf() )
+				                  node.offset += task.base;
+			                  nodes[task.base + j] = node;
+		                  }
+	                  } );
+
+	// children come after their parent in `top`, so a backwards sweep has both child boxes ready
+	for ( size_t i = build.top.size(); i-- > 0; )
+	{
+		const TopNode &node = build.top[i];
+		if ( node.task >= 0 )
+			continue;
+		const BVHNode &left  = nodes[build.top[node.left].index];
+		const BVHNode &right = nodes[build.top[node.right].index];
+		nodes[node.index] = BVHNode{ AABB::combine( left.bbox, right.bbox ), build.top[node.right].index, 0 };
+	}
+}
+
+void TriangleBVH::build( std::vector<Triangle> &tris )
+{
+	std::vector<BVHPrimitive> prims( tris.size() );
+	for ( uint32_t i = 0; i < tris.size(); i++ )
+	{
+		AABB box = tris[i].bounds();
+		prims[i] = { box, box.getCenter(), i };
+	}
+
+	buildBVH( prims, nodes );
+	applyBVHOrder( tris, prims );
+}
+
+void TriangleBVH::build( std::vector<Triangle> &tris, ThreadPool &pool, BVHBuildMode mode )
+{
+	int                       count  = tris.size();
+	int                       chunks = chunkCount( count );
+	std::vector<BVHPrimitive> prims( count );
+	pool.parallelFor( chunks,
+	                  [&]( int chunk, int )
+	                  {
+		                  int end = std::min( count, ( chunk + 1 ) * PARALLEL_BUILD_CHUNK );
+		                  for ( int i = chunk * PARALLEL_BUILD_CHUNK; i < end; i++ )
+		                  {
+			                  AABB box = tris[i].bounds();
+			                  prims[i] = { box, box.getCenter(), uint32_t( i ) };
+		                  }
+	                  } );
+
+	buildBVH( prims, nodes, pool, mode );
+
+	// a parallel gather beats following the permutation cycles serially, at the cost of a second copy
+	std::vector<Triangle> ordered( count );
+	pool.parallelFor( chunks,
+	                  [&]( int chunk, int )
+	                  {
+		                  int end = std::min( count, ( chunk + 1 ) * PARALLEL_BUILD_CHUNK );
+		                  for ( int i = chunk * PARALLEL_BUILD_CHUNK; i < end; i++ )
+			                  ordered[i] = tris[prims[i].index];
+	                  } );
+	tris.swap( ordered );
+}
+
+bool TriangleBVH::intersect( const Ray            &ray,
+                             const Triangle       *triangles,
+                             const TrianglePacket *packets,
+                             Hit                  &hit ) const
+{
+	return !empty() && intersectTriangleBVH( nodes.data(), ray, triangles, packets, hit );
+}
+
+bool intersectTriangleBVH( const BVHNode        *nodes,
+                           const Ray            &ray,
+                           const Triangle       *triangles,
+                           const TrianglePacket *packets,
+                           Hit                  &hit )
+{
+	return traverseBVH( nodes,
+	                    ray,
+	                    hit,
+	                    [&]( uint32_t offset, uint32_t count )
+	                    { return intersectTriangleRange( ray, triangles, packets, offset, count, hit ); } );
+}
+
+bool intersectSphere( const Ray &ray, const Sphere &sphere, Hit &hit )
+{
+	Vec3  oc = ray.origin - sphere.center;
 	float b  = oc.dot( ray.dir );
-	float c  = oc.dot( oc ) - radius * radius;
+	float c  = oc.dot( oc ) - sphere.radius * sphere.radius;
 	float h  = b * b - c;
 	if ( h < 0 )
 		return false;
@@ -209,13 +938,30 @@ bool intersectSphere( const Ray &ray, Vec3 center, float radius, Vec3 color, boo
 		return false;
 	hit.t          = t;
 	Vec3 p         = ray.origin + ray.dir * t;
-	hit.normal     = ( p - center ).normalize();
-	hit.color      = color;
-	hit.reflective = reflective;
+	hit.normal     = ( p - sphere.center ).normalize();
+	hit.color      = sphere.color;
+	hit.reflective = sphere.reflective;
+	hit.emission   = sphere.emission;
 	return true;
 }
 
 bool intersectTriangle( const Ray &ray, const Triangle &tri, Hit &hit )
+{
+	float t;
+	if ( intersectTriangle( ray, tri, t ) )
+	{
+		hit.t          = t;
+		hit.normal     = tri.normal;
+		hit.color      = tri.color;
+		hit.reflective = tri.reflective;
+		hit.emission   = tri.emission;
+		return true;
+	}
+
+	return false;
+}
+
+bool intersectTriangle( const Ray &ray, const Triangle &tri, float &t )
 {
 	const float EPSILON = 0.0000001f;
 	Vec3        edge1   = tri.v1 - tri.v0;
@@ -239,18 +985,12 @@ bool intersectTriangle( const Ray &ray, const Triangle &tri, Hit &hit )
 	if ( v < 0.0f || u + v > 1.0f )
 		return false;
 
-	float t = f * edge2.dot( q );
-
-	if ( t > EPSILON )
-	{
-		hit.t          = t;
-		hit.normal     = tri.normal;
-		hit.color      = tri.color;
-		hit.reflective = tri.reflective;
-		return true;
-	}
+	float dist = f * edge2.dot( q );
+	if ( dist <= EPSILON )
+		return false;
 
-	return false;
+	t = dist;
+	return true;
 }
 
 bool intersectGround( const Ray &ray, Hit &hit )
@@ -264,80 +1004,44 @@ bool intersectGround( const Ray &ray, Hit &hit )
 	hit.normal     = Vec3( 0, 1, 0 );
 	hit.color      = Vec3( 0.7f, 0.7f, 0.7f );
 	hit.reflective = false;
+	hit.emission   = Vec3( 0 );
 	return true;
 }
 
-SphereBVH::SphereBVH( std::vector<std::tuple<Vec3, float, Vec3, bool>> &sphereList,
-                      int                                               startIdx,
-                      int                                               endIdx,
-                      int                                               depth )
+SphereBVH::SphereBVH( std::vector<Sphere> sphereList )
+    : spheres( std::move( sphereList ) )
 {
-	const int MAX_SPHERES_PER_LEAF = 4;
-	const int MAX_DEPTH            = 20;
-
-	for ( int i = startIdx; i < endIdx; i++ )
-	{
-		const auto &[center, radius, color, reflective] = sphereList[i];
-		AABB sphereBox( Vec3( center.x - radius, center.y - radius, center.z - radius ),
-		                Vec3( center.x + radius, center.y + radius, center.z + radius ) );
-		bbox = AABB::combine( bbox, sphereBox );
-	}
-
-	int numSpheres = endIdx - startIdx;
-	if ( numSpheres <= MAX_SPHERES_PER_LEAF || depth >= MAX_DEPTH )
+	std::vector<BVHPrimitive> prims( spheres.size() );
+	for ( uint32_t i = 0; i < spheres.size(); i++ )
 	{
-		spheres.reserve( numSpheres );
-		for ( int i = startIdx; i < endIdx; i++ )
-		{
-			spheres.push_back( sphereList[i] );
-		}
-		return;
+		prims[i] = { sphereBounds( spheres[i] ), spheres[i].center, i };
 	}
 
-	int axis = depth % 3;
-
-	std::sort( sphereList.begin() + startIdx,
-	           sphereList.begin() + endIdx,
-	           [axis]( const auto &a, const auto &b )
-	           { return std::get<0>( a )[axis] < std::get<0>( b )[axis]; } );
-
-	int mid = startIdx + numSpheres / 2;
-
-	left  = std::make_unique<SphereBVH>( sphereList, startIdx, mid, depth + 1 );
-	right = std::make_unique<SphereBVH>( sphereList, mid, endIdx, depth + 1 );
+	buildBVH( prims, nodes );
+	applyBVHOrder( spheres, prims );
 }
 
 bool SphereBVH::intersect( const Ray &ray, Hit &hit ) const
 {
-	float tMin, tMax;
-	if ( !bbox.intersect( ray, tMin, tMax ) || tMax < 0.001f || tMin > hit.t )
-	{
+	if ( empty() )
 		return false;
-	}
-
-	bool hitAnything = false;
-	if ( !left && !right )
-	{
-		for ( const auto &[center, radius, color, reflective] : spheres )
-		{
-			Hit tempHit = hit;
-			if ( intersectSphere( ray, center, radius, color, reflective, tempHit ) && tempHit.t < hit.t )
-			{
-				hit         = tempHit;
-				hitAnything = true;
-			}
-		}
-		return hitAnything;
-	}
-
-	if ( left )
-	{
-		hitAnything |= left->intersect( ray, hit );
-	}
-	if ( right )
-	{
-		hitAnything |= right->intersect( ray, hit );
-	}
 
-	return hitAnything;
-}
\ No newline at end of file
+	return traverseBVH( nodes.data(),
+	                    ray,
+	                    hit,
+	                    [&]( uint32_t offset, uint32_t count )
+	                    {
+		                    STATS_ADD( sphereTests, count );
+		                    bool hitAnything = false;
+		                    for ( uint32_t i = offset; i < offset + count; i++ )
+		                    {
+			                    Hit tempHit = hit;
+			                    if ( intersectSphere( ray, spheres[i], tempHit ) && tempHit.t < hit.t )
+			                    {
+				                    hit         = tempHit;
+				                    hitAnything = true;
+			                    }
+		                    }
+		                    return hitAnything;
+	                    } );
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <vector>
 
 struct Vec3
@@ -30,7 +35,9 @@ struct Vec3
 struct Ray
 {
 	Vec3 origin, dir;
-	Ray( Vec3 o, Vec3 d ) : origin( o ), dir( d ) {}
+	Vec3 invDir; // 1 / dir, precomputed for the slab tests
+	Ray() = default;
+	Ray( Vec3 o, Vec3 d ) : origin( o ), dir( d ), invDir( 1.0f / d.x, 1.0f / d.y, 1.0f / d.z ) {}
 };
 
 struct Hit
@@ -39,6 +46,7 @@ struct Hit
 	Vec3  normal;
 	Vec3  color;
 	bool  reflective = false;
+	Vec3  emission; // radiance the surface gives off, zero for everything but lights
 };
 
 struct AABB
@@ -61,6 +69,32 @@ struct AABB
 	}
 
 	Vec3 getCenter() const;
+
+	float surfaceArea() const;
+};
+
+// Affine transform p -> rows * p + translation. Compose with operator*, the right-hand side applies first.
+struct Transform
+{
+	Vec3 rows[3];
+	Vec3 translation;
+
+	Transform() : rows{ Vec3( 1, 0, 0 ), Vec3( 0, 1, 0 ), Vec3( 0, 0, 1 ) }, translation( 0 ) {}
+
+	static Transform translate( const Vec3 &offset );
+	static Transform rotate( const Vec3 &axis, float degrees );
+	static Transform scale( const Vec3 &factors );
+
+	Transform operator*( const Transform &b ) const;
+	Transform inverse() const;
+	bool      isIdentity() const;
+
+	Vec3 point( const Vec3 &p ) const;
+	Vec3 vector( const Vec3 &v ) const;
+	Vec3 transposedVector( const Vec3 &v ) const; // rows^T * v, maps normals when called on the inverse
+
+	// box around the transformed corners of `box`
+	AABB bounds( const AABB &box ) const;
 };
 
 struct Triangle
@@ -69,44 +103,118 @@ struct Triangle
 	Vec3 normal;
 	Vec3 color;
 	bool reflective;
-	AABB bbox;
+	Vec3 emission; // from both sides
+
+	Triangle() = default;
+	Triangle( Vec3 a, Vec3 b, Vec3 c, Vec3 col, bool refl, Vec3 emit = Vec3( 0 ) );
 
-	Triangle( Vec3 a, Vec3 b, Vec3 c, Vec3 col, bool refl );
+	AABB bounds() const;
 };
 
 bool intersectTriangle( const Ray &ray, const Triangle &tri, Hit &hit );
 
+// Möller–Trumbore distance only; `t` is written on a hit.
+bool intersectTriangle( const Ray &ray, const Triangle &tri, float &t );
+
+struct TrianglePacket;
+class ThreadPool;
+
+// Primitive BVHs are stored as a flat, depth-first node array. An interior node's left child is the
+// node right after it, its right child is at `offset`; a leaf covers primitives [offset, offset + count).
+const int BVH_MAX_DEPTH = 64;
+
 struct BVHNode
 {
-	AABB                     bbox;
-	std::unique_ptr<BVHNode> left;
-	std::unique_ptr<BVHNode> right;
-	std::vector<Triangle>    triangles;
+	AABB     bbox;
+	uint32_t offset;
+	uint32_t count;
+
+	bool isLeaf() const
+	{
+		return count > 0;
+	}
+};
 
-	BVHNode() = default;
-	BVHNode( std::vector<Triangle> &tris, int startIdx, int endIdx, int depth = 0 );
+static_assert( sizeof( BVHNode ) == 32, "BVHNode should stay 32 bytes" );
 
-	bool intersect( const Ray &ray, Hit &hit ) const;
+// Build-time view of a primitive; `index` refers back into the caller's primitive array.
+struct BVHPrimitive
+{
+	AABB     bbox;
+	Vec3     centroid;
+	uint32_t index;
+};
+
+// Builds a binned SAH tree over `prims`. On return `prims` is in BVH order: leaf ranges index into it
+// and prims[i].index names the original primitive now expected at position i.
+void buildBVH( std::vector<BVHPrimitive> &prims, std::vector<BVHNode> &nodes );
+
+enum class BVHBuildMode
+{
+	SAH,  // binned SAH, the best trees
+	LBVH, // linear BVH over Morton-sorted centroids: several times faster to build, somewhat slower to trace
+};
+
+// buildBVH() on every worker of `pool`, with the same result contract. The top levels are split with
+// parallel binning and partitioning until there are enough subtrees to keep the workers busy, then the
+// subtrees are built as independent tasks and stitched into one depth-first array.
+void buildBVH( std::vector<BVHPrimitive> &prims,
+               std::vector<BVHNode>      &nodes,
+               ThreadPool                &pool,
+               BVHBuildMode               mode );
+
+// Nodes only: leaves reference the owner's triangle array, which build() reorders in place.
+struct TriangleBVH
+{
+	std::vector<BVHNode> nodes;
+
+	void build( std::vector<Triangle> &tris );
+	void build( std::vector<Triangle> &tris, ThreadPool &pool, BVHBuildMode mode );
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	bool intersect( const Ray            &ray,
+	                const Triangle       *triangles,
+	                const TrianglePacket *packets,
+	                Hit                  &hit ) const;
+};
+
+// TriangleBVH::intersect() on a bare, non-empty node array, e.g. one mapped from a scene cache.
+bool intersectTriangleBVH( const BVHNode        *nodes,
+                           const Ray            &ray,
+                           const Triangle       *triangles,
+                           const TrianglePacket *packets,
+                           Hit                  &hit );
+
+struct Sphere
+{
+	Vec3  center;
+	float radius;
+	Vec3  color;
+	bool  reflective = false;
+	Vec3  emission   = Vec3( 0 );
 };
 
 struct SphereBVH
 {
-	AABB                                             bbox;
-	std::unique_ptr<SphereBVH>                       left;
-	std::unique_ptr<SphereBVH>                       right;
-	std::vector<std::tuple<Vec3, float, Vec3, bool>> spheres;
+	std::vector<BVHNode> nodes;
+	std::vector<Sphere>  spheres;
 
 	SphereBVH() = default;
+	explicit SphereBVH( std::vector<Sphere> sphereList );
 
-	SphereBVH( std::vector<std::tuple<Vec3, float, Vec3, bool>> &sphereList,
-	           int                                               startIdx,
-	           int                                               endIdx,
-	           int                                               depth = 0 );
+	bool empty() const
+	{
+		return nodes.empty();
+	}
 
 	bool intersect( const Ray &ray, Hit &hit ) const;
 };
 
-bool intersectSphere( const Ray &ray, Vec3 center, float radius, Vec3 color, bool reflective, Hit &hit );
+bool intersectSphere( const Ray &ray, const Sphere &sphere, Hit &hit );
 
 bool intersectTriangle( const Ray &ray, const Triangle &tri, Hit &hit );
 
@@ -1,14 +1,55 @@
 #include "Mesh.hpp"
+#include "RayPacket.hpp"
+#include "Stats.hpp"
+
+namespace
+{
+
+// triangles per task when moving or repacking them in parallel
+const uint32_t REFIT_CHUNK = 16384;
+
+// Rebakes triangles [begin, end) from the `from` position/scale to the `to` one.
+void moveTriangles( Triangle *triangles,
+                    size_t    begin,
+                    size_t    end,
+                    Vec3      fromPosition,
+                    float     fromScale,
+                    Vec3      toPosition,
+                    float     toScale )
+{
+	float rescale = toScale / fromScale;
+	for ( size_t i = begin; i < end; i++ )
+	{
+		Triangle &tri = triangles[i];
+		tri.v0        = ( tri.v0 - fromPosition ) * rescale + toPosition;
+		tri.v1        = ( tri.v1 - fromPosition ) * rescale + toPosition;
+		tri.v2        = ( tri.v2 - fromPosition ) * rescale + toPosition;
+
+		Vec3 edge1 = tri.v1 - tri.v0;
+		Vec3 edge2 = tri.v2 - tri.v0;
+		tri.normal = edge1.cross( edge2 ).normalize();
+	}
+}
+
+} // namespace
 
 Mesh &Mesh::operator=( Mesh &&other ) noexcept
 {
 	if ( this != &other )
 	{
 		triangles = std::move( other.triangles );
+		packets   = std::move( other.packets );
 		bvh       = std::move( other.bvh );
+		wideBVH   = std::move( other.wideBVH );
+		refitter  = std::move( other.refitter );
+		bvhMode   = other.bvhMode;
 		position  = other.position;
 		scale     = other.scale;
-		bbox      = other.bbox;
+		geometry  = other.geometry;
+		cache     = std::move( other.cache );
+
+		bakedPosition = other.bakedPosition;
+		bakedScale    = other.bakedScale;
 	}
 	return *this;
 }
@@ -23,36 +64,138 @@ void Mesh::setScale( float s )
 	scale = s;
 }
 
-void Mesh::buildBVH()
+void Mesh::buildBVH( ThreadPool &pool, int bvhWidth, BVHBuildMode mode )
 {
-	std::vector<Triangle> transformedTriangles;
-	transformedTriangles.reserve( triangles.size() );
+	if ( cache )
+	{
+		// cache-backed: rebuild from an owned copy of the mapped triangles
+		triangles.assign( geometry.triangles, geometry.triangles + geometry.triangleCount );
+		cache.reset();
+	}
+
+	bakeTransform( pool );
+	bvh.build( triangles, pool, mode );
+	bvhMode = mode;
+	refitter.init( bvh.nodes );
+	wideBVH.build( bvh, bvhWidth );
+	triangles.shrink_to_fit();
+	packTriangles( triangles, packets );
+	updateGeometry();
+}
 
-	for ( const auto &tri : triangles )
+RefitResult Mesh::refit( ThreadPool &pool )
+{
+	if ( cache || refitter.empty() )
 	{
-		Triangle transformed = tri;
-		transformed.v0       = ( tri.v0 * scale ) + position;
-		transformed.v1       = ( tri.v1 * scale ) + position;
-		transformed.v2       = ( tri.v2 * scale ) + position;
+		buildBVH( pool, geometry.wideWidth, bvhMode );
+		return RefitResult::Rebuilt;
+	}
 
-		Vec3 edge1         = transformed.v1 - transformed.v0;
-		Vec3 edge2         = transformed.v2 - transformed.v0;
-		transformed.normal = edge1.cross( edge2 ).normalize();
+	bakeTransform( pool );
+	RefitResult result = refitter.refit( bvh.nodes, triangles, pool );
+	if ( result == RefitResult::NeedsRebuild )
+	{
+		buildBVH( pool, geometry.wideWidth, bvhMode );
+		return RefitResult::Rebuilt;
+	}
 
-		transformed.bbox.min.x = std::min( std::min( transformed.v0.x, transformed.v1.x ), transformed.v2.x );
-		transformed.bbox.min.y = std::min( std::min( transformed.v0.y, transformed.v1.y ), transformed.v2.y );
-		transformed.bbox.min.z = std::min( std::min( transformed.v0.z, transformed.v1.z ), transformed.v2.z );
+	if ( result == RefitResult::PartiallyRebuilt )
+		wideBVH.build( bvh, wideBVH.width ); // the rebuilt subtrees change the collapsed layout too
+	else
+		wideBVH.refit( triangles.data(), pool );
 
-		transformed.bbox.max.x = std::max( std::max( transformed.v0.x, transformed.v1.x ), transformed.v2.x );
-		transformed.bbox.max.y = std::max( std::max( transformed.v0.y, transformed.v1.y ), transformed.v2.y );
-		transformed.bbox.max.z = std::max( std::max( transformed.v0.z, transformed.v1.z ), transformed.v2.z );
+	Mesh *self  = this;
+	int   tasks = ( triangles.size() + REFIT_CHUNK - 1 ) / REFIT_CHUNK;
+	pool.parallelFor( tasks,
+	                  [self]( int i, int )
+	                  {
+		                  size_t first = size_t( i ) * REFIT_CHUNK / 4;
+		                  repackTriangles( self->triangles, self->packets, first, first + REFIT_CHUNK / 4 );
+	                  } );
 
-		transformedTriangles.push_back( transformed );
+	updateGeometry();
+	return result;
+}
+
+void Mesh::bakeTransform( ThreadPool &pool )
+{
+	// rebakes scale relative to the baked geometry, which a zero or non-finite scale would destroy for good
+	if ( scale == 0.0f || !std::isfinite( scale ) )
+		scale = bakedScale;
+
+	if ( position.x == bakedPosition.x && position.y == bakedPosition.y && position.z == bakedPosition.z &&
+	     scale == bakedScale )
+		return;
+
+	// small captures keep the jobs inside std::function's inline storage
+	Mesh *self  = this;
+	int   tasks = ( triangles.size() + REFIT_CHUNK - 1 ) / REFIT_CHUNK;
+	pool.parallelFor( tasks,
+	                  [self]( int i, int )
+	                  {
+		                  size_t begin = size_t( i ) * REFIT_CHUNK;
+		                  size_t end   = std::min<size_t>( begin + REFIT_CHUNK, self->triangles.size() );
+		                  moveTriangles( self->triangles.data(),
+		                                 begin,
+		                                 end,
+		                                 self->bakedPosition,
+		                                 self->bakedScale,
+		                                 self->position,
+		                                 self->scale );
+	                  } );
+	bakedPosition = position;
+	bakedScale    = scale;
+}
+
+void Mesh::updateGeometry()
+{
+	geometry               = MeshGeometry();
+	geometry.triangles     = triangles.data();
+	geometry.packets       = packets.empty() ? nullptr : packets.data();
+	geometry.nodes         = bvh.nodes.data();
+	geometry.wideNodes     = wideBVH.data();
+	geometry.triangleCount = triangles.size();
+	geometry.packetCount   = packets.size();
+	geometry.nodeCount     = bvh.nodes.size();
+	geometry.wideNodeCount = wideBVH.size();
+	geometry.wideWidth     = wideBVH.width;
+	if ( !bvh.empty() )
+	{
+		geometry.bbox = bvh.nodes[0].bbox;
+	}
+}
+
+bool intersectMesh( const Ray &ray, const Mesh &mesh, Hit &hit )
+{
+	const MeshGeometry &geometry = mesh.geometry;
+	if ( geometry.empty() )
+	{
+		return false;
 	}
 
-	if ( !transformedTriangles.empty() )
+	STATS_ADD( boxTests, 1 );
+	float tMin, tMax;
+	if ( !geometry.bbox.intersect( ray, tMin, tMax ) || tMax < 0.001f || tMin > hit.t )
 	{
-		bvh  = std::make_unique<BVHNode>( transformedTriangles, 0, transformedTriangles.size() );
-		bbox = bvh->bbox;
+		return false;
 	}
+
+	if ( geometry.wideNodes )
+	{
+		return intersectWideBVH(
+		    geometry.wideWidth, geometry.wideNodes, ray, geometry.triangles, geometry.packets, hit );
+	}
+
+	return intersectTriangleBVH( geometry.nodes, ray, geometry.triangles, geometry.packets, hit );
+}
+
+uint64_t intersectMeshPacket( const RayPacket &packet, const Mesh &mesh, Hit *hits )
+{
+	const MeshGeometry &geometry = mesh.geometry;
+	if ( geometry.empty() || packet.frustumCulls( geometry.bbox ) )
+	{
+		return 0;
+	}
+
+	return intersectPacket( packet, geometry.nodes, geometry.triangles, geometry.packets, hits );
 }
@@ -1,27 +1,87 @@
 #pragma once
 
+#include <memory>
+
+#include "BVHRefit.hpp"
+#include "MappedFile.hpp"
 #include "Math.hpp"
+#include "TrianglePacket.hpp"
+#include "WideBVH.hpp"
+
+struct RayPacket;
+
+// Everything the tracer reads from a built mesh. Points into the mesh's own arrays after buildBVH(), or
+// straight into a memory-mapped scene cache.
+struct MeshGeometry
+{
+	const Triangle       *triangles     = nullptr;
+	const TrianglePacket *packets       = nullptr; // null without the SIMD leaf kernel
+	const BVHNode        *nodes         = nullptr;
+	const void           *wideNodes     = nullptr; // WideBVHNode<wideWidth> array, null without a wide BVH
+	uint32_t              triangleCount = 0;
+	uint32_t              packetCount   = 0;
+	uint32_t              nodeCount     = 0;
+	uint32_t              wideNodeCount = 0;
+	int                   wideWidth     = 0;
+	AABB                  bbox;
+
+	bool empty() const
+	{
+		return nodeCount == 0;
+	}
+};
 
 struct Mesh
 {
-	std::vector<Triangle>    triangles;
-	std::unique_ptr<BVHNode> bvh;
-	Vec3                     position;
-	float                    scale;
-	AABB                     bbox;
+	// Owned copy of the geometry. buildBVH() bakes position/scale into it and reorders it so BVH leaves
+	// can reference contiguous ranges. Left empty when the mesh is read from a scene cache.
+	std::vector<Triangle>       triangles;
+	std::vector<TrianglePacket> packets; // SoA copy of `triangles` for the SIMD leaf kernel
+	TriangleBVH                 bvh;
+	WideBVH                     wideBVH; // SIMD traversal copy of `bvh`, empty when the CPU has no fast path
+	BVHRefitter                 refitter;
+	BVHBuildMode                bvhMode = BVHBuildMode::SAH; // of the last build, reused by refit()
+	Vec3                        position;
+	float                       scale;
+
+	MeshGeometry                      geometry;
+	std::shared_ptr<const MappedFile> cache; // keeps a cache-backed `geometry` mapped
 
-	Mesh() : position( 0, 0, 0 ), scale( 1.0f ) {}
+	// transform currently baked into the geometry
+	Vec3  bakedPosition;
+	float bakedScale;
+
+	Mesh() : position( 0, 0, 0 ), scale( 1.0f ), bakedPosition( 0, 0, 0 ), bakedScale( 1.0f ) {}
 	Mesh( const Mesh & )            = delete;
 	Mesh &operator=( const Mesh & ) = delete;
 	Mesh( Mesh &&other ) noexcept
-	    : triangles( std::move( other.triangles ) ), bvh( std::move( other.bvh ) ),
-	      position( other.position ), scale( other.scale ), bbox( other.bbox )
+	    : triangles( std::move( other.triangles ) ), packets( std::move( other.packets ) ),
+	      bvh( std::move( other.bvh ) ), wideBVH( std::move( other.wideBVH ) ),
+	      refitter( std::move( other.refitter ) ), bvhMode( other.bvhMode ), position( other.position ),
+	      scale( other.scale ), geometry( other.geometry ), cache( std::move( other.cache ) ),
+	      bakedPosition( other.bakedPosition ), bakedScale( other.bakedScale )
 	{
 	}
 
 	Mesh &operator=( Mesh &&other ) noexcept;
 
 	void translate( Vec3 trans );
-	void setScale( float s );
-	void buildBVH();
+	void setScale( float s ); // a zero or non-finite scale is ignored at the next bake
+	void buildBVH( ThreadPool  &pool,
+	               int          bvhWidth = preferredBVHWidth(),
+	               BVHBuildMode mode     = BVHBuildMode::SAH );
+
+	// Brings the BVHs up to date after position/scale changed or the owned triangles were moved in place
+	// (same count and order), refitting the boxes instead of rebuilding. Degraded subtrees are rebuilt in
+	// place and a tree that degraded as a whole gets a full build(). Allocates nothing in the common case.
+	RefitResult refit( ThreadPool &pool );
+
+  private:
+	void bakeTransform( ThreadPool &pool ); // moves the triangles to the current position/scale
+	void updateGeometry();
 };
+
+bool intersectMesh( const Ray &ray, const Mesh &mesh, Hit &hit );
+
+// Primary-ray packet against one mesh; returns the lanes whose hit got closer.
+uint64_t intersectMeshPacket( const RayPacket &packet, const Mesh &mesh, Hit *hits );
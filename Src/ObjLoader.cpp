@@ -0,0 +1,334 @@
+#include "ObjLoader.hpp"
+#include "MappedFile.hpp"
+
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+
+// What one chunk of the file produced. Vertices are written straight into the shared array, faces are
+// kept per chunk as resolved, 0-based position indices (three per triangle) until the merge.
+struct ObjChunk
+{
+	const char           *begin         = nullptr;
+	const char           *end           = nullptr;
+	uint32_t              vertexCount   = 0; // "v" lines, counted up front
+	uint32_t              firstVertex   = 0; // index of this chunk's first vertex in the whole file
+	std::vector<uint32_t> indices       = {};
+	uint32_t              firstTriangle = 0;
+	uint32_t              badFaces      = 0;
+};
+
+inline bool isBlank( char c )
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char *skipBlanks( const char *p, const char *end )
+{
+	while ( p < end && isBlank( *p ) )
+		p++;
+	return p;
+}
+
+inline const char *nextLine( const char *p, const char *end )
+{
+	while ( p < end && *p != '\n' )
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+// "v" followed by a blank; "vt", "vn" and "vp" are other records
+inline bool isVertexRecord( const char *p, const char *end )
+{
+	return p + 1 < end && p[0] == 'v' && isBlank( p[1] );
+}
+
+inline bool isFaceRecord( const char *p, const char *end )
+{
+	return p + 1 < end && p[0] == 'f' && isBlank( p[1] );
+}
+
+// Values past UINT32_MAX are out of range for every caller, so the digits after that point are only
+// consumed; the result then just stays past UINT32_MAX instead of overflowing.
+bool parseInt( const char *&p, const char *end, int64_t &value )
+{
+	bool negative = false;
+	if ( p < end && ( *p == '-' || *p == '+' ) )
+		negative = *p++ == '-';
+
+	if ( p >= end || *p < '0' || *p > '9' )
+		return false;
+
+	int64_t result = 0;
+	while ( p < end && *p >= '0' && *p <= '9' )
+	{
+		if ( result <= int64_t( UINT32_MAX ) )
+			result = result * 10 + ( *p - '0' );
+		p++;
+	}
+	value = negative ? -result : result;
+	return true;
+}
+
+// Decimal float with optional sign, fraction and exponent. Up to 19 significant digits are kept, which
+// is far more than a float holds.
+bool parseFloat( const char *&p, const char *end, float &value )
+{
+	static const double powers[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+	                                 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+	                                 1e22 };
+
+	bool negative = false;
+	if ( p < end && ( *p == '-' || *p == '+' ) )
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int      exponent = 0;
+	int      digits   = 0;
+	bool     any      = false;
+	while ( p < end && *p >= '0' && *p <= '9' )
+	{
+		if ( digits < 19 )
+		{
+			mantissa = mantissa * 10 + ( *p - '0' );
+			digits += mantissa != 0;
+		}
+		else
+		{
+			exponent++;
+		}
+		p++;
+		any = true;
+	}
+	if ( p < end && *p == '.' )
+	{
+		p++;
+		while ( p < end && *p >= '0' && *p <= '9' )
+		{
+			if ( digits < 19 )
+			{
+				mantissa = mantissa * 10 + ( *p - '0' );
+				digits += mantissa != 0;
+				exponent--;
+			}
+			p++;
+			any = true;
+		}
+	}
+	if ( !any )
+		return false;
+
+	if ( p < end && ( *p == 'e' || *p == 'E' ) )
+	{
+		const char *exponentStart = ++p;
+		int64_t     e;
+		if ( !parseInt( p, end, e ) )
+			p = exponentStart - 1; // not an exponent after all, leave the 'e' unparsed
+		else
+			exponent += int( std::max<int64_t>( -1000, std::min<int64_t>( 1000, e ) ) );
+	}
+
+	double result = double( mantissa );
+	while ( exponent > 22 )
+	{
+		result *= 1e22;
+		exponent -= 22;
+	}
+	while ( exponent < -22 )
+	{
+		result /= 1e22;
+		exponent += 22;
+	}
+	result = exponent >= 0 ? result * powers[exponent] : result / powers[-exponent];
+	value  = float( negative ? -result : result );
+	return true;
+}
+
+// Turns a 1-based or negative OBJ index into a 0-based one; `defined` is the number of vertices before
+// the face. Range checks against the final vertex count happen at the merge.
+inline bool resolveIndex( int64_t index, uint32_t defined, uint32_t &resolved )
+{
+	if ( index > 0 )
+		index -= 1;
+	else if ( index < 0 )
+		index += defined;
+	else
+		return false;
+
+	if ( index < 0 || index > int64_t( UINT32_MAX ) )
+		return false;
+	resolved = uint32_t( index );
+	return true;
+}
+
+void countVertices( ObjChunk &chunk )
+{
+	for ( const char *p = chunk.begin; p < chunk.end; p = nextLine( p, chunk.end ) )
+	{
+		p = skipBlanks( p, chunk.end );
+		chunk.vertexCount += isVertexRecord( p, chunk.end );
+	}
+}
+
+void parseChunk( ObjChunk &chunk, Vec3 *vertices )
+{
+	const char *end    = chunk.end;
+	uint32_t    vertex = chunk.firstVertex;
+	for ( const char *p = chunk.begin; p < end; p = nextLine( p, end ) )
+	{
+		p = skipBlanks( p, end );
+		if ( isVertexRecord( p, end ) )
+		{
+			// counted in the first pass, so the slot is reserved even if the coordinates are broken
+			float xyz[3] = { 0, 0, 0 };
+			p += 2;
+			for ( float &c : xyz )
+			{
+				p = skipBlanks( p, end );
+				if ( !parseFloat( p, end, c ) )
+					break;
+			}
+			vertices[vertex++] = Vec3( xyz[0], xyz[1], xyz[2] );
+		}
+		else if ( isFaceRecord( p, end ) )
+		{
+			// fan triangulation: (first, previous, current) for every corner after the second
+			uint32_t corner[3];
+			int      corners = 0;
+			bool     valid   = true;
+			size_t   start   = chunk.indices.size();
+			p += 2;
+			while ( true )
+			{
+				p = skipBlanks( p, end );
+				if ( p >= end || *p == '\n' || *p == '#' )
+					break;
+
+				int64_t   index;
+				uint32_t &slot = corner[std::min( corners, 2 )];
+				if ( !parseInt( p, end, index ) || !resolveIndex( index, vertex, slot ) )
+				{
+					valid = false;
+					break;
+				}
+
+				// skip "/vt", "//vn" or "/vt/vn"
+				while ( p < end && ( *p == '/' || *p == '-' || ( *p >= '0' && *p <= '9' ) ) )
+					p++;
+
+				if ( ++corners >= 3 )
+				{
+					chunk.indices.insert( chunk.indices.end(), { corner[0], corner[1], corner[2] } );
+					corner[1] = corner[2];
+				}
+			}
+
+			if ( !valid || corners < 3 )
+			{
+				chunk.indices.resize( start );
+				chunk.badFaces++;
+			}
+		}
+	}
+}
+
+} // namespace
+
+bool loadOBJ( const std::string &filename, Mesh &mesh, Vec3 color, bool reflective, ThreadPool &pool )
+{
+	using Clock = std::chrono::steady_clock;
+	auto start  = Clock::now();
+
+	MappedFile file( filename, true );
+	if ( !file.data )
+	{
+		std::cerr << "Failed to open file: " << filename << std::endl;
+		return false;
+	}
+
+	std::cout << "Loading OBJ file: " << filename << std::endl;
+
+	// a few chunks per worker so stealing can even out uneven ones
+	const size_t          targetSize = std::max<size_t>( 1 << 20, file.size / ( pool.size() * 4 ) + 1 );
+	std::vector<ObjChunk> chunks;
+	for ( const char *p = file.data, *end = file.data + file.size; p < end; )
+	{
+		const char *chunkEnd = p + std::min<size_t>( targetSize, end - p );
+		chunkEnd             = chunkEnd < end ? nextLine( chunkEnd - 1, end ) : end;
+		chunks.push_back( { p, chunkEnd } );
+		p = chunkEnd;
+	}
+
+	pool.parallelFor( chunks.size(), [&]( int i, int ) { countVertices( chunks[i] ); } );
+
+	uint32_t vertexCount = 0;
+	for ( ObjChunk &chunk : chunks )
+	{
+		chunk.firstVertex = vertexCount;
+		vertexCount += chunk.vertexCount;
+	}
+
+	std::vector<Vec3> vertices( vertexCount );
+	pool.parallelFor( chunks.size(), [&]( int i, int ) { parseChunk( chunks[i], vertices.data() ); } );
+
+	uint32_t triangleCount = 0;
+	uint32_t badFaces      = 0;
+	for ( ObjChunk &chunk : chunks )
+	{
+		chunk.firstTriangle = triangleCount;
+		triangleCount += chunk.indices.size() / 3;
+		badFaces += chunk.badFaces;
+	}
+
+	// triangles referencing vertices past the end of the file are flagged while filling in parallel and
+	// squeezed out afterwards
+	size_t               firstNew = mesh.triangles.size();
+	std::vector<uint8_t> valid( triangleCount );
+	mesh.triangles.resize( firstNew + triangleCount );
+	pool.parallelFor( chunks.size(),
+	                  [&]( int c, int )
+	                  {
+		                  const ObjChunk &chunk = chunks[c];
+		                  for ( size_t i = 0; i < chunk.indices.size(); i += 3 )
+		                  {
+			                  uint32_t t  = chunk.firstTriangle + i / 3;
+			                  uint32_t a  = chunk.indices[i];
+			                  uint32_t b  = chunk.indices[i + 1];
+			                  uint32_t cc = chunk.indices[i + 2];
+			                  valid[t]    = a < vertexCount && b < vertexCount && cc < vertexCount;
+			                  if ( valid[t] )
+			                  {
+				                  mesh.triangles[firstNew + t] =
+				                      Triangle( vertices[a], vertices[b], vertices[cc], color, reflective );
+			                  }
+		                  }
+	                  } );
+
+	size_t kept = firstNew;
+	for ( uint32_t t = 0; t < triangleCount; t++ )
+	{
+		if ( valid[t] && kept++ != firstNew + t )
+			mesh.triangles[kept - 1] = mesh.triangles[firstNew + t];
+	}
+	badFaces += triangleCount - ( kept - firstNew );
+	mesh.triangles.resize( kept );
+
+	double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+	std::cout << "OBJ loaded: " << vertexCount << " vertices, " << kept - firstNew << " triangles in "
+	          << seconds * 1e3 << " ms (" << file.size / ( 1024.0 * 1024.0 ) / seconds << " MB/s, "
+	          << chunks.size() << " chunks)" << std::endl;
+	if ( badFaces > 0 )
+	{
+		std::cerr << "Skipped " << badFaces << " faces with missing or invalid vertex indices" << std::endl;
+	}
+
+	if ( kept == firstNew )
+	{
+		std::cerr << "No valid triangles found in OBJ file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
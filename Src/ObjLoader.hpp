@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+// Reads the triangles of a Wavefront OBJ into `mesh`, all of them with `color`/`reflective`.
+//
+// The file is memory-mapped and split into chunks at line boundaries that are parsed in parallel on
+// `pool` with hand-written number parsers, then merged in file order. Faces may use the v, v/vt, v//vn
+// and v/vt/vn forms with positive or negative (relative) indices; polygons with more than three corners
+// are fan-triangulated. Texture coordinates and vertex normals are accepted but not used, the tracer
+// shades with face normals. Returns false if the file can't be read or holds no valid triangle.
+bool loadOBJ( const std::string &filename, Mesh &mesh, Vec3 color, bool reflective, ThreadPool &pool );
@@ -0,0 +1,256 @@
+#include "Options.hpp"
+
+#include <climits>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+
+namespace
+{
+
+void printUsage( const char *program )
+{
+	std::cout << "Usage: " << program << " [options] [model.obj]\n"
+	          << "  --headless          render without a window and write the result to disk\n"
+	          << "  --width N           render width in pixels (default 1080)\n"
+	          << "  --height N          render height in pixels (default 720)\n"
+	          << "  --depth N           maximum path depth (default 5)\n"
+	          << "  --roulette N        Russian roulette from bounce depth N, 0 turns it off (default 3)\n"
+	          << "  -t, --threads N     render threads (default: all hardware threads)\n"
+	          << "  --no-packets        trace primary rays one at a time\n"
+	          << "  --wavefront         trace each bounce of the whole frame as one sorted path queue\n"
+	          << "  --camera X,Y,Z[,YAW,PITCH]  start camera position and angles in degrees\n"
+	          << "  --stats SECONDS     print ray tracing statistics at this interval\n"
+	          << "  --stats-json        print the statistics as JSON lines\n"
+	          << "  --room              close the scene in a room lit by a ceiling panel\n"
+	          << "  --instances N       place N instances of the OBJ sharing one mesh (default 1)\n"
+	          << "  --no-cache          always rebuild the OBJ mesh, don't read or write the scene cache\n"
+	          << "  --cache-dir DIR     keep scene cache files in DIR instead of next to the OBJ\n"
+	          << "  --bvh-build MODE    OBJ BVH builder: sah (default) or lbvh for faster builds\n"
+	          << "  --denoise           edge-aware denoiser guided by first-hit albedo, normal and depth\n"
+	          << "  --temporal          keep the image on camera moves by reprojecting it, not clearing it\n"
+	          << "  --target-fps FPS    lower the resolution while the camera moves to hold this frame rate\n"
+	          << "  --tonemap OP        display mapping of bright pixels: clamp (default), reinhard or aces\n"
+	          << "  --noise-target E    adaptive sampling: tiles stop below relative noise E (e.g. 0.02)\n"
+	          << "  --spp N             headless: samples per pixel (default 64 unless --time is set); with\n"
+	          << "                      --noise-target the most any pixel gets (default 4096 then)\n"
+	          << "  --time SECONDS      headless: stop after this many seconds\n"
+	          << "  -o, --out FILE      headless: tonemapped image, .png or .ppm (default render.png)\n"
+	          << "  --raw FILE          headless: also write the linear radiance as .pfm\n";
+}
+
+bool parseFloat( const char *text, float &value )
+{
+	char *end;
+	float parsed = std::strtof( text, &end );
+	if ( *end != '\0' || end == text || !( parsed >= 0.0f ) )
+		return false;
+	value = parsed;
+	return true;
+}
+
+bool parseBVHBuildMode( const std::string &text, BVHBuildMode &mode )
+{
+	if ( text == "sah" )
+		mode = BVHBuildMode::SAH;
+	else if ( text == "lbvh" )
+		mode = BVHBuildMode::LBVH;
+	else
+		return false;
+	return true;
+}
+
+bool parseTonemap( const std::string &text, Tonemap &tonemap )
+{
+	for ( Tonemap candidate : { Tonemap::CLAMP, Tonemap::REINHARD, Tonemap::ACES } )
+	{
+		if ( text == tonemapName( candidate ) )
+		{
+			tonemap = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// An output path may only carry an extension of the format written to it, so e.g. "-o out.pfm" is refused
+// instead of getting PPM bytes; a path without an extension is taken as it is.
+bool parseOutputPath( const std::string                  &path,
+                      std::initializer_list<const char *> extensions,
+                      std::string                        &output )
+{
+	size_t dot = path.find_last_of( "./" );
+	if ( dot != std::string::npos && path[dot] == '.' )
+	{
+		std::string extension = path.substr( dot );
+		bool        known     = false;
+		for ( const char *candidate : extensions )
+		{
+			known |= extension == candidate;
+		}
+		if ( !known )
+			return false;
+	}
+	output = path;
+	return true;
+}
+
+bool parseCamera( const char *text, Options &options )
+{
+	float values[5] = { 0, 0, 0, options.cameraYaw, options.cameraPitch };
+	int   count     = 0;
+	for ( const char *p = text; count < 5; p++ )
+	{
+		char *end;
+		values[count++] = std::strtof( p, &end );
+		if ( end == p || ( *end != ',' && *end != '\0' ) )
+			return false;
+		p = end;
+		if ( *end == '\0' )
+			break;
+	}
+
+	if ( count != 3 && count != 5 )
+		return false;
+	options.cameraPosition = Vec3( values[0], values[1], values[2] );
+	options.cameraYaw      = values[3];
+	options.cameraPitch    = values[4];
+	return true;
+}
+
+} // namespace
+
+bool parseInt( const char *text, int minValue, int &value )
+{
+	char *end;
+	long  parsed = std::strtol( text, &end, 10 );
+	if ( *end != '\0' || end == text || parsed < minValue || parsed > INT_MAX )
+		return false;
+	value = int( parsed );
+	return true;
+}
+
+bool parseOptions( int argc, char *argv[], Options &options )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		std::string arg      = argv[i];
+		const char *value    = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool        hasValue = true;
+		bool        ok       = true;
+
+		if ( arg == "--headless" )
+		{
+			options.headless = true;
+			hasValue         = false;
+		}
+		else if ( arg == "--no-packets" )
+		{
+			options.render.primaryPackets = false;
+			hasValue                      = false;
+		}
+		else if ( arg == "--wavefront" )
+		{
+			options.render.wavefront = true;
+			hasValue                 = false;
+		}
+		else if ( arg == "--stats-json" )
+		{
+			options.statsJSON = true;
+			hasValue          = false;
+		}
+		else if ( arg == "--denoise" )
+		{
+			options.render.denoise = true;
+			hasValue               = false;
+		}
+		else if ( arg == "--temporal" )
+		{
+			options.render.temporal = true;
+			hasValue                = false;
+		}
+		else if ( arg == "--room" )
+		{
+			options.room = true;
+			hasValue     = false;
+		}
+		else if ( arg == "--no-cache" )
+		{
+			options.cache.enabled = false;
+			hasValue              = false;
+		}
+		else if ( arg == "-h" || arg == "--help" )
+		{
+			printUsage( argv[0] );
+			return false;
+		}
+		else if ( !value && arg.size() > 1 && arg[0] == '-' )
+		{
+			ok = false;
+		}
+		else if ( arg == "--width" )
+			ok = parseInt( value, 1, options.render.width );
+		else if ( arg == "--height" )
+			ok = parseInt( value, 1, options.render.height );
+		else if ( arg == "--depth" )
+			ok = parseInt( value, 1, options.render.maxDepth );
+		else if ( arg == "--roulette" )
+			ok = parseInt( value, 0, options.render.rouletteDepth );
+		else if ( arg == "-t" || arg == "--threads" )
+			ok = parseInt( value, 1, options.threads );
+		else if ( arg == "--spp" )
+			ok = parseInt( value, 1, options.spp );
+		else if ( arg == "--noise-target" )
+			ok = parseFloat( value, options.render.noiseTarget );
+		else if ( arg == "--time" )
+			ok = parseFloat( value, options.timeLimit );
+		else if ( arg == "--target-fps" )
+		{
+			float fps               = 0.0f;
+			ok                      = parseFloat( value, fps );
+			options.targetFrameTime = fps > 0.0f ? 1.0f / fps : 0.0f;
+		}
+		else if ( arg == "--stats" )
+			ok = parseFloat( value, options.statsInterval );
+		else if ( arg == "--camera" )
+			ok = parseCamera( value, options );
+		else if ( arg == "-o" || arg == "--out" )
+			ok = parseOutputPath( value, { ".png", ".ppm" }, options.output );
+		else if ( arg == "--raw" )
+			ok = parseOutputPath( value, { ".pfm" }, options.rawOutput );
+		else if ( arg == "--instances" )
+			ok = parseInt( value, 1, options.instances );
+		else if ( arg == "--cache-dir" )
+			options.cache.directory = value;
+		else if ( arg == "--bvh-build" )
+			ok = parseBVHBuildMode( value, options.bvhMode );
+		else if ( arg == "--tonemap" )
+			ok = parseTonemap( value, options.render.tonemap );
+		else if ( arg.size() > 1 && arg[0] == '-' )
+			ok = false;
+		else
+		{
+			options.objPath = arg;
+			hasValue        = false;
+		}
+
+		if ( !ok )
+		{
+			std::cerr << "Invalid argument: " << arg << " " << ( value ? value : "" ) << std::endl;
+			printUsage( argv[0] );
+			return false;
+		}
+
+		if ( hasValue )
+			i++;
+	}
+
+	return true;
+}
+
+Camera startCamera( const Options &options )
+{
+	Camera camera( options.cameraPosition );
+	camera.rotate( options.cameraYaw - camera.yaw, options.cameraPitch - camera.pitch );
+	return camera;
+}
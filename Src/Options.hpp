@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "Renderer.hpp"
+
+struct Options
+{
+	RenderSettings render;
+	int            threads  = defaultThreadCount();
+	bool           headless = false;
+
+	// headless only: stop after `spp` samples per pixel or `timeLimit` seconds, whichever comes first
+	int         spp       = 0;
+	float       timeLimit = 0.0f;
+	std::string output    = "render.png";
+	std::string rawOutput; // PFM with the mean radiance per pixel, skipped when empty
+
+	// viewer: seconds per frame to hold while the camera moves by lowering the resolution, 0 never does
+	float targetFrameTime = 0.0f;
+
+	// print render statistics every `statsInterval` seconds, as text or JSON lines
+	float statsInterval = 0.0f;
+	bool  statsJSON     = false;
+
+	// start camera, shared with the viewer
+	Vec3  cameraPosition = Vec3( 0, 2, 0 );
+	float cameraYaw      = -90.0f;
+	float cameraPitch    = 0.0f;
+
+	bool               room = false; // close the scene in makeRoom()
+	std::string        objPath;
+	int                instances = 1; // copies of the OBJ, all sharing one mesh
+	SceneCacheSettings cache;
+	BVHBuildMode       bvhMode = BVHBuildMode::SAH;
+};
+
+// Camera placed at the configured start pose.
+Camera startCamera( const Options &options );
+
+// Whole of `text` as a decimal int of at least `minValue`; false leaves `value` untouched.
+bool parseInt( const char *text, int minValue, int &value );
+
+// Fills `options` from the command line; prints usage and returns false on a bad or "--help" argument.
+bool parseOptions( int argc, char *argv[], Options &options );
+
@@ -0,0 +1,103 @@
+#include "RayPacket.hpp"
+#include "Stats.hpp"
+
+void RayPacket::setFrustum( const Vec3 &eye, const Vec3 corners[4] )
+{
+	origin      = eye;
+	Vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+	for ( int i = 0; i < 4; i++ )
+	{
+		Vec3 normal = corners[i].cross( corners[( i + 1 ) % 4] );
+		planes[i]   = normal.dot( center ) < 0 ? normal * -1.0f : normal;
+	}
+}
+
+bool RayPacket::frustumCulls( const AABB &box ) const
+{
+	for ( const Vec3 &normal : planes )
+	{
+		// the box corner furthest along the inward normal; if even that is outside, the box is
+		Vec3 corner( normal.x >= 0 ? box.max.x : box.min.x,
+		             normal.y >= 0 ? box.max.y : box.min.y,
+		             normal.z >= 0 ? box.max.z : box.min.z );
+		if ( normal.dot( corner - origin ) < 0 )
+			return true;
+	}
+	return false;
+}
+
+uint64_t intersectPacket( const RayPacket      &packet,
+                          const BVHNode        *nodes,
+                          const Triangle       *triangles,
+                          const TrianglePacket *packets,
+                          Hit                  *hits )
+{
+	if ( !packet.active )
+		return 0;
+
+	struct Entry
+	{
+		uint32_t node;
+		uint64_t mask;
+	};
+	Entry stack[BVH_MAX_DEPTH];
+	int   stackSize = 0;
+
+	uint64_t improved = 0;
+	uint32_t nodeIdx  = 0;
+	uint64_t mask     = packet.active;
+	while ( true )
+	{
+		const BVHNode &node = nodes[nodeIdx];
+		STATS_ADD( nodesVisited, 1 );
+
+		// lanes that still reach this node in front of their current hit
+		uint64_t hitMask = 0;
+		if ( !packet.frustumCulls( node.bbox ) )
+		{
+			STATS_ADD( boxTests, __builtin_popcountll( mask ) );
+			for ( uint64_t lanes = mask; lanes; lanes &= lanes - 1 )
+			{
+				int   lane = __builtin_ctzll( lanes );
+				float tMin, tMax;
+				if ( !node.bbox.intersect( packet.rays[lane], tMin, tMax ) )
+					continue;
+				if ( tMax >= 0.001f && tMin <= hits[lane].t )
+					hitMask |= uint64_t( 1 ) << lane;
+			}
+		}
+
+		if ( hitMask && node.isLeaf() )
+		{
+			for ( uint64_t lanes = hitMask; lanes; lanes &= lanes - 1 )
+			{
+				int lane = __builtin_ctzll( lanes );
+				if ( intersectTriangleRange(
+				         packet.rays[lane], triangles, packets, node.offset, node.count, hits[lane] ) )
+					improved |= uint64_t( 1 ) << lane;
+			}
+		}
+		else if ( hitMask )
+		{
+			// order the children along the direction of the first active ray; the packet is coherent
+			uint32_t near = nodeIdx + 1;
+			uint32_t far  = node.offset;
+			Vec3     dir  = packet.rays[__builtin_ctzll( hitMask )].dir;
+			if ( ( nodes[near].bbox.getCenter() - nodes[far].bbox.getCenter() ).dot( dir ) > 0 )
+				std::swap( near, far );
+
+			stack[stackSize++] = { far, hitMask };
+			nodeIdx            = near;
+			mask               = hitMask;
+			continue;
+		}
+
+		if ( stackSize == 0 )
+			break;
+		stackSize--;
+		nodeIdx = stack[stackSize].node;
+		mask    = stack[stackSize].mask;
+	}
+
+	return improved;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Math.hpp"
+#include "TrianglePacket.hpp"
+
+const int RAY_PACKET_WIDTH = 8;
+const int RAY_PACKET_SIZE  = RAY_PACKET_WIDTH * RAY_PACKET_WIDTH;
+
+// Primary rays of one RAY_PACKET_WIDTH x RAY_PACKET_WIDTH pixel tile. They all start at the camera, so
+// the tile's corner directions bound them in a frustum that lets whole BVH nodes be rejected at once.
+struct RayPacket
+{
+	Ray      rays[RAY_PACKET_SIZE];
+	uint64_t active = 0; // lanes holding a ray
+	Vec3     origin;
+	Vec3     planes[4]; // inward normals of the side planes, all passing through `origin`
+
+	// `corners` are directions through the tile's outer pixel edges, in order around the tile.
+	void setFrustum( const Vec3 &eye, const Vec3 corners[4] );
+
+	bool frustumCulls( const AABB &box ) const;
+};
+
+// Closest hits of the active rays against a non-empty triangle BVH node array, updating `hits` per lane.
+// Returns the lanes whose hit got closer.
+uint64_t intersectPacket( const RayPacket      &packet,
+                          const BVHNode        *nodes,
+                          const Triangle       *triangles,
+                          const TrianglePacket *packets,
+                          Hit                  *hits );
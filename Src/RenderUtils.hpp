@@ -1,5 +1,6 @@
 #include "Camera.hpp"
 #include "Mesh.hpp"
+#include "Scene.hpp"
 #include <SDL2/SDL.h>
 
 void drawBoundingBox( SDL_Renderer *renderer,
@@ -60,15 +61,18 @@ void drawBoundingBox( SDL_Renderer *renderer,
 	}
 }
 
-void visualizeBVHNode( SDL_Renderer  *renderer,
-                       const BVHNode *node,
-                       const Camera  &camera,
-                       int            width,
-                       int            height,
-                       int            depth    = 0,
-                       int            maxDepth = 5 )
+void visualizeBVHNode( SDL_Renderer    *renderer,
+                       const BVHNode   *nodes,
+                       uint32_t         nodeCount,
+                       const Transform &transform,
+                       uint32_t         nodeIdx,
+                       const Camera    &camera,
+                       int              width,
+                       int              height,
+                       int              depth    = 0,
+                       int              maxDepth = 5 )
 {
-	if ( !node )
+	if ( nodeIdx >= nodeCount )
 		return;
 
 	if ( depth > maxDepth )
@@ -91,28 +95,28 @@ void visualizeBVHNode( SDL_Renderer  *renderer,
 	Uint8 g = colors[depth % 10][1];
 	Uint8 b = colors[depth % 10][2];
 
-	drawBoundingBox( renderer, node->bbox, camera, width, height, r, g, b );
+	const BVHNode &node = nodes[nodeIdx];
+	drawBoundingBox( renderer, transform.bounds( node.bbox ), camera, width, height, r, g, b );
 
-	if ( node->left )
+	if ( !node.isLeaf() )
 	{
-		visualizeBVHNode( renderer, node->left.get(), camera, width, height, depth + 1, maxDepth );
-	}
-
-	if ( node->right )
-	{
-		visualizeBVHNode( renderer, node->right.get(), camera, width, height, depth + 1, maxDepth );
+		visualizeBVHNode(
+		    renderer, nodes, nodeCount, transform, nodeIdx + 1, camera, width, height, depth + 1, maxDepth );
+		visualizeBVHNode(
+		    renderer, nodes, nodeCount, transform, node.offset, camera, width, height, depth + 1, maxDepth );
 	}
 }
 
-void visualizeSphereBVHNode( SDL_Renderer    *renderer,
-                             const SphereBVH *node,
-                             const Camera    &camera,
-                             int              width,
-                             int              height,
-                             int              depth    = 0,
-                             int              maxDepth = 5 )
+void visualizeSphereBVHNode( SDL_Renderer               *renderer,
+                             const std::vector<BVHNode> &nodes,
+                             uint32_t                    nodeIdx,
+                             const Camera               &camera,
+                             int                         width,
+                             int                         height,
+                             int                         depth    = 0,
+                             int                         maxDepth = 5 )
 {
-	if ( !node )
+	if ( nodeIdx >= nodes.size() )
 		return;
 
 	if ( depth > maxDepth )
@@ -135,66 +139,76 @@ void visualizeSphereBVHNode( SDL_Renderer    *renderer,
 	Uint8 g = colors[depth % 10][1];
 	Uint8 b = colors[depth % 10][2];
 
-	drawBoundingBox( renderer, node->bbox, camera, width, height, r, g, b );
+	const BVHNode &node = nodes[nodeIdx];
+	drawBoundingBox( renderer, node.bbox, camera, width, height, r, g, b );
 
-	if ( node->left )
+	if ( !node.isLeaf() )
 	{
-		visualizeSphereBVHNode( renderer, node->left.get(), camera, width, height, depth + 1, maxDepth );
-	}
-
-	if ( node->right )
-	{
-		visualizeSphereBVHNode( renderer, node->right.get(), camera, width, height, depth + 1, maxDepth );
+		visualizeSphereBVHNode( renderer, nodes, nodeIdx + 1, camera, width, height, depth + 1, maxDepth );
+		visualizeSphereBVHNode( renderer, nodes, node.offset, camera, width, height, depth + 1, maxDepth );
 	}
 }
 
-void debugRenderBoundingBoxes( SDL_Renderer            *renderer,
-                               const std::vector<Mesh> &meshes,
-                               const SphereBVH         &sphereBVH,
-                               const Camera            &camera,
-                               int                      width,
-                               int                      height,
-                               int                      bvhDepth )
+void debugRenderBoundingBoxes( SDL_Renderer *renderer,
+                               const Scene  &scene,
+                               const Camera &camera,
+                               int           width,
+                               int           height,
+                               int           bvhDepth )
 {
-	for ( const auto &mesh : meshes )
+	const SphereBVH &sphereBVH = scene.sphereBVH;
+	for ( const MeshInstance &instance : scene.instances )
 	{
-		if ( mesh.bvh )
+		const MeshGeometry &geometry = scene.meshes[instance.mesh].geometry;
+		if ( !geometry.empty() )
 		{
-			drawBoundingBox( renderer, mesh.bbox, camera, width, height, 255, 0, 0 );
-			if ( bvhDepth > 0 && mesh.bvh )
+			drawBoundingBox( renderer, instance.bounds, camera, width, height, 255, 0, 0 );
+			if ( bvhDepth > 0 )
 			{
-				visualizeBVHNode( renderer, mesh.bvh.get(), camera, width, height, 0, bvhDepth );
+				visualizeBVHNode( renderer,
+				                  geometry.nodes,
+				                  geometry.nodeCount,
+				                  instance.transform,
+				                  0,
+				                  camera,
+				                  width,
+				                  height,
+				                  0,
+				                  bvhDepth );
 			}
 		}
 	}
 
-	drawBoundingBox( renderer, sphereBVH.bbox, camera, width, height, 0, 255, 0 );
-	if ( bvhDepth > 0 )
+	if ( !sphereBVH.empty() )
 	{
-		visualizeSphereBVHNode( renderer, &sphereBVH, camera, width, height, 0, bvhDepth );
+		drawBoundingBox( renderer, sphereBVH.nodes[0].bbox, camera, width, height, 0, 255, 0 );
+		if ( bvhDepth > 0 )
+		{
+			visualizeSphereBVHNode( renderer, sphereBVH.nodes, 0, camera, width, height, 0, bvhDepth );
+		}
 	}
 }
 
-void debugRenderTriangles( SDL_Renderer            *renderer,
-                           const std::vector<Mesh> &meshes,
-                           const Camera            &camera,
-                           int                      width,
-                           int                      height )
+void debugRenderTriangles(
+    SDL_Renderer *renderer, const Scene &scene, const Camera &camera, int width, int height )
 {
 
 	SDL_SetRenderDrawColor( renderer, 0, 255, 0, 255 );
 
-	for ( const auto &mesh : meshes )
+	for ( const MeshInstance &instance : scene.instances )
 	{
-		for ( const auto &tri : mesh.triangles )
-		{
-			Vec3 v0 = ( tri.v0 * mesh.scale ) + mesh.position;
-			Vec3 v1 = ( tri.v1 * mesh.scale ) + mesh.position;
-			Vec3 v2 = ( tri.v2 * mesh.scale ) + mesh.position;
+		const MeshGeometry &geometry = scene.meshes[instance.mesh].geometry;
+		if ( geometry.empty() )
+			continue;
 
-			auto p0 = projectPointToScreen( v0, camera, width, height );
-			auto p1 = projectPointToScreen( v1, camera, width, height );
-			auto p2 = projectPointToScreen( v2, camera, width, height );
+		// mesh triangles are in object space, placed by the instance transform
+		const Transform &transform = instance.transform;
+		for ( uint32_t i = 0; i < geometry.triangleCount; i++ )
+		{
+			const Triangle &tri = geometry.triangles[i];
+			auto p0 = projectPointToScreen( transform.point( tri.v0 ), camera, width, height );
+			auto p1 = projectPointToScreen( transform.point( tri.v1 ), camera, width, height );
+			auto p2 = projectPointToScreen( transform.point( tri.v2 ), camera, width, height );
 
 			if ( p0.first >= 0 && p0.second >= 0 && p1.first >= 0 && p1.second >= 0 && p2.first >= 0 &&
 			     p2.second >= 0 )
@@ -234,18 +248,19 @@ void debugRenderBoundingBoxes( SDL_Renderer            *renderer,
 
 	for ( const auto &mesh : meshes )
 	{
-		if ( !mesh.bvh )
+		if ( mesh.geometry.empty() )
 			continue;
 
-		Vec3 corners[8];
-		corners[0] = Vec3( mesh.bbox.min.x, mesh.bbox.min.y, mesh.bbox.min.z );
-		corners[1] = Vec3( mesh.bbox.max.x, mesh.bbox.min.y, mesh.bbox.min.z );
-		corners[2] = Vec3( mesh.bbox.min.x, mesh.bbox.max.y, mesh.bbox.min.z );
-		corners[3] = Vec3( mesh.bbox.max.x, mesh.bbox.max.y, mesh.bbox.min.z );
-		corners[4] = Vec3( mesh.bbox.min.x, mesh.bbox.min.y, mesh.bbox.max.z );
-		corners[5] = Vec3( mesh.bbox.max.x, mesh.bbox.min.y, mesh.bbox.max.z );
-		corners[6] = Vec3( mesh.bbox.min.x, mesh.bbox.max.y, mesh.bbox.max.z );
-		corners[7] = Vec3( mesh.bbox.max.x, mesh.bbox.max.y, mesh.bbox.max.z );
+		const AABB &bbox = mesh.geometry.bbox;
+		Vec3        corners[8];
+		corners[0] = Vec3( bbox.min.x, bbox.min.y, bbox.min.z );
+		corners[1] = Vec3( bbox.max.x, bbox.min.y, bbox.min.z );
+		corners[2] = Vec3( bbox.min.x, bbox.max.y, bbox.min.z );
+		corners[3] = Vec3( bbox.max.x, bbox.max.y, bbox.min.z );
+		corners[4] = Vec3( bbox.min.x, bbox.min.y, bbox.max.z );
+		corners[5] = Vec3( bbox.max.x, bbox.min.y, bbox.max.z );
+		corners[6] = Vec3( bbox.min.x, bbox.max.y, bbox.max.z );
+		corners[7] = Vec3( bbox.max.x, bbox.max.y, bbox.max.z );
 
 		std::pair<int, int> screenCorners[8];
 		for ( int i = 0; i < 8; i++ )
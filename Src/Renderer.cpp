@@ -0,0 +1,515 @@
+#include "Renderer.hpp"
+#include "Shading.hpp"
+
+#include <chrono>
+
+namespace
+{
+
+// Per-path state of the path loop.
+struct PathContext
+{
+	std::mt19937                          &rng;
+	std::uniform_real_distribution<float> &dist;
+	const Scene                           &scene;
+	int                                    maxDepth;
+	int                                    rouletteDepth;
+	uint64_t                               rays = 0; // rays intersected with the scene
+};
+
+bool intersect( const Ray &ray, PathContext &ctx, int depth, Hit &closestHit )
+{
+	bool hit = intersectScene( ray, ctx.scene, closestHit );
+	ctx.rays++;
+	STATS_ADD( raysByDepth[std::min( depth, STATS_DEPTH_BUCKETS - 1 )], 1 );
+	STATS_ADD( hits, hit );
+	STATS_ADD( misses, !hit );
+	return hit;
+}
+
+// Light from sampling one light at the diffuse point `p`, 0 when its shadow ray is blocked.
+Vec3 directLight( const Vec3 &p, const Vec3 &normal, const Vec3 &color, PathContext &ctx )
+{
+	float       u0 = ctx.dist( ctx.rng ), u1 = ctx.dist( ctx.rng ), u2 = ctx.dist( ctx.rng );
+	DirectLight direct;
+	if ( !sampleDirectLight( ctx.scene.lights, p, normal, color, u0, u1, u2, direct ) )
+		return Vec3( 0 );
+
+	ctx.rays++;
+	STATS_ADD( shadowRays, 1 );
+	Ray shadow( p + direct.dir * 0.001f, direct.dir );
+	return occludedScene( shadow, ctx.scene, direct.distance - 0.002f ) ? Vec3( 0 ) : direct.radiance;
+}
+
+// Follows a path from its already intersected camera ray and returns the radiance it carries back. Every
+// vertex adds what it emits and, on diffuse surfaces, a light sample, both scaled by the throughput (the
+// product of the albedos so far), then bounces. The last vertex before `maxDepth` neither samples a light
+// nor bounces: BSDF sampling could not reach a light from there, and the two strategies must cover the
+// same paths for their weights to add up to one. What the camera ray hit goes to `features`.
+Vec3 tracePath( Ray ray, Hit closestHit, bool hit, PathContext &ctx, PixelFeatures &features )
+{
+	features = firstHitFeatures( ray, hit, closestHit );
+
+	Vec3  radiance( 0 );
+	Vec3  throughput( 1 );
+	float bsdfPdf = 0.0f; // of the current ray, 0 when it was not sampled from a diffuse surface
+	for ( int depth = 0;; )
+	{
+		if ( !hit )
+		{
+			radiance += throughput * skyColor();
+			break;
+		}
+
+		Vec3 p = ray.origin + ray.dir * closestHit.t;
+		radiance += throughput * emittedRadiance( ctx.scene.lights, closestHit, ray.dir, bsdfPdf );
+		if ( depth + 1 >= ctx.maxDepth )
+			break;
+
+		Vec3 dir;
+		if ( closestHit.reflective )
+		{
+			dir     = reflect( ray.dir, closestHit.normal ).normalize();
+			bsdfPdf = 0.0f;
+		}
+		else
+		{
+			Vec3 normal = faceForward( closestHit.normal, ray.dir );
+			radiance += throughput * directLight( p, normal, closestHit.color, ctx );
+			float r1 = ctx.dist( ctx.rng );
+			float r2 = ctx.dist( ctx.rng );
+			dir      = sampleCosineHemisphere( normal, r1, r2 );
+			bsdfPdf  = normal.dot( dir ) / M_PI;
+		}
+
+		throughput = throughput * closestHit.color;
+		depth++;
+		if ( !surviveRoulette( throughput, depth, ctx.rouletteDepth, ctx.dist( ctx.rng ) ) )
+			break;
+
+		ray = Ray( p + dir * 0.001f, dir );
+		hit = intersect( ray, ctx, depth, closestHit );
+	}
+	return radiance;
+}
+
+Vec3 trace( const Ray &ray, PathContext &ctx, PixelFeatures &features )
+{
+	Hit  closestHit;
+	bool hit = intersect( ray, ctx, 0, closestHit );
+	return tracePath( ray, closestHit, hit, ctx, features );
+}
+
+} // namespace
+
+Renderer::Renderer( ThreadPool &pool, const RenderSettings &settings, uint32_t seed )
+    : settings( settings ), accum( settings.width * settings.height ),
+      accumSquares( settings.width * settings.height ), pixelSamples( settings.width * settings.height ),
+      features( settings.width * settings.height ), pixels( settings.width * settings.height ), pool( pool )
+{
+	for ( int i = 0; i < pool.size(); i++ )
+	{
+		workerRngs.emplace_back( seed + i * 7919 );
+	}
+	workerRays.resize( pool.size(), 0 );
+	workerStats.resize( pool.size() );
+	resolveRows.resize( pool.size() );
+
+	tileSamples.assign( tileIndex( settings.width - 1, settings.height - 1 ) + 1, 1 );
+	reprojected.assign( settings.width * settings.height, 0 );
+}
+
+void Renderer::reset()
+{
+	std::fill( accum.begin(), accum.end(), Vec3( 0 ) );
+	std::fill( accumSquares.begin(), accumSquares.end(), 0.0f );
+	std::fill( pixelSamples.begin(), pixelSamples.end(), 0 );
+	std::fill( features.begin(), features.end(), PixelFeatures() );
+	std::fill( tileSamples.begin(), tileSamples.end(), 1 );
+	std::fill( reprojected.begin(), reprojected.end(), 0 );
+	convergedTiles = 0;
+	sampleCount    = 0;
+	showDenoised   = false;
+}
+
+int Renderer::tileIndex( int x, int y ) const
+{
+	return ( y / TILE_SIZE ) * ( ( settings.width + TILE_SIZE - 1 ) / TILE_SIZE ) + x / TILE_SIZE;
+}
+
+float Renderer::pixelError( int idx ) const
+{
+	uint32_t n = pixelSamples[idx];
+	if ( n < 2 )
+		return std::numeric_limits<float>::infinity();
+	float mean     = luminance( accum[idx] ) / n;
+	float variance = std::max( 0.0f, accumSquares[idx] / n - mean * mean ) * n / ( n - 1 );
+	return std::sqrt( variance / n ) / std::max( mean, ADAPTIVE_MIN_LUMINANCE );
+}
+
+float Renderer::noiseLevel() const
+{
+	double sum = 0.0;
+	for ( int i = 0; i < int( accum.size() ); i++ )
+	{
+		float error = pixelError( i );
+		sum += double( error ) * error;
+	}
+	return std::sqrt( sum / accum.size() );
+}
+
+float Renderer::convergedFraction() const
+{
+	return float( convergedTiles ) / tileSamples.size();
+}
+
+double Renderer::averageSamples() const
+{
+	double sum = 0.0;
+	for ( uint32_t samples : pixelSamples )
+	{
+		sum += samples;
+	}
+	return sum / pixelSamples.size();
+}
+
+// Judges every tile still sampling by the RMS error of its pixels: below the target it converged and is
+// skipped from now on, otherwise it gets the samples its error says it still needs for the next frame, as
+// the error falls with the square root of the sample count, up to ADAPTIVE_MAX_SAMPLES. Tiles at
+// `settings.maxSamples` stop either way.
+void Renderer::updateTileSamples()
+{
+	const int   tilesX = ( settings.width + TILE_SIZE - 1 ) / TILE_SIZE;
+	const float target = settings.noiseTarget;
+	pool.parallelFor( tileSamples.size(),
+	                  [&]( int tile, int )
+	                  {
+		                  int x0 = ( tile % tilesX ) * TILE_SIZE;
+		                  int y0 = ( tile / tilesX ) * TILE_SIZE;
+		                  int x1 = std::min( x0 + TILE_SIZE, settings.width );
+		                  int y1 = std::min( y0 + TILE_SIZE, settings.height );
+
+		                  if ( tileSamples[tile] == 0 )
+			                  return;
+
+		                  // counts only differ within a tile after temporal reprojection
+		                  uint32_t samples = std::numeric_limits<uint32_t>::max();
+		                  float    sum     = 0.0f;
+		                  for ( int y = y0; y < y1; y++ )
+		                  {
+			                  for ( int x = x0; x < x1; x++ )
+			                  {
+				                  float error = pixelError( y * settings.width + x );
+				                  sum += error * error;
+				                  samples = std::min( samples, pixelSamples[y * settings.width + x] );
+			                  }
+		                  }
+		                  int left = settings.maxSamples > 0 ? settings.maxSamples - int( samples )
+		                                                     : std::numeric_limits<int>::max();
+		                  if ( left <= 0 )
+			                  tileSamples[tile] = 0;
+		                  if ( tileSamples[tile] == 0 || samples < ADAPTIVE_MIN_SAMPLES )
+			                  return;
+		                  float error = std::sqrt( sum / ( ( x1 - x0 ) * ( y1 - y0 ) ) );
+		                  if ( error <= target )
+		                  {
+			                  tileSamples[tile] = 0;
+			                  return;
+		                  }
+		                  float needed      = samples * ( ( error / target ) * ( error / target ) - 1.0f );
+		                  int   extra       = int( std::ceil( needed ) );
+		                  tileSamples[tile] = std::clamp( extra, 1, std::min( ADAPTIVE_MAX_SAMPLES, left ) );
+	                  } );
+	convergedTiles = std::count( tileSamples.begin(), tileSamples.end(), 0 );
+}
+
+void Renderer::renderFrame( const Camera &camera, const Scene &scene )
+{
+	const int tilesX = ( settings.width + TILE_SIZE - 1 ) / TILE_SIZE;
+	const int tilesY = ( settings.height + TILE_SIZE - 1 ) / TILE_SIZE;
+
+	using Clock = std::chrono::steady_clock;
+
+	auto renderTileJob = [&]( int tile, int worker )
+	{
+		if ( tileSamples[tile] == 0 )
+			return;
+#if PATHTRACER_STATS
+		threadStats.reset();
+		auto tileStart = Clock::now();
+#endif
+		int x0 = ( tile % tilesX ) * TILE_SIZE;
+		int y0 = ( tile / tilesX ) * TILE_SIZE;
+		int x1 = std::min( x0 + TILE_SIZE, settings.width );
+		int y1 = std::min( y0 + TILE_SIZE, settings.height );
+		if ( settings.pixelScale > 1 )
+			renderTileScaled( camera, scene, x0, y0, x1, y1, worker );
+		for ( int sample = 0; settings.pixelScale <= 1 && sample < tileSamples[tile]; sample++ )
+		{
+			if ( settings.primaryPackets )
+				renderTilePackets( camera, scene, x0, y0, x1, y1, worker );
+			else
+				renderTile( camera, scene, x0, y0, x1, y1, worker );
+		}
+#if PATHTRACER_STATS
+		double seconds             = std::chrono::duration<double>( Clock::now() - tileStart ).count();
+		threadStats.tiles          = 1;
+		threadStats.tileSeconds    = seconds;
+		threadStats.maxTileSeconds = seconds;
+		workerStats[worker].merge( threadStats );
+#endif
+	};
+
+	auto frameStart = Clock::now();
+	sampleCount++;
+	showDenoised = false;
+	if ( settings.pixelScale > 1 )
+		preview.resize( accum.size() );
+	if ( settings.wavefront && settings.pixelScale <= 1 )
+		renderFrameWavefront( camera, scene );
+	else
+		pool.parallelFor( tilesX * tilesY, renderTileJob );
+	if ( settings.noiseTarget > 0.0f )
+		updateTileSamples();
+	if ( settings.denoise && settings.pixelScale <= 1 )
+		denoise();
+
+#if PATHTRACER_STATS
+	lastFrameStats.reset();
+	for ( RenderStats &stats : workerStats )
+	{
+		lastFrameStats.merge( stats );
+		stats.reset();
+	}
+	lastFrameStats.frames       = 1;
+	lastFrameStats.frameSeconds = std::chrono::duration<double>( Clock::now() - frameStart ).count();
+	lastFrameStats.idleSeconds  = lastFrameStats.frameSeconds * pool.size() - lastFrameStats.tileSeconds;
+	accumulatedStats.merge( lastFrameStats );
+#else
+	(void)frameStart;
+#endif
+}
+
+uint64_t Renderer::raysTraced() const
+{
+	uint64_t total = 0;
+	for ( uint64_t rays : workerRays )
+	{
+		total += rays;
+	}
+	return total;
+}
+
+void Renderer::denoise()
+{
+	denoised.resize( accum.size() );
+	DenoiseInput input;
+	input.width            = settings.width;
+	input.height           = settings.height;
+	input.color            = accum.data();
+	input.luminanceSquares = accumSquares.data();
+	input.samples          = pixelSamples.data();
+	input.features         = features.data();
+	denoiser.filter( pool, input, denoised.data() );
+	showDenoised = true;
+}
+
+// Rows go through tonemapPixels() in one call each: the denoised image directly, the accumulated one after
+// its means are gathered into the worker's row buffer.
+void Renderer::resolve( uint32_t *target, int pitch )
+{
+	const int width = settings.width;
+	pool.parallelFor( settings.height,
+	                  [&]( int y, int worker )
+	                  {
+		                  uint32_t *row = target + size_t( y ) * pitch;
+		                  if ( showDenoised )
+		                  {
+			                  tonemapPixels( settings.tonemap, &denoised[y * width], row, width );
+			                  return;
+		                  }
+
+		                  std::vector<Vec3> &colors = resolveRows[worker];
+		                  colors.resize( width );
+		                  for ( int x = 0; x < width; x++ )
+		                  {
+			                  int i = y * width + x;
+			                  if ( pixelSamples[i] || preview.empty() )
+				                  colors[x] = pixelMean( i );
+			                  else
+				                  colors[x] = preview[i];
+		                  }
+		                  tonemapPixels( settings.tonemap, colors.data(), row, width );
+	                  } );
+}
+
+void Renderer::accumulatePixel( int idx, const Vec3 &color, const PixelFeatures &sample )
+{
+	if ( reprojected[idx] )
+		validateHistory( idx, sample );
+
+	float brightness = luminance( color );
+	accum[idx] += color;
+	accumSquares[idx] += brightness * brightness;
+	features[idx].albedo += sample.albedo;
+	features[idx].normal += sample.normal;
+	features[idx].depth += sample.depth;
+	pixelSamples[idx]++;
+}
+
+void Renderer::makePrimaryPacket( const Camera &camera,
+                                  int           blockX,
+                                  int           blockY,
+                                  int           blockEndX,
+                                  int           blockEndY,
+                                  std::mt19937 &rng,
+                                  RayPacket    &packet ) const
+{
+	std::uniform_real_distribution<float> dist( 0, 1 );
+
+	const float width  = settings.width;
+	const float height = settings.height;
+	const float aspect = width / height;
+
+	auto toScreenU = [&]( float x ) { return ( x / width * 2 - 1 ) * aspect; };
+	auto toScreenV = [&]( float y ) { return -( y / height * 2 - 1 ); };
+
+	Vec3 corners[4] = { camera.getRay( toScreenU( blockX ), toScreenV( blockY ) ).dir,
+	                    camera.getRay( toScreenU( blockEndX ), toScreenV( blockY ) ).dir,
+	                    camera.getRay( toScreenU( blockEndX ), toScreenV( blockEndY ) ).dir,
+	                    camera.getRay( toScreenU( blockX ), toScreenV( blockEndY ) ).dir };
+	packet.setFrustum( camera.position, corners );
+
+	packet.active = 0;
+	for ( int y = blockY; y < blockEndY; ++y )
+	{
+		for ( int x = blockX; x < blockEndX; ++x )
+		{
+			int   lane        = ( y - blockY ) * RAY_PACKET_WIDTH + ( x - blockX );
+			float u           = toScreenU( x + dist( rng ) );
+			float v           = toScreenV( y + dist( rng ) );
+			packet.rays[lane] = camera.getRay( u, v );
+			packet.active |= uint64_t( 1 ) << lane;
+		}
+	}
+}
+
+// Traces the tile [x0, x1) x [y0, y1) in RAY_PACKET_WIDTH^2 blocks: primary rays go through the scene as
+// one frustum-culled packet, every later bounce is traced as a single ray.
+void Renderer::renderTilePackets( const Camera &camera,
+                                  const Scene  &scene,
+                                  int           x0,
+                                  int           y0,
+                                  int           x1,
+                                  int           y1,
+                                  int           worker )
+{
+	std::mt19937                         &rng = workerRngs[worker];
+	std::uniform_real_distribution<float> dist( 0, 1 );
+	PathContext                           ctx{ rng, dist, scene, settings.maxDepth, settings.rouletteDepth };
+
+	RayPacket packet;
+	Hit       hits[RAY_PACKET_SIZE];
+	for ( int blockY = y0; blockY < y1; blockY += RAY_PACKET_WIDTH )
+	{
+		for ( int blockX = x0; blockX < x1; blockX += RAY_PACKET_WIDTH )
+		{
+			makePrimaryPacket( camera,
+			                   blockX,
+			                   blockY,
+			                   std::min( blockX + RAY_PACKET_WIDTH, x1 ),
+			                   std::min( blockY + RAY_PACKET_WIDTH, y1 ),
+			                   rng,
+			                   packet );
+
+			uint64_t hitMask;
+			intersectScenePacket( packet, scene, hits, hitMask );
+			ctx.rays += __builtin_popcountll( packet.active );
+			STATS_ADD( raysByDepth[0], __builtin_popcountll( packet.active ) );
+			STATS_ADD( hits, __builtin_popcountll( packet.active & hitMask ) );
+			STATS_ADD( misses, __builtin_popcountll( packet.active & ~hitMask ) );
+
+			for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+			{
+				int           lane = __builtin_ctzll( lanes );
+				int           x    = blockX + lane % RAY_PACKET_WIDTH;
+				int           y    = blockY + lane / RAY_PACKET_WIDTH;
+				bool          hit  = ( hitMask >> lane ) & 1;
+				PixelFeatures sample;
+				Vec3          color = tracePath( packet.rays[lane], hits[lane], hit, ctx, sample );
+				accumulatePixel( y * settings.width + x, color, sample );
+			}
+		}
+	}
+	workerRays[worker] += ctx.rays;
+}
+
+void Renderer::renderTile( const Camera &camera,
+                           const Scene  &scene,
+                           int           x0,
+                           int           y0,
+                           int           x1,
+                           int           y1,
+                           int           worker )
+{
+	std::mt19937                         &rng = workerRngs[worker];
+	std::uniform_real_distribution<float> dist( 0, 1 );
+	PathContext                           ctx{ rng, dist, scene, settings.maxDepth, settings.rouletteDepth };
+	for ( int y = y0; y < y1; ++y )
+	{
+		for ( int x = x0; x < x1; ++x )
+		{
+			float u = ( x + dist( rng ) ) / settings.width * 2 - 1;
+			float v = ( y + dist( rng ) ) / settings.height * 2 - 1;
+			u *= (float)settings.width / settings.height;
+			Ray           ray = camera.getRay( u, -v );
+			PixelFeatures sample;
+			Vec3          color = trace( ray, ctx, sample );
+			accumulatePixel( y * settings.width + x, color, sample );
+		}
+	}
+	workerRays[worker] += ctx.rays;
+}
+
+// Traces one jittered sample in a random pixel of every pixelScale x pixelScale block of the tile, and
+// leaves it in `preview` for the pixels of the block that have no samples of their own.
+void Renderer::renderTileScaled( const Camera &camera,
+                                 const Scene  &scene,
+                                 int           x0,
+                                 int           y0,
+                                 int           x1,
+                                 int           y1,
+                                 int           worker )
+{
+	std::mt19937                         &rng = workerRngs[worker];
+	std::uniform_real_distribution<float> dist( 0, 1 );
+	PathContext                           ctx{ rng, dist, scene, settings.maxDepth, settings.rouletteDepth };
+	const int                             scale = settings.pixelScale;
+	for ( int blockY = y0; blockY < y1; blockY += scale )
+	{
+		for ( int blockX = x0; blockX < x1; blockX += scale )
+		{
+			int blockEndX = std::min( blockX + scale, x1 );
+			int blockEndY = std::min( blockY + scale, y1 );
+			int x         = std::min( blockX + int( dist( rng ) * scale ), blockEndX - 1 );
+			int y         = std::min( blockY + int( dist( rng ) * scale ), blockEndY - 1 );
+
+			float u = ( x + dist( rng ) ) / settings.width * 2 - 1;
+			float v = ( y + dist( rng ) ) / settings.height * 2 - 1;
+			u *= (float)settings.width / settings.height;
+			Ray           ray = camera.getRay( u, -v );
+			PixelFeatures sample;
+			Vec3          color = trace( ray, ctx, sample );
+			accumulatePixel( y * settings.width + x, color, sample );
+
+			for ( int py = blockY; py < blockEndY; py++ )
+			{
+				for ( int px = blockX; px < blockEndX; px++ )
+				{
+					preview[py * settings.width + px] = color;
+				}
+			}
+		}
+	}
+	workerRays[worker] += ctx.rays;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <random>
+
+#include "Camera.hpp"
+#include "Denoiser.hpp"
+#include "Scene.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "Tonemap.hpp"
+#include "Wavefront.hpp"
+
+const int TILE_SIZE = 16;
+
+// Adaptive sampling: a tile is judged once it has ADAPTIVE_MIN_SAMPLES, takes at most ADAPTIVE_MAX_SAMPLES
+// per frame, and pixels darker than ADAPTIVE_MIN_LUMINANCE measure their noise against that instead.
+const int   ADAPTIVE_MIN_SAMPLES   = 16;
+const int   ADAPTIVE_MAX_SAMPLES   = 4;
+const float ADAPTIVE_MIN_LUMINANCE = 0.05f;
+
+// Temporal reprojection: history carried into a new camera pose counts as at most TEMPORAL_MAX_HISTORY
+// samples (TEMPORAL_HOLE_HISTORY where it was borrowed from a neighbouring pixel), so new samples can still
+// correct it. It is dropped when the first new sample's depth is off by more than TEMPORAL_DEPTH_TOLERANCE
+// (relative) or its normal by more than the angle whose cosine is TEMPORAL_MIN_NORMAL_COSINE.
+const int   TEMPORAL_MAX_HISTORY       = 32;
+const int   TEMPORAL_HOLE_HISTORY      = 16;
+const float TEMPORAL_DEPTH_TOLERANCE   = 0.05f;
+const float TEMPORAL_MIN_NORMAL_COSINE = 0.9f;
+
+struct RenderSettings
+{
+	int  width          = 1080;
+	int  height         = 720;
+	int  maxDepth       = 5;
+	int  rouletteDepth  = 3;     // Russian roulette on bounces from this depth on, 0 disables it
+	bool primaryPackets = true;  // trace primary rays as frustum-culled 8x8 packets
+	bool wavefront      = false; // advance all paths of a frame bounce by bounce instead of per pixel
+
+	// Adaptive sampling: tiles whose relative noise (see Renderer::pixelError()) is below this stop taking
+	// samples, noisier ones take several per frame. 0 gives every pixel one sample per frame. Tiles also stop
+	// at `maxSamples` per pixel unless that is 0.
+	float noiseTarget = 0.0f;
+	int   maxSamples  = 0;
+
+	// Run the Denoiser over the accumulated image after every frame and resolve its result.
+	bool denoise = false;
+
+	// Carry the accumulated image over camera moves with reproject() instead of dropping it.
+	bool temporal = false;
+
+	// Trace one randomly picked pixel per pixelScale x pixelScale block (a power of two up to TILE_SIZE) and
+	// show its sample across the block's pixels that have none yet. The traced pixel accumulates as usual,
+	// so coarse frames still converge to the full image. Scaled frames always run per tile, undenoised.
+	int pixelScale = 1;
+
+	// How resolve() maps radiance above 1 to the display.
+	Tonemap tonemap = Tonemap::CLAMP;
+};
+
+// Progressive renderer: every renderFrame() adds one sample per pixel to `accum`, and resolve() tonemaps
+// the accumulated image into gamma-corrected 0x00RRGGBB pixels when it is to be shown. Frames are split into
+// TILE_SIZE tiles run on `pool`, or with `settings.wavefront` traced as whole-frame path queues: each bounce
+// intersects every live path, groups them by what they hit and shades each group in its own loop. With a
+// noise target, converged tiles are skipped and noisy ones take extra samples (the wavefront integrator
+// only skips). Camera rays also record what they hit first in `features`, which guides the optional
+// denoiser.
+struct Renderer
+{
+	RenderSettings             settings;
+	std::vector<Vec3>          accum;
+	std::vector<float>         accumSquares; // sum of the squared sample luminances, for the variance
+	std::vector<uint32_t>      pixelSamples; // samples in each pixel of `accum`
+	std::vector<PixelFeatures> features;     // first-hit albedo, normal and depth, summed like `accum`
+	std::vector<Vec3>          denoised;     // filtered mean per pixel, see denoise()
+	std::vector<uint32_t>      pixels;       // image of the last resolve()
+	int                        sampleCount = 0; // frames in `accum`
+
+	Renderer( ThreadPool &pool, const RenderSettings &settings, uint32_t seed = 1 );
+
+	// Drops the accumulated samples, e.g. after the camera moved.
+	void reset();
+
+	// Moves the accumulated samples from the pose `previous` to `camera`: every pixel's first hit, from its
+	// mean depth, is projected into the new view, the nearest one landing on a pixel becomes that pixel's
+	// history and pixels nothing lands on borrow a neighbour's. The first new sample of each pixel then
+	// keeps or rejects its history, see TEMPORAL_DEPTH_TOLERANCE.
+	void reproject( const Camera &previous, const Camera &camera );
+	void renderFrame( const Camera &camera, const Scene &scene );
+
+	// Filters the accumulated image into `denoised`, which resolve() then shows until the next frame;
+	// renderFrame() does this after every frame with `settings.denoise`.
+	void denoise();
+
+	// Writes the image as of the last frame to `target` through `settings.tonemap`, rows `pitch` pixels
+	// apart: the denoised image if the frame was denoised, otherwise each pixel's mean, or for pixels a
+	// scaled frame left without samples the sample previewing their block. Without arguments it writes
+	// `pixels`.
+	void resolve( uint32_t *target, int pitch );
+	void resolve()
+	{
+		resolve( pixels.data(), settings.width );
+	}
+
+	// Mean of the samples in pixel `idx`.
+	Vec3 pixelMean( int idx ) const
+	{
+		return accum[idx] * ( 1.0f / std::max( 1u, pixelSamples[idx] ) );
+	}
+
+	// Standard error of the pixel's mean luminance relative to that mean (dark pixels count as
+	// ADAPTIVE_MIN_LUMINANCE); infinite below two samples.
+	float pixelError( int idx ) const;
+
+	// RMS of pixelError() over the image, and the share of tiles that stopped sampling, at the noise target
+	// or at `settings.maxSamples`.
+	float noiseLevel() const;
+	float convergedFraction() const;
+	bool  converged() const
+	{
+		return settings.noiseTarget > 0.0f && convergedTiles == int( tileSamples.size() );
+	}
+
+	// Samples per pixel over the image.
+	double averageSamples() const;
+
+	// Rays intersected with the scene since construction, over all bounces.
+	uint64_t raysTraced() const;
+
+	// Counters of the last frame, and of every frame since the last resetStats(). They stay zero when the
+	// build has PATHTRACER_STATS off.
+	const RenderStats &frameStats() const
+	{
+		return lastFrameStats;
+	}
+	const RenderStats &totalStats() const
+	{
+		return accumulatedStats;
+	}
+	void resetStats()
+	{
+		accumulatedStats.reset();
+	}
+
+  private:
+	ThreadPool               &pool;
+	std::vector<std::mt19937> workerRngs; // one per pool worker, kept across frames
+	std::vector<uint64_t>     workerRays;
+	std::vector<RenderStats>  workerStats; // merged from the tiles of the frame in flight
+	RenderStats               lastFrameStats;
+	RenderStats               accumulatedStats;
+
+	// adaptive sampling: samples every pixel of each tile gets next frame, 0 once it converged
+	std::vector<uint8_t> tileSamples;
+	int                  convergedTiles = 0;
+
+	Denoiser denoiser;
+	bool     showDenoised = false; // `denoised` is up to date with the last frame
+
+	std::vector<Vec3> preview; // sample of each block of the last scaled frame, per pixel of the block
+
+	std::vector<std::vector<Vec3>> resolveRows; // per worker, the means of the row resolve() is on
+
+	// temporal reprojection, see Temporal.cpp: buffers the history is gathered into before being swapped
+	// with the live ones, and the pixels whose history no new sample has checked yet
+	std::vector<Vec3>          historyAccum;
+	std::vector<float>         historySquares;
+	std::vector<uint32_t>      historySamples;
+	std::vector<PixelFeatures> historyFeatures;
+	std::vector<uint64_t>      historyKeys; // distance bits and source pixel of the nearest point landing
+	std::vector<uint8_t>       reprojected;
+
+	void validateHistory( int idx, const PixelFeatures &sample );
+
+	int  tileIndex( int x, int y ) const;
+	void updateTileSamples();
+
+	void renderTile( const Camera &camera, const Scene &scene, int x0, int y0, int x1, int y1, int worker );
+	void renderTileScaled( const Camera &camera,
+	                       const Scene  &scene,
+	                       int           x0,
+	                       int           y0,
+	                       int           x1,
+	                       int           y1,
+	                       int           worker );
+	void renderTilePackets( const Camera &camera,
+	                        const Scene  &scene,
+	                        int           x0,
+	                        int           y0,
+	                        int           x1,
+	                        int           y1,
+	                        int           worker );
+	void accumulatePixel( int idx, const Vec3 &color, const PixelFeatures &sample );
+
+	// One jittered primary ray per pixel of [blockX, blockEndX) x [blockY, blockEndY), at most
+	// RAY_PACKET_WIDTH square, with the block's frustum.
+	void makePrimaryPacket( const Camera &camera,
+	                        int           blockX,
+	                        int           blockY,
+	                        int           blockEndX,
+	                        int           blockEndY,
+	                        std::mt19937 &rng,
+	                        RayPacket    &packet ) const;
+
+	// wavefront integrator state, see Wavefront.cpp
+	PathQueue                  paths;
+	PathQueue                  nextPaths;
+	ShadowQueue                shadows;
+	std::vector<Hit>           pathHits;
+	std::vector<uint8_t>       pathKeys;
+	std::vector<uint32_t>      pathOrder;
+	std::vector<uint32_t>      keyCounts;    // per chunk and key, for the parallel counting sorts
+	std::vector<Vec3>          radiance;     // this frame's sample per pixel
+	std::vector<PixelFeatures> pathFeatures; // this frame's first hit per pixel
+	std::vector<uint32_t>      blockSlots;   // first path of each primary block, equal to the next if skipped
+
+	void renderFrameWavefront( const Camera &camera, const Scene &scene );
+	void generatePaths( const Camera &camera, const Scene &scene );
+	void intersectPaths( const Scene &scene, int depth );
+	void shadePaths( const Scene &scene, int depth );
+	void traceShadows( const Scene &scene );
+	void sortPaths( int count, int keyCount, uint32_t *groupStart );
+	void forEachChunk( int count, int chunkSize, const std::function<void( int, int, int )> &job );
+};
@@ -0,0 +1,468 @@
+#include "Scene.hpp"
+#include "BVHTraversal.hpp"
+#include "ObjLoader.hpp"
+
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+// rebuild once the refitted tree costs this much more than it did right after its build
+const float TOP_LEVEL_REBUILD_RATIO = 1.3f;
+
+// Instances of meshes without geometry are left out of the top level.
+bool instanceVisible( const Scene &scene, uint32_t instance )
+{
+	return instance < scene.instances.size() && scene.instances[instance].mesh < scene.meshes.size() &&
+	       !scene.meshes[scene.instances[instance].mesh].geometry.empty();
+}
+
+// Object count the top level should have: every visible instance plus the sphere set if it has any.
+uint32_t topLevelObjectCount( const Scene &scene )
+{
+	uint32_t count = !scene.sphereBVH.empty();
+	for ( uint32_t i = 0; i < scene.instances.size(); i++ )
+	{
+		count += instanceVisible( scene, i );
+	}
+	return count;
+}
+
+AABB objectBounds( const Scene &scene, uint32_t object )
+{
+	return object == SCENE_SPHERES ? scene.sphereBVH.nodes[0].bbox : scene.instances[object].bounds;
+}
+
+// Recomputes the instance's derived state from its transform and mesh bounds; returns whether the
+// transform changed since the last call.
+bool updateInstance( const Scene &scene, MeshInstance &instance )
+{
+	Transform toObject = instance.transform.inverse();
+	AABB      bounds   = instance.transform.bounds( scene.meshes[instance.mesh].geometry.bbox );
+	bool      changed  = std::memcmp( &toObject, &instance.toObject, sizeof( Transform ) ) != 0;
+
+	// nothing is written for unchanged instances, so other threads may read them while frames update the
+	// scene, e.g. the viewer's debug overlays
+	if ( changed )
+	{
+		instance.identity = instance.transform.isIdentity();
+		instance.toObject = toObject;
+	}
+	if ( std::memcmp( &bounds, &instance.bounds, sizeof( AABB ) ) != 0 )
+		instance.bounds = bounds;
+	return changed;
+}
+
+// Surface area heuristic cost of the tree relative to its root: the expected number of nodes a random
+// ray through the root visits. Refitting after motion inflates it.
+float topLevelCost( const TopLevelBVH &topLevel )
+{
+	float rootArea = topLevel.nodes[0].bbox.surfaceArea();
+	if ( rootArea <= 0.0f )
+		return 0.0f;
+
+	float area = 0.0f;
+	for ( const BVHNode &node : topLevel.nodes )
+	{
+		area += node.bbox.surfaceArea() * ( node.isLeaf() ? node.count : 1 );
+	}
+	return area / rootArea;
+}
+
+void buildTopLevel( Scene &scene )
+{
+	TopLevelBVH &topLevel = scene.topLevel;
+
+	std::vector<BVHPrimitive> prims;
+	std::vector<uint32_t>     objects;
+	if ( !scene.sphereBVH.empty() )
+		objects.push_back( SCENE_SPHERES );
+	for ( uint32_t i = 0; i < scene.instances.size(); i++ )
+	{
+		if ( instanceVisible( scene, i ) )
+			objects.push_back( i );
+	}
+	for ( uint32_t i = 0; i < objects.size(); i++ )
+	{
+		AABB box = objectBounds( scene, objects[i] );
+		prims.push_back( { box, box.getCenter(), i } );
+	}
+
+	buildBVH( prims, topLevel.nodes );
+	topLevel.objects.resize( prims.size() );
+	topLevel.objectBounds.resize( prims.size() );
+	for ( uint32_t i = 0; i < prims.size(); i++ )
+	{
+		topLevel.objects[i]      = objects[prims[i].index];
+		topLevel.objectBounds[i] = prims[i].bbox;
+	}
+	topLevel.builtCost = topLevel.nodes.empty() ? 0.0f : topLevelCost( topLevel );
+}
+
+// Recomputes every node box from `objectBounds`. Children always follow their parent in the array, so
+// one backwards sweep sees both children of a node before the node itself.
+void refitTopLevel( TopLevelBVH &topLevel )
+{
+	for ( size_t i = topLevel.nodes.size(); i-- > 0; )
+	{
+		BVHNode &node = topLevel.nodes[i];
+		AABB     box;
+		if ( node.isLeaf() )
+		{
+			for ( uint32_t j = node.offset; j < node.offset + node.count; j++ )
+				box = AABB::combine( box, topLevel.objectBounds[j] );
+		}
+		else
+		{
+			box = AABB::combine( topLevel.nodes[i + 1].bbox, topLevel.nodes[node.offset].bbox );
+		}
+		node.bbox = box;
+	}
+}
+
+inline bool sameBounds( const AABB &a, const AABB &b )
+{
+	return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z && a.max.x == b.max.x &&
+	       a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+// The mesh under an instance transform: the ray goes to object space unnormalized, so `t` means the same
+// in both spaces and only the normal needs to come back.
+bool intersectInstance( const Ray &ray, const Scene &scene, const MeshInstance &instance, Hit &hit )
+{
+	const Mesh &mesh = scene.meshes[instance.mesh];
+	if ( instance.identity )
+		return intersectMesh( ray, mesh, hit );
+
+	Ray local( instance.toObject.point( ray.origin ), instance.toObject.vector( ray.dir ) );
+	if ( !intersectMesh( local, mesh, hit ) )
+		return false;
+	hit.normal = instance.toObject.transposedVector( hit.normal ).normalize();
+	return true;
+}
+
+// Packet version of intersectInstance(); the frustum planes move to object space with the rays.
+uint64_t intersectInstancePacket( const RayPacket    &packet,
+                                  const Scene        &scene,
+                                  const MeshInstance &instance,
+                                  Hit                *hits )
+{
+	const Mesh &mesh = scene.meshes[instance.mesh];
+	if ( instance.identity )
+		return intersectMeshPacket( packet, mesh, hits );
+
+	const Transform &toObject = instance.toObject;
+	RayPacket        local;
+	local.active = packet.active;
+	local.origin = toObject.point( packet.origin );
+	for ( int i = 0; i < 4; i++ )
+	{
+		local.planes[i] = instance.transform.transposedVector( packet.planes[i] );
+	}
+	for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+	{
+		int        lane = __builtin_ctzll( lanes );
+		const Ray &ray  = packet.rays[lane];
+		local.rays[lane] = Ray( toObject.point( ray.origin ), toObject.vector( ray.dir ) );
+	}
+
+	uint64_t improved = intersectMeshPacket( local, mesh, hits );
+	for ( uint64_t lanes = improved; lanes; lanes &= lanes - 1 )
+	{
+		Hit &hit   = hits[__builtin_ctzll( lanes )];
+		hit.normal = toObject.transposedVector( hit.normal ).normalize();
+	}
+	return improved;
+}
+
+// Top-level leaf: the objects [offset, offset + count) in BVH order.
+bool intersectObjects( const Ray &ray, const Scene &scene, uint32_t offset, uint32_t count, Hit &closestHit )
+{
+	bool hit = false;
+	for ( uint32_t i = offset; i < offset + count; i++ )
+	{
+		uint32_t object = scene.topLevel.objects[i];
+		if ( object == SCENE_SPHERES )
+		{
+			hit |= scene.sphereBVH.intersect( ray, closestHit );
+			continue;
+		}
+
+		Hit meshHit = closestHit;
+		if ( intersectInstance( ray, scene, scene.instances[object], meshHit ) && meshHit.t < closestHit.t )
+		{
+			closestHit = meshHit;
+			hit        = true;
+		}
+	}
+	return hit;
+}
+
+// Closest hit nearer than `closestHit.t` as passed in.
+bool intersectSceneWithin( const Ray &ray, const Scene &scene, Hit &closestHit )
+{
+	bool hit = false;
+
+	if ( !scene.topLevel.empty() )
+	{
+		hit = traverseBVH( scene.topLevel.nodes.data(),
+		                   ray,
+		                   closestHit,
+		                   [&]( uint32_t offset, uint32_t count )
+		                   { return intersectObjects( ray, scene, offset, count, closestHit ); } );
+	}
+
+	Hit groundHit;
+	groundHit.t = 1e9;
+	if ( intersectGround( ray, groundHit ) && groundHit.t < closestHit.t )
+	{
+		closestHit = groundHit;
+		hit        = true;
+	}
+
+	return hit;
+}
+
+// updateTopLevel() without the lights.
+bool updateTopLevelBVH( Scene &scene )
+{
+	bool transformed = false;
+	for ( uint32_t i = 0; i < scene.instances.size(); i++ )
+	{
+		if ( instanceVisible( scene, i ) )
+			transformed |= updateInstance( scene, scene.instances[i] );
+	}
+
+	TopLevelBVH &topLevel = scene.topLevel;
+	if ( topLevel.objects.size() != topLevelObjectCount( scene ) )
+	{
+		buildTopLevel( scene );
+		return true;
+	}
+
+	// a rotation can leave the bounds as they were, the tree is still fine then but the image is not
+	bool moved = false;
+	for ( uint32_t i = 0; i < topLevel.objects.size(); i++ )
+	{
+		uint32_t object = topLevel.objects[i];
+		bool     gone   = !instanceVisible( scene, object );
+		if ( object == SCENE_SPHERES )
+			gone = scene.sphereBVH.empty();
+		if ( gone )
+		{
+			// same count but different objects
+			buildTopLevel( scene );
+			return true;
+		}
+
+		AABB box = objectBounds( scene, object );
+		if ( !sameBounds( box, topLevel.objectBounds[i] ) )
+		{
+			topLevel.objectBounds[i] = box;
+			moved                    = true;
+		}
+	}
+	if ( !moved )
+		return transformed;
+
+	refitTopLevel( topLevel );
+	if ( topLevelCost( topLevel ) > topLevel.builtCost * TOP_LEVEL_REBUILD_RATIO )
+		buildTopLevel( scene );
+	return true;
+}
+
+} // namespace
+
+std::vector<Sphere> defaultSpheres()
+{
+	return {
+	    { { 0, 1.0f, 0 }, 1.0f, { 1, 1.0f, 1.0f }, true },
+	    { { -2, 1, -2 }, 1.0f, { 1, 0.2f, 0.2f }, false },
+	    { { -3, 1, -6 }, 1.0f, { 0.2f, 1, 0.2f }, false },
+	    { { 4, 1, -4 }, 1.0f, { 0.2f, 0.2f, 1 }, false },
+	    { { 3, 1, -6 }, 0.5f, { 1, 1, 0.2f }, false },
+	};
+}
+
+Mesh makeRoom()
+{
+	const float x0 = -6, x1 = 6, y1 = 5, z0 = -10, z1 = 5;
+	const Vec3  white( 0.75f, 0.75f, 0.75f ), red( 0.75f, 0.2f, 0.2f ), green( 0.2f, 0.75f, 0.2f );
+
+	Mesh mesh;
+	auto quad = [&]( Vec3 a, Vec3 b, Vec3 c, Vec3 d, Vec3 color, Vec3 emission = Vec3( 0 ) )
+	{
+		mesh.triangles.emplace_back( a, b, c, color, false, emission );
+		mesh.triangles.emplace_back( a, c, d, color, false, emission );
+	};
+
+	// the ground plane is the floor
+	quad( Vec3( x0, 0, z0 ), Vec3( x0, y1, z0 ), Vec3( x0, y1, z1 ), Vec3( x0, 0, z1 ), green );
+	quad( Vec3( x1, 0, z1 ), Vec3( x1, y1, z1 ), Vec3( x1, y1, z0 ), Vec3( x1, 0, z0 ), red );
+	quad( Vec3( x1, 0, z0 ), Vec3( x1, y1, z0 ), Vec3( x0, y1, z0 ), Vec3( x0, 0, z0 ), white );
+	quad( Vec3( x0, 0, z1 ), Vec3( x0, y1, z1 ), Vec3( x1, y1, z1 ), Vec3( x1, 0, z1 ), white );
+	quad( Vec3( x0, y1, z0 ), Vec3( x1, y1, z0 ), Vec3( x1, y1, z1 ), Vec3( x0, y1, z1 ), white );
+
+	// the light hangs just below the ceiling so the two never overlap
+	float ly = y1 - 0.01f;
+	quad( Vec3( -1.5f, ly, -5 ),
+	      Vec3( 1.5f, ly, -5 ),
+	      Vec3( 1.5f, ly, -2 ),
+	      Vec3( -1.5f, ly, -2 ),
+	      Vec3( 0 ),
+	      Vec3( 16, 14, 11 ) );
+	return mesh;
+}
+
+void addRoom( Scene &scene, ThreadPool &pool, BVHBuildMode bvhMode )
+{
+	Mesh room = makeRoom();
+	room.buildBVH( pool, preferredBVHWidth(), bvhMode );
+	addMesh( scene, std::move( room ) );
+}
+
+bool addOBJMesh( Scene                    &scene,
+                 const std::string        &objPath,
+                 ThreadPool               &pool,
+                 const SceneCacheSettings &cacheSettings,
+                 int                       copies,
+                 BVHBuildMode              bvhMode )
+{
+	MeshBuildParams params;
+	params.position = Vec3( 0, 1.0f, -5.0f );
+	params.scale    = 1.0f;
+	params.color    = Vec3( 0.9f, 0.9f, 0.9f );
+	params.bvhMode  = bvhMode;
+
+	Mesh       objMesh;
+	SceneCache cache( objPath, params, cacheSettings, pool );
+	if ( !cache.load( objMesh ) )
+	{
+		if ( !loadOBJ( objPath, objMesh, params.color, params.reflective, pool ) )
+			return false;
+
+		objMesh.setScale( params.scale );
+		objMesh.translate( params.position );
+		objMesh.buildBVH( pool, params.bvhWidth, params.bvhMode );
+		cache.store( objMesh );
+	}
+
+	uint32_t triangles = objMesh.geometry.triangleCount;
+	AABB     bbox      = objMesh.geometry.bbox;
+	uint32_t mesh      = addMesh( scene, std::move( objMesh ) );
+	std::cout << "Loaded OBJ with " << triangles << " triangles" << std::endl;
+
+	// the copies share the mesh: a square grid going back from the first, each turned about its centre
+	Vec3  center  = bbox.getCenter();
+	Vec3  extent  = bbox.max - bbox.min;
+	float spacing = 1.25f * std::max( extent.x, extent.z );
+	int   side    = int( std::ceil( std::sqrt( float( copies ) ) ) );
+	for ( int i = 1; i < copies; i++ )
+	{
+		Vec3 offset( ( i % side - side / 2 ) * spacing, 0, -( i / side ) * spacing );
+		scene.instances.emplace_back( mesh,
+		                              Transform::translate( center + offset ) *
+		                                  Transform::rotate( Vec3( 0, 1, 0 ), 37.0f * i ) *
+		                                  Transform::translate( center * -1.0f ) );
+	}
+	if ( copies > 1 )
+		std::cout << "Placed " << copies << " instances of it" << std::endl;
+	return true;
+}
+
+uint32_t addMesh( Scene &scene, Mesh mesh, const Transform &transform )
+{
+	scene.meshes.push_back( std::move( mesh ) );
+	scene.instances.emplace_back( scene.meshes.size() - 1, transform );
+	return scene.meshes.size() - 1;
+}
+
+bool updateTopLevel( Scene &scene )
+{
+	bool changed = updateTopLevelBVH( scene );
+	if ( changed )
+		updateLights( scene );
+	return changed;
+}
+
+bool intersectScene( const Ray &ray, const Scene &scene, Hit &closestHit )
+{
+	closestHit.t = 1e9;
+	return intersectSceneWithin( ray, scene, closestHit );
+}
+
+bool occludedScene( const Ray &ray, const Scene &scene, float maxT )
+{
+	Hit hit;
+	hit.t = maxT;
+	return intersectSceneWithin( ray, scene, hit );
+}
+
+void intersectScenePacket( const RayPacket &packet, const Scene &scene, Hit *hits, uint64_t &hitMask )
+{
+	hitMask = 0;
+	if ( !packet.active )
+		return;
+	for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+	{
+		hits[__builtin_ctzll( lanes )].t = 1e9;
+	}
+
+	// the packet walks the top level as a whole, culling nodes outside its frustum; the objects' own
+	// traversals do the per-lane tests
+	const std::vector<BVHNode> &nodes = scene.topLevel.nodes;
+	uint32_t                    stack[BVH_MAX_DEPTH + 1];
+	int                         stackSize = 0;
+	if ( !nodes.empty() )
+		stack[stackSize++] = 0;
+	Vec3 dir = packet.rays[__builtin_ctzll( packet.active )].dir;
+	while ( stackSize > 0 )
+	{
+		const BVHNode &node = nodes[stack[--stackSize]];
+		STATS_ADD( nodesVisited, 1 );
+		if ( packet.frustumCulls( node.bbox ) )
+			continue;
+
+		if ( !node.isLeaf() )
+		{
+			// push the far child first so the near one is visited first
+			uint32_t near = &node - nodes.data() + 1;
+			uint32_t far  = node.offset;
+			if ( ( nodes[near].bbox.getCenter() - nodes[far].bbox.getCenter() ).dot( dir ) > 0 )
+				std::swap( near, far );
+			stack[stackSize++] = far;
+			stack[stackSize++] = near;
+			continue;
+		}
+
+		for ( uint32_t i = node.offset; i < node.offset + node.count; i++ )
+		{
+			uint32_t object = scene.topLevel.objects[i];
+			if ( object != SCENE_SPHERES )
+			{
+				hitMask |= intersectInstancePacket( packet, scene, scene.instances[object], hits );
+				continue;
+			}
+
+			for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+			{
+				int lane = __builtin_ctzll( lanes );
+				if ( scene.sphereBVH.intersect( packet.rays[lane], hits[lane] ) )
+					hitMask |= uint64_t( 1 ) << lane;
+			}
+		}
+	}
+
+	for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+	{
+		int lane = __builtin_ctzll( lanes );
+		Hit groundHit;
+		groundHit.t = 1e9;
+		if ( intersectGround( packet.rays[lane], groundHit ) && groundHit.t < hits[lane].t )
+		{
+			hits[lane] = groundHit;
+			hitMask |= uint64_t( 1 ) << lane;
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+
+#include "Lights.hpp"
+#include "Mesh.hpp"
+#include "RayPacket.hpp"
+#include "SceneCache.hpp"
+#include "ThreadPool.hpp"
+
+// TopLevelBVH::objects entry standing for the whole sphere set.
+const uint32_t SCENE_SPHERES = UINT32_MAX;
+
+// One placement of `Scene::meshes[mesh]` in the world. Any number of instances share a mesh and its
+// object-space BVH; rays are moved into object space at the instance, so moving, rotating or scaling an
+// instance only changes its transform, never the mesh.
+struct MeshInstance
+{
+	uint32_t  mesh;
+	Transform transform; // object to world
+
+	// derived from `transform` by updateTopLevel()
+	Transform toObject;
+	AABB      bounds;          // world space
+	bool      identity = true; // rays are used as they are
+
+	explicit MeshInstance( uint32_t mesh, const Transform &transform = Transform() )
+	    : mesh( mesh ), transform( transform )
+	{
+	}
+};
+
+// BVH over the scene's objects: every mesh instance, plus the sphere set as one more object. Rays walk it
+// front to back and only enter an object's own BVH when its box is reached before the closest hit so far.
+struct TopLevelBVH
+{
+	std::vector<BVHNode>  nodes;
+	std::vector<uint32_t> objects;      // in BVH order: an instance index or SCENE_SPHERES
+	std::vector<AABB>     objectBounds; // bounds of `objects` as of the last build or refit
+	float                 builtCost = 0.0f;
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+};
+
+// Everything a frame is traced against: the sphere set, the mesh instances and the implicit ground plane.
+// Meshes are only drawn through instances. Call updateTopLevel() after adding, removing or moving any.
+struct Scene
+{
+	SphereBVH                 sphereBVH;
+	std::vector<Mesh>         meshes;
+	std::vector<MeshInstance> instances;
+	TopLevelBVH               topLevel;
+	SceneLights               lights; // derived by updateTopLevel()
+};
+
+// Adds `mesh` with one instance under `transform`; returns its index in `scene.meshes` for more instances.
+uint32_t addMesh( Scene &scene, Mesh mesh, const Transform &transform = Transform() );
+
+// Brings `scene.topLevel` up to date. Returns right away when no object moved, refits the node bounds in
+// place when only bounds changed and rebuilds when objects were added or removed or the refitted tree got
+// markedly worse than a fresh build. Returns whether anything changed; `scene.lights` is rebuilt if so.
+bool updateTopLevel( Scene &scene );
+
+// The built-in spheres every scene starts with.
+std::vector<Sphere> defaultSpheres();
+
+// Walls and a ceiling closing the default spheres in, lit only by a panel in the ceiling; the BVH is not
+// built yet.
+Mesh makeRoom();
+
+// makeRoom() built on `pool` with `bvhMode` and added to `scene`.
+void addRoom( Scene &scene, ThreadPool &pool, BVHBuildMode bvhMode = BVHBuildMode::SAH );
+
+// Loads `objPath` and places it in front of the default camera, followed by `copies - 1` more instances in
+// a grid behind it; returns false if nothing could be loaded. The built mesh comes from the scene cache
+// when it has a current one and is written to it otherwise, built on `pool` with `bvhMode`.
+bool addOBJMesh( Scene                    &scene,
+                 const std::string        &objPath,
+                 ThreadPool               &pool,
+                 const SceneCacheSettings &cacheSettings = SceneCacheSettings(),
+                 int                       copies        = 1,
+                 BVHBuildMode              bvhMode       = BVHBuildMode::SAH );
+
+bool intersectScene( const Ray &ray, const Scene &scene, Hit &closestHit );
+
+// Whether anything lies on `ray` closer than `maxT`; the shadow ray test.
+bool occludedScene( const Ray &ray, const Scene &scene, float maxT );
+
+// First-hit intersection for a whole packet; `hitMask` gets the lanes that hit anything.
+void intersectScenePacket( const RayPacket &packet, const Scene &scene, Hit *hits, uint64_t &hitMask );
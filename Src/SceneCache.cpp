@@ -0,0 +1,393 @@
+#include "SceneCache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+namespace
+{
+
+const char     CACHE_MAGIC[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t CACHE_VERSION  = 1;
+const size_t   SECTION_ALIGN  = 64;
+const size_t   HASH_CHUNK     = 8 << 20;
+
+struct CacheHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t layout; // record sizes of this build, rejects caches from an incompatible one
+	uint64_t sourceHash;
+	uint64_t paramsHash;
+	uint64_t sourceSize;
+	int64_t  sourceMtime; // nanoseconds
+	uint64_t fileSize;
+
+	uint32_t triangleCount;
+	uint32_t packetCount;
+	uint32_t nodeCount;
+	uint32_t wideNodeCount;
+	int32_t  wideWidth;
+	float    scale;
+	Vec3     position;
+	AABB     bbox;
+
+	uint64_t trianglesOffset;
+	uint64_t packetsOffset;
+	uint64_t nodesOffset;
+	uint64_t wideNodesOffset;
+};
+
+inline uint64_t mix( uint64_t x )
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+uint64_t hashBytes( const void *data, size_t size, uint64_t seed )
+{
+	const uint64_t prime = 0x100000001b3ull;
+	const char    *bytes = static_cast<const char *>( data );
+	uint64_t       h     = mix( seed ^ size );
+	size_t         i     = 0;
+	for ( ; i + 8 <= size; i += 8 )
+	{
+		uint64_t word;
+		std::memcpy( &word, bytes + i, 8 );
+		h = ( h ^ word ) * prime;
+		h = ( h << 31 ) | ( h >> 33 );
+	}
+	for ( ; i < size; i++ )
+	{
+		h = ( h ^ uint8_t( bytes[i] ) ) * prime;
+	}
+	return mix( h );
+}
+
+uint32_t layoutHash()
+{
+	const uint64_t sizes[] = { sizeof( CacheHeader ),
+	                           sizeof( Triangle ),
+	                           sizeof( TrianglePacket ),
+	                           sizeof( BVHNode ),
+	                           sizeof( WideBVHNode<4> ),
+	                           sizeof( WideBVHNode<8> ) };
+	return uint32_t( hashBytes( sizes, sizeof( sizes ), CACHE_VERSION ) );
+}
+
+inline uint64_t alignUp( uint64_t offset )
+{
+	return ( offset + SECTION_ALIGN - 1 ) & ~uint64_t( SECTION_ALIGN - 1 );
+}
+
+size_t wideNodeSize( int width )
+{
+	return width == 8 ? sizeof( WideBVHNode<8> ) : width == 4 ? sizeof( WideBVHNode<4> ) : 0;
+}
+
+// section [offset, offset + count * size) lies inside the file and is aligned
+bool validSection( uint64_t offset, uint64_t count, size_t size, uint64_t fileSize )
+{
+	return offset % SECTION_ALIGN == 0 && offset <= fileSize && count * size <= fileSize - offset;
+}
+
+bool writeSection( FILE *file, uint64_t &written, uint64_t offset, const void *data, size_t bytes )
+{
+	static const char zeros[SECTION_ALIGN] = {};
+	if ( std::fwrite( zeros, 1, offset - written, file ) != offset - written )
+		return false;
+	written = offset + bytes;
+	return bytes == 0 || std::fwrite( data, 1, bytes, file ) == bytes;
+}
+
+// Traversal follows the mapped nodes unchecked, so a cache is only used if every child index stays in
+// range and points further down the array (no cycles), every leaf range lies within the triangles and
+// no path is deeper than the fixed traversal stacks allow. One pass, as children follow their parents.
+bool validNodes( const BVHNode *nodes, uint32_t nodeCount, uint32_t triangleCount )
+{
+	std::vector<uint8_t> level( nodeCount, 0 ); // 1-based depth once a parent reached the node
+	level[0] = 1;
+	for ( uint32_t i = 0; i < nodeCount; i++ )
+	{
+		const BVHNode &node = nodes[i];
+		if ( level[i] == 0 )
+			return false;
+		if ( node.isLeaf() )
+		{
+			if ( uint64_t( node.offset ) + node.count > triangleCount )
+				return false;
+			continue;
+		}
+
+		// near child right after the node, far child at `offset`
+		if ( node.offset <= i + 1 || node.offset >= nodeCount || level[i] >= BVH_MAX_DEPTH ||
+		     level[i + 1] != 0 || level[node.offset] != 0 )
+			return false;
+		level[i + 1]       = level[i] + 1;
+		level[node.offset] = level[i] + 1;
+	}
+	return true;
+}
+
+template <int N>
+bool validWideNodes( const WideBVHNode<N> *nodes, uint32_t nodeCount, uint32_t triangleCount )
+{
+	const WideBVHNode<N> unused;
+	std::vector<uint8_t> level( nodeCount, 0 ); // as in validNodes()
+	level[0] = 1;
+	for ( uint32_t i = 0; i < nodeCount; i++ )
+	{
+		const WideBVHNode<N> &node = nodes[i];
+		if ( level[i] == 0 )
+			return false;
+		for ( int lane = 0; lane < N; lane++ )
+		{
+			uint32_t child = node.child[lane];
+			if ( node.count[lane] > 0 )
+			{
+				if ( uint64_t( child ) + node.count[lane] > triangleCount )
+					return false;
+			}
+			else if ( child == 0 )
+			{
+				// an unused lane is only skipped thanks to its inverted bounds
+				for ( int plane = 0; plane < 6; plane++ )
+				{
+					if ( node.bounds[plane][lane] != unused.bounds[plane][lane] )
+						return false;
+				}
+			}
+			else
+			{
+				if ( child <= i || child >= nodeCount || level[i] >= BVH_MAX_DEPTH - 1 || level[child] != 0 )
+					return false;
+				level[child] = level[i] + 1;
+			}
+		}
+	}
+	return true;
+}
+
+std::string fileName( const std::string &path )
+{
+	size_t slash = path.find_last_of( '/' );
+	return slash == std::string::npos ? path : path.substr( slash + 1 );
+}
+
+} // namespace
+
+SceneCache::SceneCache( const std::string        &sourcePath,
+                        const MeshBuildParams    &params,
+                        const SceneCacheSettings &settings,
+                        ThreadPool               &pool )
+    : sourcePath( sourcePath ), pool( pool ), enabled( settings.enabled ), bvhMode( params.bvhMode )
+{
+	const float values[] = { params.position.x,
+	                         params.position.y,
+	                         params.position.z,
+	                         params.scale,
+	                         params.color.x,
+	                         params.color.y,
+	                         params.color.z,
+	                         float( params.reflective ),
+	                         float( params.bvhWidth ),
+	                         float( params.bvhMode ) };
+	paramsHash           = hashBytes( values, sizeof( values ), layoutHash() );
+
+	char suffix[32];
+	std::snprintf( suffix, sizeof( suffix ), ".%016llx.ptcache", (unsigned long long)paramsHash );
+	if ( settings.directory.empty() )
+		cachePath = sourcePath + suffix;
+	else
+		cachePath = settings.directory + "/" + fileName( sourcePath ) + suffix;
+}
+
+bool SceneCache::statSource()
+{
+	struct stat info;
+	if ( stat( sourcePath.c_str(), &info ) != 0 )
+		return false;
+
+	sourceSize = info.st_size;
+#ifdef __APPLE__
+	sourceMtime = int64_t( info.st_mtimespec.tv_sec ) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	sourceMtime = int64_t( info.st_mtim.tv_sec ) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+// Word-wise hash of every 8 MB chunk in parallel, then of the chunk hashes in order.
+uint64_t SceneCache::contentHash()
+{
+	if ( hashed )
+		return sourceHash;
+
+	MappedFile source( sourcePath, true );
+	if ( !source.data )
+		return 0;
+
+	std::vector<uint64_t> chunks( ( source.size + HASH_CHUNK - 1 ) / HASH_CHUNK );
+	pool.parallelFor( chunks.size(),
+	                  [&]( int i, int )
+	                  {
+		                  size_t begin = size_t( i ) * HASH_CHUNK;
+		                  size_t size  = std::min( HASH_CHUNK, source.size - begin );
+		                  chunks[i]    = hashBytes( source.data + begin, size, i );
+	                  } );
+
+	sourceHash = hashBytes( chunks.data(), chunks.size() * sizeof( uint64_t ), source.size );
+	hashed     = true;
+	return sourceHash;
+}
+
+bool SceneCache::load( Mesh &mesh )
+{
+	if ( !enabled || !statSource() )
+		return false;
+
+	using Clock = std::chrono::steady_clock;
+	auto start  = Clock::now();
+
+	auto file = std::make_shared<const MappedFile>( cachePath );
+	if ( !file->data || file->size < sizeof( CacheHeader ) )
+		return false;
+
+	CacheHeader header;
+	std::memcpy( &header, file->data, sizeof( header ) );
+	size_t wideSize = wideNodeSize( header.wideWidth );
+	if ( std::memcmp( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0 ||
+	     header.version != CACHE_VERSION || header.layout != layoutHash() ||
+	     header.paramsHash != paramsHash || header.fileSize != file->size ||
+	     header.sourceSize != sourceSize || header.nodeCount == 0 ||
+	     !validSection( header.trianglesOffset, header.triangleCount, sizeof( Triangle ), file->size ) ||
+	     !validSection( header.packetsOffset, header.packetCount, sizeof( TrianglePacket ), file->size ) ||
+	     !validSection( header.nodesOffset, header.nodeCount, sizeof( BVHNode ), file->size ) ||
+	     !validSection( header.wideNodesOffset, header.wideNodeCount, wideSize, file->size ) )
+	{
+		std::cout << "Ignoring stale scene cache " << cachePath << std::endl;
+		return false;
+	}
+
+	// a touched but unchanged source still hits, only slower
+	if ( header.sourceMtime != sourceMtime && header.sourceHash != contentHash() )
+	{
+		std::cout << "Ignoring stale scene cache " << cachePath << std::endl;
+		return false;
+	}
+
+	const char *wideNodes = file->data + header.wideNodesOffset;
+	bool        wideValid = header.wideNodeCount == 0;
+	if ( !wideValid && header.wideWidth == 4 )
+		wideValid = validWideNodes( reinterpret_cast<const WideBVHNode<4> *>( wideNodes ),
+		                             header.wideNodeCount,
+		                             header.triangleCount );
+	else if ( !wideValid && header.wideWidth == 8 )
+		wideValid = validWideNodes( reinterpret_cast<const WideBVHNode<8> *>( wideNodes ),
+		                             header.wideNodeCount,
+		                             header.triangleCount );
+	if ( ( header.packetCount != 0 && header.packetCount != ( uint64_t( header.triangleCount ) + 3 ) / 4 ) ||
+	     !wideValid ||
+	     !validNodes( reinterpret_cast<const BVHNode *>( file->data + header.nodesOffset ),
+	                  header.nodeCount,
+	                  header.triangleCount ) )
+	{
+		std::cout << "Ignoring corrupt scene cache " << cachePath << std::endl;
+		return false;
+	}
+
+	MeshGeometry &geometry = mesh.geometry;
+	geometry               = MeshGeometry();
+	geometry.triangles     = reinterpret_cast<const Triangle *>( file->data + header.trianglesOffset );
+	geometry.nodes         = reinterpret_cast<const BVHNode *>( file->data + header.nodesOffset );
+	geometry.wideNodes     = header.wideNodeCount ? file->data + header.wideNodesOffset : nullptr;
+	geometry.triangleCount = header.triangleCount;
+	geometry.packetCount   = header.packetCount;
+	geometry.nodeCount     = header.nodeCount;
+	geometry.wideNodeCount = header.wideNodeCount;
+	geometry.wideWidth     = header.wideNodeCount ? header.wideWidth : 0;
+	geometry.bbox          = header.bbox;
+	if ( header.packetCount )
+		geometry.packets = reinterpret_cast<const TrianglePacket *>( file->data + header.packetsOffset );
+
+	mesh.triangles.clear();
+	mesh.packets.clear();
+	mesh.bvh     = TriangleBVH();
+	mesh.wideBVH = WideBVH();
+	mesh.cache   = std::move( file );
+
+	mesh.position      = header.position;
+	mesh.scale         = header.scale;
+	mesh.bakedPosition = header.position;
+	mesh.bakedScale    = header.scale;
+	mesh.bvhMode       = bvhMode;
+
+	double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+	std::cout << "Scene cache hit: " << cachePath << " (" << header.triangleCount << " triangles, "
+	          << seconds * 1e3 << " ms)" << std::endl;
+	return true;
+}
+
+bool SceneCache::store( const Mesh &mesh )
+{
+	const MeshGeometry &geometry = mesh.geometry;
+	if ( !enabled || geometry.empty() || ( !hashed && !statSource() ) )
+		return false;
+
+	CacheHeader header;
+	std::memset( static_cast<void *>( &header ), 0, sizeof( header ) ); // zero padding too
+	std::memcpy( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+	header.version       = CACHE_VERSION;
+	header.layout        = layoutHash();
+	header.sourceHash    = contentHash();
+	header.paramsHash    = paramsHash;
+	header.sourceSize    = sourceSize;
+	header.sourceMtime   = sourceMtime;
+	header.triangleCount = geometry.triangleCount;
+	header.packetCount   = geometry.packetCount;
+	header.nodeCount     = geometry.nodeCount;
+	header.wideNodeCount = geometry.wideNodeCount;
+	header.wideWidth     = geometry.wideWidth;
+	header.scale         = mesh.bakedScale;
+	header.position      = mesh.bakedPosition;
+	header.bbox          = geometry.bbox;
+
+	size_t trianglesBytes = size_t( geometry.triangleCount ) * sizeof( Triangle );
+	size_t packetsBytes   = size_t( geometry.packetCount ) * sizeof( TrianglePacket );
+	size_t nodesBytes     = size_t( geometry.nodeCount ) * sizeof( BVHNode );
+	size_t wideBytes      = size_t( geometry.wideNodeCount ) * wideNodeSize( geometry.wideWidth );
+
+	header.trianglesOffset = alignUp( sizeof( CacheHeader ) );
+	header.packetsOffset   = alignUp( header.trianglesOffset + trianglesBytes );
+	header.nodesOffset     = alignUp( header.packetsOffset + packetsBytes );
+	header.wideNodesOffset = alignUp( header.nodesOffset + nodesBytes );
+	header.fileSize        = header.wideNodesOffset + wideBytes;
+
+	// written under a temporary name and renamed, so a crash never leaves a truncated cache behind
+	std::string tmpPath = cachePath + ".tmp";
+	FILE       *file    = std::fopen( tmpPath.c_str(), "wb" );
+	uint64_t    written = 0;
+	bool        ok      = file && writeSection( file, written, 0, &header, sizeof( header ) ) &&
+	              writeSection( file, written, header.trianglesOffset, geometry.triangles, trianglesBytes ) &&
+	              writeSection( file, written, header.packetsOffset, geometry.packets, packetsBytes ) &&
+	              writeSection( file, written, header.nodesOffset, geometry.nodes, nodesBytes ) &&
+	              writeSection( file, written, header.wideNodesOffset, geometry.wideNodes, wideBytes );
+	if ( file && std::fclose( file ) != 0 )
+		ok = false;
+	if ( !ok || std::rename( tmpPath.c_str(), cachePath.c_str() ) != 0 )
+	{
+		std::remove( tmpPath.c_str() );
+		std::cerr << "Warning: could not write scene cache " << cachePath << std::endl;
+		return false;
+	}
+
+	std::cout << "Wrote scene cache " << cachePath << " (" << header.fileSize / ( 1024.0 * 1024.0 ) << " MB)"
+	          << std::endl;
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+struct SceneCacheSettings
+{
+	bool        enabled = true;
+	std::string directory; // next to the source file when empty
+};
+
+// Everything besides the source file that goes into a built mesh; part of the cache key.
+struct MeshBuildParams
+{
+	Vec3         position;
+	float        scale = 1.0f;
+	Vec3         color;
+	bool         reflective = false;
+	int          bvhWidth   = preferredBVHWidth();
+	BVHBuildMode bvhMode    = BVHBuildMode::SAH;
+};
+
+// Binary cache of one built mesh: the transformed, BVH-ordered triangles, their SIMD packets, the binary
+// and wide BVH nodes and the bounds, each section 64-byte aligned so a mapping of the file can be traced
+// directly. The file is named after the source and a hash of the build params and records a content hash
+// of the source; the source's size and mtime are stored too so an unchanged file is not rehashed.
+struct SceneCache
+{
+	SceneCache( const std::string        &sourcePath,
+	            const MeshBuildParams    &params,
+	            const SceneCacheSettings &settings,
+	            ThreadPool               &pool );
+
+	// Maps a matching cache file and points `mesh` into it; false on a miss or a stale/corrupt file. Every
+	// node and leaf index is checked before use, triangle values are taken as they are.
+	bool load( Mesh &mesh );
+
+	// Writes the built `mesh` for later runs. Failures only print a warning.
+	bool store( const Mesh &mesh );
+
+  private:
+	std::string  sourcePath;
+	std::string  cachePath;
+	ThreadPool  &pool;
+	bool         enabled;
+	BVHBuildMode bvhMode;
+	uint64_t     paramsHash;
+	uint64_t     sourceSize  = 0;
+	int64_t      sourceMtime = 0;
+	uint64_t     sourceHash  = 0;
+	bool         hashed      = false;
+
+	bool     statSource();
+	uint64_t contentHash();
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Math.hpp"
+
+// Surface and sky terms shared by the recursive and the wavefront integrator, so both converge to the
+// same image.
+
+// Radiance of every ray that leaves the scene.
+inline Vec3 skyColor()
+{
+	return Vec3( 0.2f, 0.3f, 0.6f );
+}
+
+// Mirror direction of `dir` about `normal`; unnormalized, the caller offsets the origin along it first.
+inline Vec3 reflect( const Vec3 &dir, const Vec3 &normal )
+{
+	return dir - normal * 2.0f * dir.dot( normal );
+}
+
+// Cosine-weighted direction in the hemisphere around `normal` from two uniform numbers in [0, 1).
+inline Vec3 sampleCosineHemisphere( const Vec3 &normal, float r1, float r2 )
+{
+	float phi = 2 * M_PI * r1;
+	float r   = std::sqrt( r2 );
+	float x = r * std::cos( phi ), y = r * std::sin( phi ), z = std::sqrt( 1 - r2 );
+	Vec3  u = normal.cross( std::abs( normal.x ) > 0.1f ? Vec3( 0, 1, 0 ) : Vec3( 1, 0, 0 ) ).normalize();
+	Vec3  v = normal.cross( u );
+	return ( u * x + v * y + normal * z ).normalize();
+}
+
+// `normal` flipped to the side `dir` arrives from, so surfaces scatter light from both sides.
+inline Vec3 faceForward( const Vec3 &normal, const Vec3 &dir )
+{
+	return normal.dot( dir ) < 0 ? normal : normal * -1.0f;
+}
+
+// Rec. 709 luminance; weighs lights by how bright they look.
+inline float luminance( const Vec3 &c )
+{
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+// Power heuristic MIS weight of a sample drawn with density `pdf` when `otherPdf` could also have produced
+// it; written as a ratio so an infinite density on either side still gives 0 or 1.
+inline float powerHeuristic( float pdf, float otherPdf )
+{
+	if ( !( pdf > 0.0f ) )
+		return 0.0f;
+	float ratio = otherPdf / pdf;
+	return 1.0f / ( 1.0f + ratio * ratio );
+}
+
+// Lowest survival probability of Russian roulette; caps the weight a surviving path gets.
+const float ROULETTE_MIN_SURVIVAL = 0.05f;
+
+// Russian roulette before tracing the ray at `depth`, from `rouletteDepth` on (never when that is 0): the
+// path survives with the luminance of its throughput as probability, from a uniform `u` in [0, 1), and
+// survivors have their throughput divided by it, so dark paths end early and the estimate stays unbiased.
+inline bool surviveRoulette( Vec3 &throughput, int depth, int rouletteDepth, float u )
+{
+	if ( rouletteDepth <= 0 || depth < rouletteDepth )
+		return true;
+	float survival = std::min( 1.0f, std::max( luminance( throughput ), ROULETTE_MIN_SURVIVAL ) );
+	if ( u >= survival )
+		return false;
+	throughput = throughput * ( 1.0f / survival );
+	return true;
+}
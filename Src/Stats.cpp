@@ -0,0 +1,101 @@
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#if PATHTRACER_STATS
+thread_local RenderStats threadStats;
+#endif
+
+uint64_t RenderStats::rays() const
+{
+	uint64_t total = shadowRays;
+	for ( uint64_t rays : raysByDepth )
+	{
+		total += rays;
+	}
+	return total;
+}
+
+void RenderStats::reset()
+{
+	*this = RenderStats();
+}
+
+void RenderStats::merge( const RenderStats &other )
+{
+	for ( int i = 0; i < STATS_DEPTH_BUCKETS; i++ )
+	{
+		raysByDepth[i] += other.raysByDepth[i];
+	}
+	shadowRays += other.shadowRays;
+	nodesVisited += other.nodesVisited;
+	boxTests += other.boxTests;
+	triangleTests += other.triangleTests;
+	sphereTests += other.sphereTests;
+	hits += other.hits;
+	misses += other.misses;
+
+	tiles += other.tiles;
+	tileSeconds += other.tileSeconds;
+	maxTileSeconds = std::max( maxTileSeconds, other.maxTileSeconds );
+	frames += other.frames;
+	frameSeconds += other.frameSeconds;
+	idleSeconds += other.idleSeconds;
+}
+
+std::string RenderStats::toText() const
+{
+	uint64_t           total  = rays();
+	double             perRay = total ? 1.0 / total : 0.0;
+	std::ostringstream out;
+	out << "Stats over " << frames << " frames (" << frameSeconds << " s):\n";
+	out << "  rays " << total << " (" << ( frameSeconds > 0 ? total / frameSeconds / 1e6 : 0.0 )
+	    << " Mrays/s), hits " << hits << ", misses " << misses << ", shadow " << shadowRays
+	    << "\n  rays by depth:";
+	for ( int i = 0; i < STATS_DEPTH_BUCKETS; i++ )
+	{
+		if ( raysByDepth[i] )
+			out << " " << i << ":" << raysByDepth[i];
+	}
+	out << "\n  per ray: " << nodesVisited * perRay << " nodes, " << boxTests * perRay << " box tests, "
+	    << triangleTests * perRay << " triangle tests, " << sphereTests * perRay << " sphere tests\n";
+	out << "  tiles " << tiles << ", avg " << ( tiles ? tileSeconds / tiles * 1e3 : 0.0 ) << " ms, max "
+	    << maxTileSeconds * 1e3 << " ms, idle " << idleSeconds << " s\n";
+	return out.str();
+}
+
+std::string RenderStats::toJSON() const
+{
+	std::ostringstream out;
+	out << "{\"frames\": " << frames << ", \"frame_seconds\": " << frameSeconds << ", \"rays\": " << rays()
+	    << ", \"rays_by_depth\": [";
+	for ( int i = 0; i < STATS_DEPTH_BUCKETS; i++ )
+	{
+		out << ( i ? ", " : "" ) << raysByDepth[i];
+	}
+	out << "], \"shadow_rays\": " << shadowRays << ", \"hits\": " << hits << ", \"misses\": " << misses
+	    << ", \"nodes_visited\": " << nodesVisited << ", \"box_tests\": " << boxTests
+	    << ", \"triangle_tests\": " << triangleTests << ", \"sphere_tests\": " << sphereTests
+	    << ", \"tiles\": " << tiles
+	    << ", \"tile_seconds\": " << tileSeconds << ", \"max_tile_seconds\": " << maxTileSeconds
+	    << ", \"idle_seconds\": " << idleSeconds << "}";
+	return out.str();
+}
+
+bool StatsReporter::update( const RenderStats &stats )
+{
+	auto now = std::chrono::steady_clock::now();
+	if ( interval <= 0.0f || std::chrono::duration<float>( now - last ).count() < interval )
+		return false;
+
+	last = now;
+	print( stats );
+	return true;
+}
+
+void StatsReporter::print( const RenderStats &stats ) const
+{
+	std::cout << ( json ? stats.toJSON() + "\n" : stats.toText() ) << std::flush;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Statistics are compiled in unless the build sets PATHTRACER_STATS=0 (CMake option PATHTRACER_STATS);
+// compiled out, every STATS_ADD() vanishes and the counters simply stay zero.
+#ifndef PATHTRACER_STATS
+#define PATHTRACER_STATS 1
+#endif
+
+const int STATS_DEPTH_BUCKETS = 16; // rays at depth 15 and deeper share the last bucket
+
+// Counters of one worker, or merged over several. A worker only ever touches its own copy, so these are
+// plain integers; the renderer merges them at the end of every tile and frame.
+struct alignas( 64 ) RenderStats
+{
+	uint64_t raysByDepth[STATS_DEPTH_BUCKETS] = {};
+	uint64_t shadowRays                       = 0; // light sampling visibility tests, not in raysByDepth
+	uint64_t nodesVisited                     = 0; // BVH nodes popped, all BVH kinds
+	uint64_t boxTests                         = 0; // ray-box slab tests, one per SIMD lane
+	uint64_t triangleTests                    = 0;
+	uint64_t sphereTests                      = 0;
+	uint64_t hits                             = 0; // scene rays that hit something
+	uint64_t misses                           = 0;
+
+	uint64_t tiles          = 0;
+	double   tileSeconds    = 0; // wall time spent inside tiles, summed over workers
+	double   maxTileSeconds = 0;
+	uint64_t frames         = 0;
+	double   frameSeconds   = 0;
+	double   idleSeconds    = 0; // worker time during frames not spent on tiles
+
+	uint64_t rays() const;
+	void     reset();
+	void     merge( const RenderStats &other );
+
+	std::string toText() const;
+	std::string toJSON() const; // one line, so periodic dumps form a JSON-lines stream
+};
+
+#if PATHTRACER_STATS
+// Counters of the calling thread. The renderer clears them before a tile and merges them after.
+extern thread_local RenderStats threadStats;
+#define STATS_ADD( counter, amount ) ( threadStats.counter += ( amount ) )
+#else
+#define STATS_ADD( counter, amount ) ( (void)0 )
+#endif
+
+// Prints stats from a render loop every `interval` seconds (never when 0).
+struct StatsReporter
+{
+	float                                 interval = 0.0f;
+	bool                                  json     = false;
+	std::chrono::steady_clock::time_point last     = std::chrono::steady_clock::now();
+
+	// True when `stats` were printed; the caller then starts a new interval by resetting its counters.
+	bool update( const RenderStats &stats );
+	void print( const RenderStats &stats ) const;
+};
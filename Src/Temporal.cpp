@@ -0,0 +1,163 @@
+#include "Renderer.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+const uint64_t NO_HISTORY = ~uint64_t( 0 );
+
+// Positive floats order like their bit patterns, so a key with the distance in its high half sorts
+// nearest first.
+inline uint64_t historyKey( float distance, uint32_t pixel )
+{
+	uint32_t bits;
+	std::memcpy( &bits, &distance, sizeof( bits ) );
+	return uint64_t( bits ) << 32 | pixel;
+}
+
+inline float keyDistance( uint64_t key )
+{
+	uint32_t bits = uint32_t( key >> 32 );
+	float    distance;
+	std::memcpy( &distance, &bits, sizeof( distance ) );
+	return distance;
+}
+
+inline void atomicMin( uint64_t &slot, uint64_t key )
+{
+	uint64_t current = __atomic_load_n( &slot, __ATOMIC_RELAXED );
+	while ( key < current &&
+	        !__atomic_compare_exchange_n( &slot, &current, key, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+	{
+	}
+}
+
+} // namespace
+
+void Renderer::reproject( const Camera &previous, const Camera &camera )
+{
+	const int   width      = settings.width;
+	const int   height     = settings.height;
+	const int   pixelCount = width * height;
+	const float aspect     = float( width ) / height;
+	if ( int( historyKeys.size() ) != pixelCount )
+	{
+		historyAccum.resize( pixelCount );
+		historySquares.resize( pixelCount );
+		historySamples.resize( pixelCount );
+		historyFeatures.resize( pixelCount );
+		historyKeys.resize( pixelCount );
+	}
+
+	pool.parallelFor( height,
+	                  [&]( int y, int )
+	                  {
+		                  std::fill( &historyKeys[y * width], &historyKeys[( y + 1 ) * width], NO_HISTORY );
+	                  } );
+
+	// scatter: the first hit through each pixel centre, at the pixel's mean depth, lands on the pixel of the
+	// new view it projects to; the nearest of several wins
+	pool.parallelFor( height,
+	                  [&]( int y, int )
+	                  {
+		                  for ( int x = 0; x < width; x++ )
+		                  {
+			                  int      i = y * width + x;
+			                  uint32_t n = pixelSamples[i];
+			                  if ( n == 0 )
+				                  continue;
+
+			                  float u     = ( ( x + 0.5f ) / width * 2 - 1 ) * aspect;
+			                  float v     = -( ( y + 0.5f ) / height * 2 - 1 );
+			                  Ray   ray   = previous.getRay( u, v );
+			                  Vec3  point = ray.origin + ray.dir * ( features[i].depth / n );
+
+			                  Vec3  toPoint = point - camera.position;
+			                  float z       = toPoint.dot( camera.forward );
+			                  if ( z <= 1e-4f )
+				                  continue;
+			                  float tx = ( toPoint.dot( camera.right ) / z / aspect + 1 ) * 0.5f * width;
+			                  float ty = ( 1 - toPoint.dot( camera.up ) / z ) * 0.5f * height;
+			                  if ( !( tx >= 0.0f && tx < width && ty >= 0.0f && ty < height ) )
+				                  continue;
+			                  atomicMin( historyKeys[int( ty ) * width + int( tx )],
+			                             historyKey( toPoint.length(), i ) );
+		                  }
+	                  } );
+
+	// gather: every pixel copies the history that landed on it, or the nearest of its neighbours' where
+	// nothing did (the view moved closer or a surface turned towards it), scaled down to the history cap
+	pool.parallelFor(
+	    height,
+	    [&]( int y, int )
+	    {
+		    for ( int x = 0; x < width; x++ )
+		    {
+			    int      i       = y * width + x;
+			    uint64_t key     = historyKeys[i];
+			    int      maxKept = TEMPORAL_MAX_HISTORY;
+			    if ( key == NO_HISTORY )
+			    {
+				    for ( int qy = std::max( y - 1, 0 ); qy <= std::min( y + 1, height - 1 ); qy++ )
+				    {
+					    for ( int qx = std::max( x - 1, 0 ); qx <= std::min( x + 1, width - 1 ); qx++ )
+						    key = std::min( key, historyKeys[qy * width + qx] );
+				    }
+				    maxKept = TEMPORAL_HOLE_HISTORY;
+			    }
+
+			    reprojected[i] = key != NO_HISTORY;
+			    if ( key == NO_HISTORY )
+			    {
+				    historyAccum[i]    = Vec3( 0 );
+				    historySquares[i]  = 0.0f;
+				    historySamples[i]  = 0;
+				    historyFeatures[i] = PixelFeatures();
+				    continue;
+			    }
+
+			    uint32_t source = uint32_t( key );
+			    uint32_t n      = pixelSamples[source];
+			    uint32_t kept   = std::min( n, uint32_t( maxKept ) );
+			    float    scale  = float( kept ) / n;
+
+			    historyAccum[i]           = accum[source] * scale;
+			    historySquares[i]         = accumSquares[source] * scale;
+			    historySamples[i]         = kept;
+			    historyFeatures[i].albedo = features[source].albedo * scale;
+			    historyFeatures[i].normal = features[source].normal * scale;
+			    historyFeatures[i].depth  = keyDistance( key ) * kept;
+		    }
+	    } );
+
+	accum.swap( historyAccum );
+	accumSquares.swap( historySquares );
+	pixelSamples.swap( historySamples );
+	features.swap( historyFeatures );
+
+	// per-pixel counts no longer agree within a tile; adaptive sampling judges every tile afresh
+	std::fill( tileSamples.begin(), tileSamples.end(), 1 );
+	convergedTiles = 0;
+}
+
+// Drops the reprojected history of pixel `idx` when the first new sample through it hits something else:
+// a surface the old view did not see, or one at a different depth or angle.
+void Renderer::validateHistory( int idx, const PixelFeatures &sample )
+{
+	reprojected[idx] = 0;
+
+	uint32_t             n       = pixelSamples[idx];
+	const PixelFeatures &history = features[idx];
+	float                depth   = history.depth / n;
+	bool depthMatches  = std::abs( depth - sample.depth ) <= TEMPORAL_DEPTH_TOLERANCE * sample.depth;
+	bool normalMatches = history.normal.dot( sample.normal ) >=
+	                     TEMPORAL_MIN_NORMAL_COSINE * history.normal.length() * sample.normal.length();
+	if ( depthMatches && normalMatches )
+		return;
+
+	accum[idx]        = Vec3( 0 );
+	accumSquares[idx] = 0.0f;
+	pixelSamples[idx] = 0;
+	features[idx]     = PixelFeatures();
+}
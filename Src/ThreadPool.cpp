@@ -0,0 +1,179 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+void WorkDeque::reset()
+{
+	top.store( 0, std::memory_order_relaxed );
+	bottom.store( items.size(), std::memory_order_relaxed );
+}
+
+bool WorkDeque::pop( int &item )
+{
+	int64_t b = bottom.load( std::memory_order_relaxed ) - 1;
+	bottom.store( b, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	int64_t t = top.load( std::memory_order_relaxed );
+
+	if ( t > b )
+	{
+		bottom.store( b + 1, std::memory_order_relaxed );
+		return false;
+	}
+
+	item = items[b];
+	if ( t == b )
+	{
+		// last item: race the thieves for it
+		bool won =
+		    top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed );
+		bottom.store( b + 1, std::memory_order_relaxed );
+		return won;
+	}
+	return true;
+}
+
+bool WorkDeque::steal( int &item )
+{
+	int64_t t = top.load( std::memory_order_acquire );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	int64_t b = bottom.load( std::memory_order_acquire );
+	if ( t >= b )
+		return false;
+
+	int candidate = items[t];
+	if ( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+		return false;
+
+	item = candidate;
+	return true;
+}
+
+bool WorkDeque::empty() const
+{
+	return top.load( std::memory_order_acquire ) >= bottom.load( std::memory_order_acquire );
+}
+
+ThreadPool::ThreadPool( int threadCount ) : workerCount( std::max( 1, threadCount ) )
+{
+	for ( int i = 0; i < workerCount; i++ )
+	{
+		deques.push_back( std::make_unique<WorkDeque>() );
+	}
+
+	for ( int i = 1; i < workerCount; i++ )
+	{
+		threads.emplace_back( &ThreadPool::workerLoop, this, i );
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for ( auto &thread : threads )
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::parallelFor( int count, const std::function<void( int index, int worker )> &job )
+{
+	if ( count <= 0 )
+		return;
+
+	// workers are parked, so the deques can be refilled without synchronisation
+	for ( int w = 0; w < workerCount; w++ )
+	{
+		int begin = int( int64_t( count ) * w / workerCount );
+		int end   = int( int64_t( count ) * ( w + 1 ) / workerCount );
+
+		WorkDeque &deque = *deques[w];
+		deque.items.clear();
+		for ( int i = end - 1; i >= begin; i-- )
+		{
+			deque.items.push_back( i ); // popped from the back, so each worker walks its run in order
+		}
+		deque.reset();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		currentJob = &job;
+		busy       = workerCount - 1;
+		generation++;
+	}
+	wake.notify_all();
+
+	runJob( 0 );
+
+	std::unique_lock<std::mutex> lock( mutex );
+	done.wait( lock, [this] { return busy == 0; } );
+	currentJob = nullptr;
+}
+
+void ThreadPool::workerLoop( int worker )
+{
+	uint64_t seen = 0;
+	while ( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			wake.wait( lock, [&] { return stopping || generation != seen; } );
+			if ( stopping )
+				return;
+			seen = generation;
+		}
+
+		runJob( worker );
+
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			busy--;
+		}
+		done.notify_one();
+	}
+}
+
+void ThreadPool::runJob( int worker )
+{
+	const auto &job = *currentJob;
+	int         item;
+
+	while ( true )
+	{
+		while ( deques[worker]->pop( item ) )
+		{
+			job( item, worker );
+		}
+
+		// own run is done: steal from the others until every deque is seen empty
+		bool stole    = false;
+		bool allEmpty = true;
+		for ( int i = 1; i < workerCount && !stole; i++ )
+		{
+			WorkDeque &victim = *deques[( worker + i ) % workerCount];
+			if ( victim.steal( item ) )
+			{
+				job( item, worker );
+				stole = true;
+			}
+			else if ( !victim.empty() )
+			{
+				allEmpty = false; // lost a race, there is still work there
+			}
+		}
+
+		if ( !stole && allEmpty )
+			return;
+	}
+}
+
+int defaultThreadCount()
+{
+	return std::max( 1u, std::thread::hardware_concurrency() );
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work queue owned by one worker (Chase-Lev): the owner pops from the bottom, idle workers steal from
+// the top. Items are filled in before a job starts and never pushed while it runs.
+struct WorkDeque
+{
+	std::vector<int>     items;
+	std::atomic<int64_t> top{ 0 };
+	std::atomic<int64_t> bottom{ 0 };
+
+	void reset();
+	bool pop( int &item );
+	bool steal( int &item );
+	bool empty() const;
+};
+
+// Persistent workers created once for the whole process. The calling thread takes part as worker 0,
+// so a pool of size N runs N - 1 extra threads.
+class ThreadPool
+{
+  public:
+	explicit ThreadPool( int threadCount );
+	~ThreadPool();
+
+	ThreadPool( const ThreadPool & )            = delete;
+	ThreadPool &operator=( const ThreadPool & ) = delete;
+
+	int size() const
+	{
+		return workerCount;
+	}
+
+	// Runs job( index, worker ) for every index in [0, count) and returns once all of them finished.
+	// Indices are dealt out in contiguous runs, one per worker, and rebalanced by stealing.
+	void parallelFor( int count, const std::function<void( int index, int worker )> &job );
+
+  private:
+	void workerLoop( int worker );
+	void runJob( int worker );
+
+	int                                     workerCount;
+	std::vector<std::unique_ptr<WorkDeque>> deques;
+	std::vector<std::thread>                threads;
+
+	const std::function<void( int, int )> *currentJob = nullptr;
+
+	std::mutex              mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t                generation = 0;
+	int                     busy       = 0;
+	bool                    stopping   = false;
+};
+
+// Number of workers to use when none is requested: every hardware thread.
+int defaultThreadCount();
@@ -0,0 +1,150 @@
+#include "Tonemap.hpp"
+
+#include <array>
+#include <cmath>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define TONEMAP_SSE 1
+#include <immintrin.h>
+#else
+#define TONEMAP_SSE 0
+#endif
+
+namespace
+{
+
+// Coefficients of the ACES fit a * x^2 + b * x over c * x^2 + d * x + e.
+const float ACES_A = 2.51f, ACES_B = 0.03f, ACES_C = 2.43f, ACES_D = 0.59f, ACES_E = 0.14f;
+
+const std::array<uint8_t, GAMMA_LUT_SIZE> &gammaTable()
+{
+	static const std::array<uint8_t, GAMMA_LUT_SIZE> table = []
+	{
+		std::array<uint8_t, GAMMA_LUT_SIZE> entries;
+		for ( int i = 0; i < GAMMA_LUT_SIZE; i++ )
+		{
+			entries[i] = uint8_t( std::pow( float( i ) / ( GAMMA_LUT_SIZE - 1 ), 1 / 2.2f ) * 255 + 0.5f );
+		}
+		return entries;
+	}();
+	return table;
+}
+
+// Display-linear value of one channel, not yet clamped to 1. Written so that NaNs come out as 0 or 1
+// like in the SSE path.
+inline float tonemapChannel( Tonemap tonemap, float x )
+{
+	x = x > 0.0f ? x : 0.0f;
+	if ( tonemap == Tonemap::REINHARD )
+		return x / ( 1.0f + x );
+	if ( tonemap == Tonemap::ACES )
+		return x * ( ACES_A * x + ACES_B ) / ( x * ( ACES_C * x + ACES_D ) + ACES_E );
+	return x;
+}
+
+inline uint32_t encodeChannel( const uint8_t *table, float x )
+{
+	x = x < 1.0f ? x : 1.0f;
+	return table[int( x * ( GAMMA_LUT_SIZE - 1 ) + 0.5f )];
+}
+
+#if TONEMAP_SSE
+
+inline __m128 scaleAdd( __m128 x, float scale, float offset )
+{
+	return _mm_add_ps( _mm_mul_ps( x, _mm_set1_ps( scale ) ), _mm_set1_ps( offset ) );
+}
+
+// _mm_max_ps and _mm_min_ps return their second operand for NaN lanes.
+inline __m128 tonemapLanes( Tonemap tonemap, __m128 x )
+{
+	x = _mm_max_ps( x, _mm_setzero_ps() );
+	if ( tonemap == Tonemap::REINHARD )
+		return _mm_div_ps( x, _mm_add_ps( _mm_set1_ps( 1.0f ), x ) );
+	if ( tonemap == Tonemap::ACES )
+	{
+		__m128 numerator   = _mm_mul_ps( x, scaleAdd( x, ACES_A, ACES_B ) );
+		__m128 denominator = scaleAdd( _mm_mul_ps( x, scaleAdd( x, ACES_C, ACES_D ) ), 1.0f, ACES_E );
+		return _mm_div_ps( numerator, denominator );
+	}
+	return x;
+}
+
+// Table indices of four display-linear values; _mm_cvtps_epi32 rounds to nearest.
+inline __m128i tableIndices( __m128 x )
+{
+	x = _mm_min_ps( x, _mm_set1_ps( 1.0f ) );
+	return _mm_cvtps_epi32( _mm_mul_ps( x, _mm_set1_ps( GAMMA_LUT_SIZE - 1 ) ) );
+}
+
+// Four pixels per iteration: their twelve floats are loaded as three vectors and shuffled into one vector
+// per channel, tonemapped and turned into table indices, which are looked up one by one as SSE has no
+// gather. Returns how many pixels it wrote.
+int tonemapPixelsSSE( Tonemap tonemap, const Vec3 *colors, uint32_t *pixels, int count, const uint8_t *table )
+{
+	static_assert( sizeof( Vec3 ) == 3 * sizeof( float ), "Vec3 must be three packed floats" );
+
+	int i = 0;
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		const float *source = &colors[i].x;
+		__m128       v0     = _mm_loadu_ps( source );     // r0 g0 b0 r1
+		__m128       v1     = _mm_loadu_ps( source + 4 ); // g1 b1 r2 g2
+		__m128       v2     = _mm_loadu_ps( source + 8 ); // b2 r3 g3 b3
+
+		__m128 r01 = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE( 0, 0, 3, 0 ) ); // r0 r1 g1 g1
+		__m128 r23 = _mm_shuffle_ps( v1, v2, _MM_SHUFFLE( 0, 1, 2, 2 ) ); // r2 r2 r3 b2
+		__m128 g01 = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE( 0, 0, 0, 1 ) ); // g0 r0 g1 g1
+		__m128 g23 = _mm_shuffle_ps( v1, v2, _MM_SHUFFLE( 2, 2, 3, 3 ) ); // g2 g2 g3 g3
+		__m128 b01 = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE( 1, 1, 2, 2 ) ); // b0 b0 b1 b1
+		__m128 b23 = _mm_shuffle_ps( v2, v2, _MM_SHUFFLE( 3, 3, 0, 0 ) ); // b2 b2 b3 b3
+
+		__m128 r = _mm_shuffle_ps( r01, r23, _MM_SHUFFLE( 2, 0, 1, 0 ) );
+		__m128 g = _mm_shuffle_ps( g01, g23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+		__m128 b = _mm_shuffle_ps( b01, b23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+
+		alignas( 16 ) int32_t red[4], green[4], blue[4];
+		_mm_store_si128( reinterpret_cast<__m128i *>( red ), tableIndices( tonemapLanes( tonemap, r ) ) );
+		_mm_store_si128( reinterpret_cast<__m128i *>( green ), tableIndices( tonemapLanes( tonemap, g ) ) );
+		_mm_store_si128( reinterpret_cast<__m128i *>( blue ), tableIndices( tonemapLanes( tonemap, b ) ) );
+		for ( int lane = 0; lane < 4; lane++ )
+		{
+			pixels[i + lane] = table[red[lane]] << 16 | table[green[lane]] << 8 | table[blue[lane]];
+		}
+	}
+	return i;
+}
+
+#endif
+
+} // namespace
+
+const char *tonemapName( Tonemap tonemap )
+{
+	switch ( tonemap )
+	{
+	case Tonemap::REINHARD:
+		return "reinhard";
+	case Tonemap::ACES:
+		return "aces";
+	default:
+		return "clamp";
+	}
+}
+
+void tonemapPixels( Tonemap tonemap, const Vec3 *colors, uint32_t *pixels, int count )
+{
+	const uint8_t *table = gammaTable().data();
+
+	int i = 0;
+#if TONEMAP_SSE
+	i = tonemapPixelsSSE( tonemap, colors, pixels, count, table );
+#endif
+	for ( ; i < count; i++ )
+	{
+		uint32_t r = encodeChannel( table, tonemapChannel( tonemap, colors[i].x ) );
+		uint32_t g = encodeChannel( table, tonemapChannel( tonemap, colors[i].y ) );
+		uint32_t b = encodeChannel( table, tonemapChannel( tonemap, colors[i].z ) );
+		pixels[i]  = r << 16 | g << 8 | b;
+	}
+}
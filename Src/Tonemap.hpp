@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Math.hpp"
+
+// Display-linear values are gamma-encoded through a table of GAMMA_LUT_SIZE entries over [0, 1].
+const int GAMMA_LUT_SIZE = 1 << 14;
+
+// How linear radiance is brought into [0, 1] before gamma: CLAMP cuts everything above 1, REINHARD maps
+// x to x / (1 + x) per channel, ACES follows the filmic curve of the ACES reference transform (Narkowicz's
+// fit), with a toe and a soft shoulder.
+enum class Tonemap
+{
+	CLAMP,
+	REINHARD,
+	ACES,
+};
+const int TONEMAP_COUNT = 3;
+
+const char *tonemapName( Tonemap tonemap );
+
+// Tonemaps `count` linear radiances and writes them gamma-corrected (1 / 2.2) as 0x00RRGGBB, four at a
+// time with SSE where available.
+void tonemapPixels( Tonemap tonemap, const Vec3 *colors, uint32_t *pixels, int count );
@@ -0,0 +1,203 @@
+#include "TrianglePacket.hpp"
+#include "Stats.hpp"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define TRIANGLE_PACKET_SSE 1
+#include <immintrin.h>
+#else
+#define TRIANGLE_PACKET_SSE 0
+#endif
+
+namespace
+{
+
+void fillHit( const Triangle &tri, float t, Hit &hit )
+{
+	hit.t          = t;
+	hit.normal     = tri.normal;
+	hit.color      = tri.color;
+	hit.reflective = tri.reflective;
+	hit.emission   = tri.emission;
+}
+
+bool intersectTriangleRangeScalar( const Ray      &ray,
+                                   const Triangle *triangles,
+                                   uint32_t        offset,
+                                   uint32_t        count,
+                                   Hit            &hit )
+{
+	uint32_t best  = offset + count;
+	float    bestT = hit.t;
+	for ( uint32_t i = offset; i < offset + count; i++ )
+	{
+		float t;
+		if ( intersectTriangle( ray, triangles[i], t ) && t < bestT )
+		{
+			bestT = t;
+			best  = i;
+		}
+	}
+
+	if ( best == offset + count )
+		return false;
+
+	fillHit( triangles[best], bestT, hit );
+	return true;
+}
+
+#if TRIANGLE_PACKET_SSE
+
+inline __m128 dot3( __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz )
+{
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ), _mm_mul_ps( az, bz ) );
+}
+
+inline __m128 select( __m128 mask, __m128 a, __m128 b )
+{
+	return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+// Same arithmetic, in the same order, as the scalar intersectTriangle() so both kernels agree; each lane
+// keeps its own closest candidate and the lanes are reduced once at the end of the range.
+bool intersectTriangleRangeSSE( const Ray            &ray,
+                                const Triangle       *triangles,
+                                const TrianglePacket *packets,
+                                uint32_t              offset,
+                                uint32_t              count,
+                                Hit                  &hit )
+{
+	const float  EPSILON = 0.0000001f;
+	const __m128 eps     = _mm_set1_ps( EPSILON );
+	const __m128 negEps  = _mm_set1_ps( -EPSILON );
+	const __m128 zero    = _mm_setzero_ps();
+	const __m128 one     = _mm_set1_ps( 1.0f );
+
+	const __m128 dx = _mm_set1_ps( ray.dir.x );
+	const __m128 dy = _mm_set1_ps( ray.dir.y );
+	const __m128 dz = _mm_set1_ps( ray.dir.z );
+	const __m128 ox = _mm_set1_ps( ray.origin.x );
+	const __m128 oy = _mm_set1_ps( ray.origin.y );
+	const __m128 oz = _mm_set1_ps( ray.origin.z );
+
+	const __m128i laneIdx = _mm_setr_epi32( 0, 1, 2, 3 );
+
+	__m128  bestT   = _mm_set1_ps( hit.t );
+	__m128i bestIdx = _mm_set1_epi32( -1 );
+
+	uint32_t end = offset + count;
+	for ( uint32_t p = offset / 4; p <= ( end - 1 ) / 4; p++ )
+	{
+		const TrianglePacket &packet = packets[p];
+
+		// lanes of this packet that belong to the requested range
+		__m128i first   = _mm_set1_epi32( int( std::max( offset, p * 4 ) - p * 4 ) );
+		__m128i last    = _mm_set1_epi32( int( std::min( end, p * 4 + 4 ) - p * 4 ) );
+		__m128i inRange =
+		    _mm_andnot_si128( _mm_cmplt_epi32( laneIdx, first ), _mm_cmplt_epi32( laneIdx, last ) );
+
+		__m128 e1x = _mm_load_ps( packet.edge1[0] );
+		__m128 e1y = _mm_load_ps( packet.edge1[1] );
+		__m128 e1z = _mm_load_ps( packet.edge1[2] );
+		__m128 e2x = _mm_load_ps( packet.edge2[0] );
+		__m128 e2y = _mm_load_ps( packet.edge2[1] );
+		__m128 e2z = _mm_load_ps( packet.edge2[2] );
+
+		// h = dir x edge2, a = edge1 . h
+		__m128 hx = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+		__m128 hy = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+		__m128 hz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+		__m128 a  = dot3( e1x, e1y, e1z, hx, hy, hz );
+
+		__m128 valid = _mm_or_ps( _mm_cmple_ps( a, negEps ), _mm_cmpge_ps( a, eps ) );
+		valid        = _mm_and_ps( valid, _mm_castsi128_ps( inRange ) );
+
+		__m128 f  = _mm_div_ps( one, a );
+		__m128 sx = _mm_sub_ps( ox, _mm_load_ps( packet.v0[0] ) );
+		__m128 sy = _mm_sub_ps( oy, _mm_load_ps( packet.v0[1] ) );
+		__m128 sz = _mm_sub_ps( oz, _mm_load_ps( packet.v0[2] ) );
+		__m128 u  = _mm_mul_ps( f, dot3( sx, sy, sz, hx, hy, hz ) );
+		valid     = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( u, zero ), _mm_cmple_ps( u, one ) ) );
+
+		// q = s x edge1
+		__m128 qx = _mm_sub_ps( _mm_mul_ps( sy, e1z ), _mm_mul_ps( sz, e1y ) );
+		__m128 qy = _mm_sub_ps( _mm_mul_ps( sz, e1x ), _mm_mul_ps( sx, e1z ) );
+		__m128 qz = _mm_sub_ps( _mm_mul_ps( sx, e1y ), _mm_mul_ps( sy, e1x ) );
+		__m128 v  = _mm_mul_ps( f, dot3( dx, dy, dz, qx, qy, qz ) );
+		valid     = _mm_and_ps( valid, _mm_cmpge_ps( v, zero ) );
+		valid     = _mm_and_ps( valid, _mm_cmple_ps( _mm_add_ps( u, v ), one ) );
+
+		__m128 t = _mm_mul_ps( f, dot3( e2x, e2y, e2z, qx, qy, qz ) );
+		valid    = _mm_and_ps( valid, _mm_and_ps( _mm_cmpgt_ps( t, eps ), _mm_cmplt_ps( t, bestT ) ) );
+
+		__m128 idx = _mm_castsi128_ps( _mm_add_epi32( _mm_set1_epi32( int( p * 4 ) ), laneIdx ) );
+		bestT      = select( valid, t, bestT );
+		bestIdx    = _mm_castps_si128( select( valid, idx, _mm_castsi128_ps( bestIdx ) ) );
+	}
+
+	// horizontal min, then the lowest lane holding it
+	__m128 minT  = _mm_min_ps( bestT, _mm_shuffle_ps( bestT, bestT, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	minT         = _mm_min_ps( minT, _mm_shuffle_ps( minT, minT, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	__m128 empty = _mm_castsi128_ps( _mm_cmpeq_epi32( bestIdx, _mm_set1_epi32( -1 ) ) );
+	__m128 found = _mm_andnot_ps( empty, _mm_cmpeq_ps( bestT, minT ) );
+
+	int lanes = _mm_movemask_ps( found );
+	if ( lanes == 0 )
+		return false;
+
+	alignas( 16 ) int32_t indices[4];
+	_mm_store_si128( reinterpret_cast<__m128i *>( indices ), bestIdx );
+	fillHit( triangles[indices[__builtin_ctz( lanes )]], _mm_cvtss_f32( minT ), hit );
+	return true;
+}
+
+#endif
+
+} // namespace
+
+void packTriangles( const std::vector<Triangle> &triangles, std::vector<TrianglePacket> &packets )
+{
+	packets.clear();
+#if TRIANGLE_PACKET_SSE
+	packets.resize( ( triangles.size() + 3 ) / 4 );
+	repackTriangles( triangles, packets, 0, packets.size() );
+	packets.shrink_to_fit();
+#endif
+}
+
+void repackTriangles( const std::vector<Triangle>  &triangles,
+                      std::vector<TrianglePacket> &packets,
+                      size_t                       firstPacket,
+                      size_t                       endPacket )
+{
+	size_t end = std::min( endPacket * 4, triangles.size() );
+	for ( size_t i = firstPacket * 4; i < end && i / 4 < packets.size(); i++ )
+	{
+		const Triangle &tri    = triangles[i];
+		TrianglePacket &packet = packets[i / 4];
+		int             lane   = i % 4;
+
+		Vec3 edge1 = tri.v1 - tri.v0;
+		Vec3 edge2 = tri.v2 - tri.v0;
+		for ( int axis = 0; axis < 3; axis++ )
+		{
+			packet.v0[axis][lane]    = tri.v0[axis];
+			packet.edge1[axis][lane] = edge1[axis];
+			packet.edge2[axis][lane] = edge2[axis];
+		}
+	}
+}
+
+bool intersectTriangleRange( const Ray            &ray,
+                             const Triangle       *triangles,
+                             const TrianglePacket *packets,
+                             uint32_t              offset,
+                             uint32_t              count,
+                             Hit                  &hit )
+{
+	STATS_ADD( triangleTests, count );
+#if TRIANGLE_PACKET_SSE
+	if ( packets )
+		return intersectTriangleRangeSSE( ray, triangles, packets, offset, count, hit );
+#endif
+	return intersectTriangleRangeScalar( ray, triangles, offset, count, hit );
+}
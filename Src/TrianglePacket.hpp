@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Math.hpp"
+
+// Four consecutive triangles of a BVH-ordered array in SoA form with precomputed edges; packet p covers
+// triangles [4p, 4p + 4). Lanes past the end of the array have zero edges and never report a hit.
+struct alignas( 16 ) TrianglePacket
+{
+	float v0[3][4];
+	float edge1[3][4];
+	float edge2[3][4];
+};
+
+// Fills `packets` for `triangles`, or leaves it empty when there is no SIMD kernel for this CPU.
+void packTriangles( const std::vector<Triangle> &triangles, std::vector<TrianglePacket> &packets );
+
+// Rewrites packets [firstPacket, endPacket) of a packTriangles() result in place after the triangles
+// moved; the triangle count must be unchanged. Does nothing when `packets` is empty.
+void repackTriangles( const std::vector<Triangle>  &triangles,
+                      std::vector<TrianglePacket> &packets,
+                      size_t                       firstPacket,
+                      size_t                       endPacket );
+
+// Closest hit among triangles [offset, offset + count), the leaf test shared by all triangle BVHs.
+// Uses the packed kernel when `packets` is given and the scalar loop over `triangles` otherwise.
+bool intersectTriangleRange( const Ray            &ray,
+                             const Triangle       *triangles,
+                             const TrianglePacket *packets,
+                             uint32_t              offset,
+                             uint32_t              count,
+                             Hit                  &hit );
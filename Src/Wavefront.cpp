@@ -0,0 +1,450 @@
+#include "Renderer.hpp"
+#include "Shading.hpp"
+
+#include <chrono>
+
+namespace
+{
+
+// paths per job in every wavefront stage, and primary packets per job when generating them
+const int WAVEFRONT_CHUNK        = 4096;
+const int WAVEFRONT_BLOCK_CHUNK  = 16;
+const int DIRECTION_OCTANT_COUNT = 8;
+const int PATH_ENDED             = DIRECTION_OCTANT_COUNT; // bounce key of paths Russian roulette ended
+
+// Sorting key of a bounce ray. Rays leaving in the same octant tend to visit the same BVH nodes, so
+// tracing them next to each other keeps those nodes in cache.
+inline uint8_t directionOctant( const Vec3 &dir )
+{
+	return ( dir.x < 0.0f ) | ( dir.y < 0.0f ) << 1 | ( dir.z < 0.0f ) << 2;
+}
+
+inline uint8_t pathKind( bool hit, const Hit &closestHit )
+{
+	if ( !hit )
+		return PATH_MISS;
+	return closestHit.reflective ? PATH_REFLECTIVE : PATH_DIFFUSE;
+}
+
+} // namespace
+
+void PathQueue::resize( int capacity )
+{
+	for ( std::vector<float> *field : { &originX,
+	                                    &originY,
+	                                    &originZ,
+	                                    &dirX,
+	                                    &dirY,
+	                                    &dirZ,
+	                                    &throughputX,
+	                                    &throughputY,
+	                                    &throughputZ,
+	                                    &bsdfPdf } )
+	{
+		field->resize( capacity );
+	}
+	pixel.resize( capacity );
+	size = 0;
+}
+
+void PathQueue::set( int i, const Ray &ray, const Vec3 &throughput, float pdf, uint32_t pixelIndex )
+{
+	originX[i]     = ray.origin.x;
+	originY[i]     = ray.origin.y;
+	originZ[i]     = ray.origin.z;
+	dirX[i]        = ray.dir.x;
+	dirY[i]        = ray.dir.y;
+	dirZ[i]        = ray.dir.z;
+	throughputX[i] = throughput.x;
+	throughputY[i] = throughput.y;
+	throughputZ[i] = throughput.z;
+	bsdfPdf[i]     = pdf;
+	pixel[i]       = pixelIndex;
+}
+
+void PathQueue::copy( int to, const PathQueue &other, int from )
+{
+	originX[to]     = other.originX[from];
+	originY[to]     = other.originY[from];
+	originZ[to]     = other.originZ[from];
+	dirX[to]        = other.dirX[from];
+	dirY[to]        = other.dirY[from];
+	dirZ[to]        = other.dirZ[from];
+	throughputX[to] = other.throughputX[from];
+	throughputY[to] = other.throughputY[from];
+	throughputZ[to] = other.throughputZ[from];
+	bsdfPdf[to]     = other.bsdfPdf[from];
+	pixel[to]       = other.pixel[from];
+}
+
+void ShadowQueue::resize( int capacity )
+{
+	for ( std::vector<float> *field :
+	      { &originX, &originY, &originZ, &dirX, &dirY, &dirZ, &maxT, &radianceX, &radianceY, &radianceZ } )
+	{
+		field->resize( capacity );
+	}
+	pixel.resize( capacity );
+	size = 0;
+}
+
+void ShadowQueue::set( int i, const Ray &ray, float distance, const Vec3 &contribution, uint32_t pixelIndex )
+{
+	originX[i]   = ray.origin.x;
+	originY[i]   = ray.origin.y;
+	originZ[i]   = ray.origin.z;
+	dirX[i]      = ray.dir.x;
+	dirY[i]      = ray.dir.y;
+	dirZ[i]      = ray.dir.z;
+	maxT[i]      = distance;
+	radianceX[i] = contribution.x;
+	radianceY[i] = contribution.y;
+	radianceZ[i] = contribution.z;
+	pixel[i]     = pixelIndex;
+}
+
+// Runs job( begin, end, worker ) over [0, count) in `chunkSize` slices on the pool. Every slice is
+// counted as a tile in the statistics, so idle time is reported the same way for both integrators.
+void Renderer::forEachChunk( int count, int chunkSize, const std::function<void( int, int, int )> &job )
+{
+	int chunks = ( count + chunkSize - 1 ) / chunkSize;
+	pool.parallelFor( chunks,
+	                  [&]( int chunk, int worker )
+	                  {
+#if PATHTRACER_STATS
+		                  using Clock = std::chrono::steady_clock;
+		                  threadStats.reset();
+		                  auto chunkStart = Clock::now();
+#endif
+		                  job( chunk * chunkSize, std::min( count, ( chunk + 1 ) * chunkSize ), worker );
+#if PATHTRACER_STATS
+		                  double seconds = std::chrono::duration<double>( Clock::now() - chunkStart ).count();
+		                  threadStats.tiles          = 1;
+		                  threadStats.tileSeconds    = seconds;
+		                  threadStats.maxTileSeconds = seconds;
+		                  workerStats[worker].merge( threadStats );
+#endif
+	                  } );
+}
+
+void Renderer::renderFrameWavefront( const Camera &camera, const Scene &scene )
+{
+	const int pixelCount = settings.width * settings.height;
+	if ( int( paths.pixel.size() ) != pixelCount )
+	{
+		paths.resize( pixelCount );
+		nextPaths.resize( pixelCount );
+		shadows.resize( pixelCount );
+		pathHits.resize( pixelCount );
+		pathKeys.resize( pixelCount );
+		pathOrder.resize( pixelCount );
+		radiance.resize( pixelCount );
+		pathFeatures.resize( pixelCount );
+	}
+
+	generatePaths( camera, scene );
+	for ( int depth = 0; depth < settings.maxDepth && paths.size > 0; depth++ )
+	{
+		if ( depth > 0 || !settings.primaryPackets )
+			intersectPaths( scene, depth );
+		if ( depth == 0 )
+			forEachChunk( paths.size,
+			              WAVEFRONT_CHUNK,
+			              [this]( int begin, int end, int )
+			              {
+				              for ( int i = begin; i < end; i++ )
+				              {
+					              bool hit = pathKeys[i] != PATH_MISS;
+					              pathFeatures[paths.pixel[i]] =
+					                  firstHitFeatures( paths.ray( i ), hit, pathHits[i] );
+				              }
+			              } );
+		shadePaths( scene, depth );
+		traceShadows( scene );
+	}
+
+	forEachChunk( pixelCount,
+	              WAVEFRONT_CHUNK,
+	              [this]( int begin, int end, int )
+	              {
+		              for ( int i = begin; i < end; i++ )
+		              {
+			              if ( tileSamples[tileIndex( i % settings.width, i / settings.width )] )
+				              accumulatePixel( i, radiance[i], pathFeatures[i] );
+		              }
+	              } );
+}
+
+// Fills `paths` with one camera ray per pixel of every tile still sampling, RAY_PACKET_WIDTH^2 blocks
+// stored one after another so the first bounce is traced in screen-space order. With primary packets the
+// blocks are intersected right away as frustum-culled packets.
+void Renderer::generatePaths( const Camera &camera, const Scene &scene )
+{
+	const int blocksX = ( settings.width + RAY_PACKET_WIDTH - 1 ) / RAY_PACKET_WIDTH;
+	const int blocksY = ( settings.height + RAY_PACKET_WIDTH - 1 ) / RAY_PACKET_WIDTH;
+
+	// blocks never straddle tiles; the ones of converged tiles get no slots
+	blockSlots.resize( blocksX * blocksY + 1 );
+	uint32_t slots = 0;
+	for ( int block = 0; block < blocksX * blocksY; block++ )
+	{
+		int x0            = ( block % blocksX ) * RAY_PACKET_WIDTH;
+		int y0            = ( block / blocksX ) * RAY_PACKET_WIDTH;
+		blockSlots[block] = slots;
+		if ( tileSamples[tileIndex( x0, y0 )] )
+			slots += std::min( RAY_PACKET_WIDTH, settings.width - x0 ) *
+			         std::min( RAY_PACKET_WIDTH, settings.height - y0 );
+	}
+	blockSlots[blocksX * blocksY] = slots;
+
+	forEachChunk(
+	    blocksX * blocksY,
+	    WAVEFRONT_BLOCK_CHUNK,
+	    [&]( int begin, int end, int worker )
+	    {
+		    RayPacket packet;
+		    Hit       hits[RAY_PACKET_SIZE];
+		    for ( int block = begin; block < end; block++ )
+		    {
+			    int base = blockSlots[block];
+			    if ( blockSlots[block + 1] == uint32_t( base ) )
+				    continue;
+			    int x0     = ( block % blocksX ) * RAY_PACKET_WIDTH;
+			    int y0     = ( block / blocksX ) * RAY_PACKET_WIDTH;
+			    int width  = std::min( RAY_PACKET_WIDTH, settings.width - x0 );
+			    int height = std::min( RAY_PACKET_WIDTH, settings.height - y0 );
+			    makePrimaryPacket( camera, x0, y0, x0 + width, y0 + height, workerRngs[worker], packet );
+
+			    uint64_t hitMask = 0;
+			    if ( settings.primaryPackets )
+			    {
+				    intersectScenePacket( packet, scene, hits, hitMask );
+				    workerRays[worker] += __builtin_popcountll( packet.active );
+				    STATS_ADD( raysByDepth[0], __builtin_popcountll( packet.active ) );
+				    STATS_ADD( hits, __builtin_popcountll( packet.active & hitMask ) );
+				    STATS_ADD( misses, __builtin_popcountll( packet.active & ~hitMask ) );
+			    }
+
+			    for ( uint64_t lanes = packet.active; lanes; lanes &= lanes - 1 )
+			    {
+				    int      lane  = __builtin_ctzll( lanes );
+				    int      x     = lane % RAY_PACKET_WIDTH;
+				    int      y     = lane / RAY_PACKET_WIDTH;
+				    int      slot  = base + y * width + x;
+				    uint32_t pixel = ( y0 + y ) * settings.width + x0 + x;
+				    paths.set( slot, packet.rays[lane], Vec3( 1.0f ), 0.0f, pixel );
+				    radiance[pixel] = Vec3( 0 );
+				    if ( settings.primaryPackets )
+				    {
+					    pathHits[slot] = hits[lane];
+					    pathKeys[slot] = pathKind( ( hitMask >> lane ) & 1, hits[lane] );
+				    }
+			    }
+		    }
+	    } );
+	paths.size = slots;
+}
+
+void Renderer::intersectPaths( const Scene &scene, int depth )
+{
+	forEachChunk( paths.size,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int worker )
+	              {
+		              for ( int i = begin; i < end; i++ )
+		              {
+			              bool hit    = intersectScene( paths.ray( i ), scene, pathHits[i] );
+			              pathKeys[i] = pathKind( hit, pathHits[i] );
+			              STATS_ADD( hits, hit );
+			              STATS_ADD( misses, !hit );
+		              }
+		              workerRays[worker] += end - begin;
+		              STATS_ADD( raysByDepth[std::min( depth, STATS_DEPTH_BUCKETS - 1 )], end - begin );
+	              } );
+}
+
+// Groups the intersected paths by kind and runs one loop per group: misses add their throughput times the
+// sky to their pixel, hits add what they emit and bounce into `nextPaths`, which is then sorted by
+// direction back into `paths` for the next depth. Diffuse hits also queue a shadow ray to a light sample.
+void Renderer::shadePaths( const Scene &scene, int depth )
+{
+	uint32_t groupStart[PATH_KIND_COUNT + 1];
+	sortPaths( paths.size, PATH_KIND_COUNT, groupStart );
+
+	const int missEnd       = groupStart[PATH_MISS + 1];
+	const int reflectiveEnd = groupStart[PATH_REFLECTIVE + 1];
+	const int diffuseEnd    = groupStart[PATH_DIFFUSE + 1];
+
+	forEachChunk( missEnd,
+	              WAVEFRONT_CHUNK,
+	              [this]( int begin, int end, int )
+	              {
+		              const Vec3 sky = skyColor();
+		              for ( int i = begin; i < end; i++ )
+		              {
+			              uint32_t path = pathOrder[i];
+			              radiance[paths.pixel[path]] += paths.throughput( path ) * sky;
+		              }
+	              } );
+
+	// a bounce past the last depth would only contribute black, and so would a light sample taken for it:
+	// the last hits only add what they emit
+	const bool lastDepth = depth + 1 >= settings.maxDepth;
+
+	auto emit = [&]( uint32_t path, const Hit &hit, const Vec3 &dir )
+	{
+		Vec3 emitted = emittedRadiance( scene.lights, hit, dir, paths.bsdfPdf[path] );
+		radiance[paths.pixel[path]] += paths.throughput( path ) * emitted;
+	};
+
+	// bounced paths go to nextPaths in sorted order, so the misses before them leave no holes; the ones
+	// Russian roulette ends (`u` is its random number) are keyed to be sorted out after the live ones
+	auto bounce =
+	    [this, depth, missEnd]( int i, uint32_t path, const Vec3 &p, const Vec3 &dir, float pdf, float u )
+	{
+		int  slot       = i - missEnd;
+		Vec3 throughput = paths.throughput( path ) * pathHits[path].color;
+		if ( !surviveRoulette( throughput, depth + 1, settings.rouletteDepth, u ) )
+		{
+			pathKeys[slot] = PATH_ENDED;
+			return;
+		}
+		nextPaths.set( slot, Ray( p + dir * 0.001f, dir ), throughput, pdf, paths.pixel[path] );
+		pathKeys[slot] = directionOctant( dir );
+	};
+
+	forEachChunk( reflectiveEnd - missEnd,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int worker )
+	              {
+		              std::mt19937                         &rng = workerRngs[worker];
+		              std::uniform_real_distribution<float> dist( 0, 1 );
+		              for ( int i = missEnd + begin; i < missEnd + end; i++ )
+		              {
+			              uint32_t   path = pathOrder[i];
+			              const Hit &hit  = pathHits[path];
+			              Vec3       dir  = paths.direction( path );
+			              Vec3       p    = paths.origin( path ) + dir * hit.t;
+			              emit( path, hit, dir );
+			              if ( !lastDepth )
+				              bounce( i, path, p, reflect( dir, hit.normal ).normalize(), 0.0f, dist( rng ) );
+		              }
+	              } );
+
+	forEachChunk( diffuseEnd - reflectiveEnd,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int worker )
+	              {
+		              std::mt19937                         &rng = workerRngs[worker];
+		              std::uniform_real_distribution<float> dist( 0, 1 );
+		              for ( int i = reflectiveEnd + begin; i < reflectiveEnd + end; i++ )
+		              {
+			              uint32_t   path = pathOrder[i];
+			              const Hit &hit  = pathHits[path];
+			              Vec3       dir  = paths.direction( path );
+			              Vec3       p    = paths.origin( path ) + dir * hit.t;
+			              emit( path, hit, dir );
+			              if ( lastDepth )
+				              continue;
+
+			              Vec3        normal = faceForward( hit.normal, dir );
+			              float       u0 = dist( rng ), u1 = dist( rng ), u2 = dist( rng );
+			              DirectLight direct;
+			              int         shadow = i - reflectiveEnd;
+			              if ( sampleDirectLight( scene.lights, p, normal, hit.color, u0, u1, u2, direct ) )
+				              shadows.set( shadow,
+				                           Ray( p + direct.dir * 0.001f, direct.dir ),
+				                           direct.distance - 0.002f,
+				                           paths.throughput( path ) * direct.radiance,
+				                           paths.pixel[path] );
+			              else
+				              shadows.maxT[shadow] = 0.0f;
+
+			              float r1        = dist( rng );
+			              float r2        = dist( rng );
+			              Vec3  bounceDir = sampleCosineHemisphere( normal, r1, r2 );
+			              bounce( i, path, p, bounceDir, normal.dot( bounceDir ) / M_PI, dist( rng ) );
+		              }
+	              } );
+
+	if ( lastDepth )
+	{
+		paths.size = 0;
+		return;
+	}
+
+	shadows.size = diffuseEnd - reflectiveEnd;
+	uint32_t octantStart[DIRECTION_OCTANT_COUNT + 2];
+	sortPaths( diffuseEnd - missEnd, DIRECTION_OCTANT_COUNT + 1, octantStart );
+	nextPaths.size = octantStart[PATH_ENDED];
+	forEachChunk( nextPaths.size,
+	              WAVEFRONT_CHUNK,
+	              [this]( int begin, int end, int )
+	              {
+		              for ( int i = begin; i < end; i++ )
+			              paths.copy( i, nextPaths, pathOrder[i] );
+	              } );
+	paths.size = nextPaths.size;
+}
+
+// Tests the shadow rays queued by shadePaths() and adds the light of the unoccluded ones. Every pixel has
+// at most one path and so at most one shadow ray, so the adds do not race.
+void Renderer::traceShadows( const Scene &scene )
+{
+	forEachChunk( shadows.size,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int worker )
+	              {
+		              int traced = 0;
+		              for ( int i = begin; i < end; i++ )
+		              {
+			              if ( shadows.maxT[i] <= 0.0f )
+				              continue;
+			              traced++;
+			              if ( !occludedScene( shadows.ray( i ), scene, shadows.maxT[i] ) )
+				              radiance[shadows.pixel[i]] += shadows.radiance( i );
+		              }
+		              workerRays[worker] += traced;
+		              STATS_ADD( shadowRays, traced );
+	              } );
+	shadows.size = 0;
+}
+
+// Stable parallel counting sort of the indices [0, count) by `pathKeys` into `pathOrder`. `groupStart`
+// gets keyCount + 1 entries: key k occupies pathOrder[groupStart[k], groupStart[k + 1]).
+void Renderer::sortPaths( int count, int keyCount, uint32_t *groupStart )
+{
+	const int chunks = ( count + WAVEFRONT_CHUNK - 1 ) / WAVEFRONT_CHUNK;
+	keyCounts.assign( size_t( chunks ) * keyCount, 0 );
+	forEachChunk( count,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int )
+	              {
+		              uint32_t *counts = &keyCounts[size_t( begin / WAVEFRONT_CHUNK ) * keyCount];
+		              for ( int i = begin; i < end; i++ )
+			              counts[pathKeys[i]]++;
+	              } );
+
+	// key-major prefix sum: every chunk's share of key 0 in chunk order, then of key 1, ...
+	uint32_t sum = 0;
+	for ( int key = 0; key < keyCount; key++ )
+	{
+		groupStart[key] = sum;
+		for ( int chunk = 0; chunk < chunks; chunk++ )
+		{
+			uint32_t n                                  = keyCounts[size_t( chunk ) * keyCount + key];
+			keyCounts[size_t( chunk ) * keyCount + key] = sum;
+			sum += n;
+		}
+	}
+	groupStart[keyCount] = sum;
+
+	forEachChunk( count,
+	              WAVEFRONT_CHUNK,
+	              [&]( int begin, int end, int )
+	              {
+		              uint32_t *offsets = &keyCounts[size_t( begin / WAVEFRONT_CHUNK ) * keyCount];
+		              for ( int i = begin; i < end; i++ )
+			              pathOrder[offsets[pathKeys[i]]++] = i;
+	              } );
+}
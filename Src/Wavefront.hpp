@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Math.hpp"
+
+// Paths of one bounce for the wavefront integrator, structure-of-arrays so every stage only streams the
+// fields it uses. Sized once for a whole frame and reused, so frames allocate nothing.
+struct PathQueue
+{
+	std::vector<float>    originX, originY, originZ;
+	std::vector<float>    dirX, dirY, dirZ;
+	std::vector<float>    throughputX, throughputY, throughputZ; // product of the albedos so far
+	std::vector<float>    bsdfPdf; // density the ray was sampled with, 0 for camera rays and mirror bounces
+	std::vector<uint32_t> pixel;
+	int                   size = 0;
+
+	void resize( int capacity );
+
+	Vec3 origin( int i ) const
+	{
+		return Vec3( originX[i], originY[i], originZ[i] );
+	}
+
+	Vec3 direction( int i ) const
+	{
+		return Vec3( dirX[i], dirY[i], dirZ[i] );
+	}
+
+	Ray ray( int i ) const
+	{
+		return Ray( origin( i ), direction( i ) );
+	}
+
+	Vec3 throughput( int i ) const
+	{
+		return Vec3( throughputX[i], throughputY[i], throughputZ[i] );
+	}
+
+	void set( int i, const Ray &ray, const Vec3 &throughput, float pdf, uint32_t pixelIndex );
+
+	// Copies path `from` of `other` to slot `to`.
+	void copy( int to, const PathQueue &other, int from );
+};
+
+// Shadow rays of one bounce's light samples, traced as a batch after shading; an unoccluded one adds its
+// `radiance` to its pixel. Indexed like the diffuse paths that made them, a failed sample leaves maxT 0.
+struct ShadowQueue
+{
+	std::vector<float>    originX, originY, originZ;
+	std::vector<float>    dirX, dirY, dirZ;
+	std::vector<float>    maxT;
+	std::vector<float>    radianceX, radianceY, radianceZ; // light sample times path throughput
+	std::vector<uint32_t> pixel;
+	int                   size = 0;
+
+	void resize( int capacity );
+
+	Ray ray( int i ) const
+	{
+		return Ray( Vec3( originX[i], originY[i], originZ[i] ), Vec3( dirX[i], dirY[i], dirZ[i] ) );
+	}
+
+	Vec3 radiance( int i ) const
+	{
+		return Vec3( radianceX[i], radianceY[i], radianceZ[i] );
+	}
+
+	void set( int i, const Ray &ray, float distance, const Vec3 &contribution, uint32_t pixelIndex );
+};
+
+// Which shading loop a path goes to after intersection; also the order of the groups in the queue.
+enum PathKind : uint8_t
+{
+	PATH_MISS,
+	PATH_REFLECTIVE,
+	PATH_DIFFUSE,
+	PATH_KIND_COUNT,
+};
@@ -0,0 +1,468 @@
+#include "WideBVH.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "TrianglePacket.hpp"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define WIDE_BVH_X86 1
+#include <immintrin.h>
+#else
+#define WIDE_BVH_X86 0
+#endif
+
+template <int N>
+WideBVHNode<N>::WideBVHNode()
+{
+	// inverted bounds never pass the slab test, so unused lanes need no special casing
+	for ( int lane = 0; lane < N; lane++ )
+	{
+		for ( int axis = 0; axis < 3; axis++ )
+		{
+			bounds[axis][lane]     = std::numeric_limits<float>::infinity();
+			bounds[axis + 3][lane] = -std::numeric_limits<float>::infinity();
+		}
+		child[lane] = 0;
+		count[lane] = 0;
+	}
+}
+
+template struct WideBVHNode<4>;
+template struct WideBVHNode<8>;
+
+int preferredBVHWidth()
+{
+#if WIDE_BVH_X86
+	static const int width = __builtin_cpu_supports( "avx2" ) ? 8 : 4;
+	return width;
+#else
+	return 2;
+#endif
+}
+
+namespace
+{
+
+template <int N>
+void setLaneBounds( WideBVHNode<N> &node, int lane, const AABB &box )
+{
+	node.bounds[0][lane] = box.min.x;
+	node.bounds[1][lane] = box.min.y;
+	node.bounds[2][lane] = box.min.z;
+	node.bounds[3][lane] = box.max.x;
+	node.bounds[4][lane] = box.max.y;
+	node.bounds[5][lane] = box.max.z;
+}
+
+template <int N>
+AABB nodeBounds( const WideBVHNode<N> &node )
+{
+	AABB box;
+	for ( int lane = 0; lane < N; lane++ )
+	{
+		if ( node.count[lane] > 0 || node.child[lane] != 0 )
+		{
+			Vec3 min( node.bounds[0][lane], node.bounds[1][lane], node.bounds[2][lane] );
+			Vec3 max( node.bounds[3][lane], node.bounds[4][lane], node.bounds[5][lane] );
+			box = AABB::combine( box, AABB( min, max ) );
+		}
+	}
+	return box;
+}
+
+// Refits the subtree at `nodeIdx` bottom-up. Nodes `levels` below it are taken as already refitted;
+// -1 refits the whole subtree.
+template <int N>
+AABB refitWide( WideBVHNode<N> *nodes, uint32_t nodeIdx, const Triangle *triangles, int levels )
+{
+	WideBVHNode<N> &node = nodes[nodeIdx];
+	if ( levels == 0 )
+		return nodeBounds( node );
+
+	AABB bounds;
+	for ( int lane = 0; lane < N; lane++ )
+	{
+		AABB box;
+		if ( node.count[lane] > 0 )
+		{
+			for ( uint32_t i = node.child[lane]; i < node.child[lane] + node.count[lane]; i++ )
+			{
+				box = AABB::combine( box, triangles[i].bounds() );
+			}
+		}
+		else if ( node.child[lane] != 0 )
+		{
+			box = refitWide( nodes, node.child[lane], triangles, levels - 1 );
+		}
+		else
+		{
+			continue;
+		}
+		setLaneBounds( node, lane, box );
+		bounds = AABB::combine( bounds, box );
+	}
+	return bounds;
+}
+
+// The subtrees two levels below the root (at most N * N) are refitted in parallel, then the nodes above.
+template <int N>
+void refitWideParallel( std::vector<WideBVHNode<N>> &nodes, const Triangle *triangles, ThreadPool &pool )
+{
+	if ( nodes.empty() )
+		return;
+
+	struct Job
+	{
+		WideBVHNode<N> *nodes;
+		const Triangle *triangles;
+		uint32_t        roots[N * N];
+	} job;
+	job.nodes     = nodes.data();
+	job.triangles = triangles;
+
+	int                   rootCount = 0;
+	const WideBVHNode<N> &root      = nodes[0];
+	for ( int lane = 0; lane < N; lane++ )
+	{
+		if ( root.count[lane] > 0 || root.child[lane] == 0 )
+			continue;
+		const WideBVHNode<N> &child = nodes[root.child[lane]];
+		for ( int childLane = 0; childLane < N; childLane++ )
+		{
+			if ( child.count[childLane] == 0 && child.child[childLane] != 0 )
+				job.roots[rootCount++] = child.child[childLane];
+		}
+	}
+
+	pool.parallelFor( rootCount,
+	                  [&job]( int i, int ) { refitWide( job.nodes, job.roots[i], job.triangles, -1 ); } );
+	refitWide( nodes.data(), 0, triangles, 2 );
+}
+
+#if WIDE_BVH_X86
+
+// Turns the binary subtree at `binaryIdx` into a wide node, opening the interior child with the
+// largest surface area until all N lanes are used or only leaves remain.
+template <int N>
+uint32_t collapse( const std::vector<BVHNode>  &binary,
+                   uint32_t                     binaryIdx,
+                   std::vector<WideBVHNode<N>> &nodes )
+{
+	uint32_t nodeIdx = nodes.size();
+	nodes.emplace_back();
+
+	uint32_t children[N];
+	int      numChildren = 0;
+	if ( binary[binaryIdx].isLeaf() )
+	{
+		children[numChildren++] = binaryIdx;
+	}
+	else
+	{
+		children[numChildren++] = binaryIdx + 1;
+		children[numChildren++] = binary[binaryIdx].offset;
+	}
+
+	while ( numChildren < N )
+	{
+		int   widest     = -1;
+		float widestArea = -1.0f;
+		for ( int i = 0; i < numChildren; i++ )
+		{
+			const BVHNode &child = binary[children[i]];
+			if ( !child.isLeaf() && child.bbox.surfaceArea() > widestArea )
+			{
+				widest     = i;
+				widestArea = child.bbox.surfaceArea();
+			}
+		}
+		if ( widest < 0 )
+			break;
+
+		uint32_t opened         = children[widest];
+		children[widest]        = opened + 1;
+		children[numChildren++] = binary[opened].offset;
+	}
+
+	for ( int lane = 0; lane < numChildren; lane++ )
+	{
+		const BVHNode &child = binary[children[lane]];
+
+		setLaneBounds( nodes[nodeIdx], lane, child.bbox );
+		if ( child.isLeaf() )
+		{
+			nodes[nodeIdx].child[lane] = child.offset;
+			nodes[nodeIdx].count[lane] = child.count;
+		}
+		else
+		{
+			uint32_t childIdx          = collapse( binary, children[lane], nodes );
+			nodes[nodeIdx].child[lane] = childIdx;
+		}
+	}
+
+	return nodeIdx;
+}
+
+struct StackEntry
+{
+	uint32_t node;
+	float    tEntry;
+};
+
+// Visits the lanes that passed the slab test front to back: leaves are intersected right away, interior
+// children still in front of the current hit are pushed farthest first so the nearest is popped next.
+template <int N>
+bool visitLanes( const WideBVHNode<N> &node,
+                 unsigned              mask,
+                 const float          *tEntry,
+                 const Ray            &ray,
+                 const Triangle       *triangles,
+                 const TrianglePacket *packets,
+                 Hit                  &hit,
+                 StackEntry           *stack,
+                 int                  &stackSize )
+{
+	int   lanes[N];
+	float dist[N];
+	int   numLanes = 0;
+	while ( mask )
+	{
+		int   lane = __builtin_ctz( mask );
+		float t    = tEntry[lane];
+		mask &= mask - 1;
+
+		int i = numLanes++;
+		while ( i > 0 && dist[i - 1] > t )
+		{
+			lanes[i] = lanes[i - 1];
+			dist[i]  = dist[i - 1];
+			i--;
+		}
+		lanes[i] = lane;
+		dist[i]  = t;
+	}
+
+	bool hitAnything = false;
+	for ( int i = 0; i < numLanes; i++ )
+	{
+		int lane = lanes[i];
+		if ( node.count[lane] > 0 && dist[i] <= hit.t )
+		{
+			hitAnything |=
+			    intersectTriangleRange( ray, triangles, packets, node.child[lane], node.count[lane], hit );
+		}
+	}
+
+	for ( int i = numLanes - 1; i >= 0; i-- )
+	{
+		int lane = lanes[i];
+		if ( node.count[lane] == 0 && dist[i] <= hit.t )
+		{
+			stack[stackSize++] = { node.child[lane], dist[i] };
+		}
+	}
+
+	return hitAnything;
+}
+
+// Pops the nearest stacked node that can still hold a closer hit; false once the stack runs dry.
+bool popNode( StackEntry *stack, int &stackSize, const Hit &hit, uint32_t &nodeIdx )
+{
+	while ( stackSize > 0 )
+	{
+		const StackEntry &entry = stack[--stackSize];
+		if ( entry.tEntry <= hit.t )
+		{
+			nodeIdx = entry.node;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool intersectWide4( const WideBVHNode<4> *nodes,
+                     const Ray            &ray,
+                     const Triangle       *triangles,
+                     const TrianglePacket *packets,
+                     Hit                  &hit )
+{
+	// pick the entry/exit plane per axis once from the ray direction sign
+	int nearX = ray.invDir.x < 0 ? 3 : 0;
+	int nearY = ray.invDir.y < 0 ? 4 : 1;
+	int nearZ = ray.invDir.z < 0 ? 5 : 2;
+	int farX  = ( nearX + 3 ) % 6;
+	int farY  = ( nearY + 3 ) % 6;
+	int farZ  = ( nearZ + 3 ) % 6;
+
+	const __m128 ox      = _mm_set1_ps( ray.origin.x );
+	const __m128 oy      = _mm_set1_ps( ray.origin.y );
+	const __m128 oz      = _mm_set1_ps( ray.origin.z );
+	const __m128 ix      = _mm_set1_ps( ray.invDir.x );
+	const __m128 iy      = _mm_set1_ps( ray.invDir.y );
+	const __m128 iz      = _mm_set1_ps( ray.invDir.z );
+	const __m128 epsilon = _mm_set1_ps( 0.001f );
+
+	StackEntry stack[BVH_MAX_DEPTH * 3];
+	int        stackSize   = 0;
+	bool       hitAnything = false;
+	uint32_t   nodeIdx     = 0;
+	uint32_t   visited     = 0;
+	do
+	{
+		const WideBVHNode<4> &node = nodes[nodeIdx];
+		visited++;
+
+		__m128 t0x = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[nearX] ), ox ), ix );
+		__m128 t0y = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[nearY] ), oy ), iy );
+		__m128 t0z = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[nearZ] ), oz ), iz );
+		__m128 t1x = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[farX] ), ox ), ix );
+		__m128 t1y = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[farY] ), oy ), iy );
+		__m128 t1z = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[farZ] ), oz ), iz );
+
+		__m128 tEntry  = _mm_max_ps( _mm_max_ps( t0x, t0y ), t0z );
+		__m128 tExit   = _mm_min_ps( _mm_min_ps( t1x, t1y ), t1z );
+		__m128 overlap = _mm_cmple_ps( tEntry, tExit );
+		__m128 inFront =
+		    _mm_and_ps( _mm_cmpge_ps( tExit, epsilon ), _mm_cmple_ps( tEntry, _mm_set1_ps( hit.t ) ) );
+		__m128 valid   = _mm_and_ps( overlap, inFront );
+
+		alignas( 16 ) float entry[4];
+		_mm_store_ps( entry, tEntry );
+		unsigned mask = _mm_movemask_ps( valid );
+		hitAnything |= visitLanes( node, mask, entry, ray, triangles, packets, hit, stack, stackSize );
+	} while ( popNode( stack, stackSize, hit, nodeIdx ) );
+
+	STATS_ADD( nodesVisited, visited );
+	STATS_ADD( boxTests, 4 * visited );
+	return hitAnything;
+}
+
+__attribute__( ( target( "avx2" ) ) ) bool intersectWide8( const WideBVHNode<8> *nodes,
+                                                           const Ray            &ray,
+                                                           const Triangle       *triangles,
+                                                           const TrianglePacket *packets,
+                                                           Hit                  &hit )
+{
+	int nearX = ray.invDir.x < 0 ? 3 : 0;
+	int nearY = ray.invDir.y < 0 ? 4 : 1;
+	int nearZ = ray.invDir.z < 0 ? 5 : 2;
+	int farX  = ( nearX + 3 ) % 6;
+	int farY  = ( nearY + 3 ) % 6;
+	int farZ  = ( nearZ + 3 ) % 6;
+
+	const __m256 ox      = _mm256_set1_ps( ray.origin.x );
+	const __m256 oy      = _mm256_set1_ps( ray.origin.y );
+	const __m256 oz      = _mm256_set1_ps( ray.origin.z );
+	const __m256 ix      = _mm256_set1_ps( ray.invDir.x );
+	const __m256 iy      = _mm256_set1_ps( ray.invDir.y );
+	const __m256 iz      = _mm256_set1_ps( ray.invDir.z );
+	const __m256 epsilon = _mm256_set1_ps( 0.001f );
+
+	StackEntry stack[BVH_MAX_DEPTH * 7];
+	int        stackSize   = 0;
+	bool       hitAnything = false;
+	uint32_t   nodeIdx     = 0;
+	uint32_t   visited     = 0;
+	do
+	{
+		const WideBVHNode<8> &node = nodes[nodeIdx];
+		visited++;
+
+		__m256 t0x = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[nearX] ), ox ), ix );
+		__m256 t0y = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[nearY] ), oy ), iy );
+		__m256 t0z = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[nearZ] ), oz ), iz );
+		__m256 t1x = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[farX] ), ox ), ix );
+		__m256 t1y = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[farY] ), oy ), iy );
+		__m256 t1z = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[farZ] ), oz ), iz );
+
+		__m256 tEntry  = _mm256_max_ps( _mm256_max_ps( t0x, t0y ), t0z );
+		__m256 tExit   = _mm256_min_ps( _mm256_min_ps( t1x, t1y ), t1z );
+		__m256 overlap = _mm256_cmp_ps( tEntry, tExit, _CMP_LE_OQ );
+		__m256 inFront = _mm256_and_ps( _mm256_cmp_ps( tExit, epsilon, _CMP_GE_OQ ),
+		                                _mm256_cmp_ps( tEntry, _mm256_set1_ps( hit.t ), _CMP_LE_OQ ) );
+		__m256 valid   = _mm256_and_ps( overlap, inFront );
+
+		alignas( 32 ) float entry[8];
+		_mm256_store_ps( entry, tEntry );
+		unsigned mask = _mm256_movemask_ps( valid );
+		hitAnything |= visitLanes( node, mask, entry, ray, triangles, packets, hit, stack, stackSize );
+	} while ( popNode( stack, stackSize, hit, nodeIdx ) );
+
+	STATS_ADD( nodesVisited, visited );
+	STATS_ADD( boxTests, 8 * visited );
+	return hitAnything;
+}
+
+#endif
+
+} // namespace
+
+void WideBVH::build( const TriangleBVH &binary, int width )
+{
+	this->width = 0;
+	nodes4.clear();
+	nodes8.clear();
+#if WIDE_BVH_X86
+	if ( binary.empty() )
+		return;
+
+	if ( width == 4 )
+	{
+		collapse( binary.nodes, 0, nodes4 );
+		nodes4.shrink_to_fit();
+		this->width = 4;
+	}
+	else if ( width == 8 )
+	{
+		collapse( binary.nodes, 0, nodes8 );
+		nodes8.shrink_to_fit();
+		this->width = 8;
+	}
+#endif
+}
+
+void WideBVH::refit( const Triangle *triangles, ThreadPool &pool )
+{
+	if ( width == 8 )
+		refitWideParallel( nodes8, triangles, pool );
+	else if ( width == 4 )
+		refitWideParallel( nodes4, triangles, pool );
+}
+
+const void *WideBVH::data() const
+{
+	if ( width == 8 )
+		return nodes8.data();
+	if ( width == 4 )
+		return nodes4.data();
+	return nullptr;
+}
+
+size_t WideBVH::size() const
+{
+	return width == 8 ? nodes8.size() : width == 4 ? nodes4.size() : 0;
+}
+
+bool WideBVH::intersect( const Ray            &ray,
+                         const Triangle       *triangles,
+                         const TrianglePacket *packets,
+                         Hit                  &hit ) const
+{
+	return intersectWideBVH( width, data(), ray, triangles, packets, hit );
+}
+
+bool intersectWideBVH( int                   width,
+                       const void           *nodes,
+                       const Ray            &ray,
+                       const Triangle       *triangles,
+                       const TrianglePacket *packets,
+                       Hit                  &hit )
+{
+#if WIDE_BVH_X86
+	if ( width == 8 )
+		return intersectWide8( static_cast<const WideBVHNode<8> *>( nodes ), ray, triangles, packets, hit );
+	if ( width == 4 )
+		return intersectWide4( static_cast<const WideBVHNode<4> *>( nodes ), ray, triangles, packets, hit );
+#endif
+	return false;
+}
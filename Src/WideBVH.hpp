@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Math.hpp"
+
+class ThreadPool;
+
+// N-ary BVH collapsed from a binary TriangleBVH. Child bounds are stored SoA (bounds[plane][lane],
+// planes ordered minX, minY, minZ, maxX, maxY, maxZ) so one SIMD slab test covers every child.
+// Leaf lanes reference the same triangle ranges as the binary leaves they came from.
+template <int N>
+struct alignas( N * sizeof( float ) ) WideBVHNode
+{
+	float    bounds[6][N];
+	uint32_t child[N]; // interior lane: index of the child node, leaf lane: first triangle
+	uint32_t count[N]; // leaf lane: triangle count, 0 for interior and unused lanes
+
+	WideBVHNode();
+};
+
+// Widest BVH the running CPU can traverse with SIMD: 8 with AVX2, 4 with SSE, 2 (binary) otherwise.
+int preferredBVHWidth();
+
+struct WideBVH
+{
+	int                         width = 0; // 4 or 8 once built
+	std::vector<WideBVHNode<4>> nodes4;
+	std::vector<WideBVHNode<8>> nodes8;
+
+	// Collapses `binary` into a `width`-ary tree; any other width leaves this empty.
+	void build( const TriangleBVH &binary, int width );
+
+	// Recomputes every lane box after the triangles moved in place, keeping the tree as it is.
+	void refit( const Triangle *triangles, ThreadPool &pool );
+
+	bool empty() const
+	{
+		return width == 0;
+	}
+
+	// nodes4 or nodes8, whichever is in use
+	const void *data() const;
+	size_t      size() const;
+
+	bool intersect( const Ray            &ray,
+	                const Triangle       *triangles,
+	                const TrianglePacket *packets,
+	                Hit                  &hit ) const;
+};
+
+// WideBVH::intersect() on a bare node array of the given width, e.g. one mapped from a scene cache.
+bool intersectWideBVH( int                   width,
+                       const void           *nodes,
+                       const Ray            &ray,
+                       const Triangle       *triangles,
+                       const TrianglePacket *packets,
+                       Hit                  &hit );